@@ -0,0 +1,582 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "archive.h"
+#include "trace.h"
+
+#include <string.h>
+#include <gio/gio.h>
+
+#define TAR_BLOCK_SIZE 512
+
+#define ZIP_LOCAL_MAGIC 0x04034b50
+#define ZIP_CENTRAL_MAGIC 0x02014b50
+#define ZIP_END_MAGIC 0x06054b50
+#define ZIP64_END_MAGIC 0x06064b50
+#define ZIP64_LOCATOR_MAGIC 0x07064b50
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+#define ZIP_FLAG_ENCRYPTED 0x0001
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP64_END_SIZE 56
+#define ZIP64_LOCATOR_SIZE 20
+//End record is followed by comment of up to 64 KiB
+#define ZIP_END_SEARCH (ZIP_END_SIZE + 0xffff)
+
+typedef struct ArchiveMember {
+    char *name;
+    guint64 offset;         //Data of member in archive
+    guint64 size;           //Bytes of data in archive
+    gboolean deflated;
+} ArchiveMember;
+
+struct Archive {
+    volatile gint ref_count;
+    char *filename;
+    GMappedFile *mapped;
+    const byte *data;
+    guint64 size;
+    GArray *members;
+    GHashTable *names;      //Member name to member number
+};
+
+struct ArchiveReader {
+    Archive *archive;
+    const byte *data;       //Data of member in mapping
+    size_t size;
+    size_t pos;
+    GInputStream *stream;   //Decompressing stream or NULL if stored
+};
+
+static inline guint32
+get_le16 (const byte *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline guint32
+get_le32 (const byte *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+static inline guint64
+get_le64 (const byte *p)
+{
+    return get_le32 (p) | ((guint64) get_le32 (p + 4) << 32);
+}
+
+static void
+archive_add (Archive *archive, char *name, guint64 offset, guint64 size,
+        gboolean deflated)
+{
+    ArchiveMember member;
+
+    member.name = name;
+    member.offset = offset;
+    member.size = size;
+    member.deflated = deflated;
+    g_array_append_val (archive->members, member);
+    //Member added to tar later replaces earlier one
+    g_hash_table_insert (archive->names, name, 
+            GINT_TO_POINTER (archive->members->len - 1));
+}
+
+static guint64
+tar_number (const byte *field, int length)
+{
+    guint64 value = 0;
+    int i;
+
+    //Big numbers are stored in base 256 by GNU tar
+    if (field[0] & 0x80) {
+        value = field[0] & 0x7f;
+        for (i = 1; i < length; ++i) {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    for (i = 0; i < length && field[i] == ' '; ++i) {
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        value = value * 8 + field[i] - '0';
+    }
+    return value;
+}
+
+static gboolean
+tar_header_check (const byte *header)
+{
+    guint64 sum = 0;
+    int i;
+
+    //Checksum is counted with its own field filled by spaces
+    for (i = 0; i < TAR_BLOCK_SIZE; ++i) {
+        sum += i >= 148 && i < 156 ? ' ' : header[i];
+    }
+    return sum == tar_number (header + 148, 8);
+}
+
+static char *
+tar_name (const byte *header)
+{
+    char *name, *prefix, *result;
+
+    name = g_strndup ((const char *) header, 100);
+    if (memcmp (header + 257, "ustar", 5) != 0 || header[345] == '\0') {
+        return name;
+    }
+    prefix = g_strndup ((const char *) header + 345, 155);
+    result = g_strconcat (prefix, "/", name, NULL);
+    g_free (prefix);
+    g_free (name);
+    return result;
+}
+
+/**
+ *  Finds path record in pax extended header, which is a sequence of
+ *  "length key=value\n" records.
+ */
+static char *
+tar_pax_path (const byte *data, guint64 size)
+{
+    const byte *end = data + size, *p, *key;
+    guint64 length;
+
+    while (data < end) {
+        length = 0;
+        for (p = data; p < end && *p >= '0' && *p <= '9'; ++p) {
+            length = length * 10 + *p - '0';
+        }
+        if (p >= end || *p != ' ' || length == 0 || 
+                length > (guint64) (end - data)) {
+            break;
+        }
+        key = p + 1;
+        if (data + length - key > 5 && memcmp (key, "path=", 5) == 0) {
+            return g_strndup ((const char *) key + 5, 
+                    data + length - 1 - (key + 5));
+        }
+        data += length;
+    }
+    return NULL;
+}
+
+static gboolean
+tar_index (Archive *archive)
+{
+    const byte *header;
+    guint64 offset = 0, size;
+    char *long_name = NULL;
+
+    if (archive->size < TAR_BLOCK_SIZE || 
+            !tar_header_check (archive->data)) {
+        return FALSE;
+    }
+    while (offset + TAR_BLOCK_SIZE <= archive->size) {
+        header = archive->data + offset;
+        //Archive ends with zero blocks
+        if (header[0] == '\0') {
+            break;
+        }
+        if (!tar_header_check (header)) {
+            put_warning ("Broken tar header in '%s'", archive->filename);
+            break;
+        }
+        size = tar_number (header + 124, 12);
+        offset += TAR_BLOCK_SIZE;
+        if (size > archive->size - offset) {
+            put_warning ("Tar '%s' is truncated", archive->filename);
+            break;
+        }
+
+        switch (header[156]) {
+        case 'L':
+            //GNU long name of next member
+            g_free (long_name);
+            long_name = g_strndup ((const char *) archive->data + offset, 
+                    size);
+            break;
+        case 'x':
+            g_free (long_name);
+            long_name = tar_pax_path (archive->data + offset, size);
+            break;
+        case '0':
+        case '7':
+        case '\0':
+            archive_add (archive, long_name != NULL ? long_name : 
+                    tar_name (header), offset, size, FALSE);
+            long_name = NULL;
+            break;
+        default:
+            //Directories and links have no data of their own
+            g_free (long_name);
+            long_name = NULL;
+            break;
+        }
+        offset += (size + TAR_BLOCK_SIZE - 1) / 
+                TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+    }
+    g_free (long_name);
+    return TRUE;
+}
+
+/**
+ *  Takes 64 bit values from zip64 extra field. Only values, which are
+ *  saturated in central header, are stored there in fixed order.
+ */
+static void
+zip64_extra (const byte *extra, int length, guint64 *size, guint64 *csize,
+        guint64 *offset)
+{
+    const byte *end = extra + length, *field, *field_end;
+
+    while (extra + 4 <= end) {
+        field = extra + 4;
+        field_end = field + get_le16 (extra + 2);
+        if (field_end > end) {
+            return;
+        }
+        if (get_le16 (extra) == ZIP64_EXTRA_ID) {
+            if (*size == 0xffffffff && field + 8 <= field_end) {
+                *size = get_le64 (field);
+                field += 8;
+            }
+            if (*csize == 0xffffffff && field + 8 <= field_end) {
+                *csize = get_le64 (field);
+                field += 8;
+            }
+            if (*offset == 0xffffffff && field + 8 <= field_end) {
+                *offset = get_le64 (field);
+            }
+            return;
+        }
+        extra = field_end;
+    }
+}
+
+/**
+ *  Checks that record of size bytes at offset is inside archive.
+ */
+static gboolean
+zip_fits (const Archive *archive, guint64 offset, guint64 size)
+{
+    return archive->size >= size && offset <= archive->size - size;
+}
+
+static gboolean
+zip_index (Archive *archive)
+{
+    const byte *data = archive->data, *entry, *local;
+    guint64 end = 0, zip64, count, offset, i, pos;
+    guint64 size, csize, local_offset, data_offset;
+    int name_length, extra_length, comment_length, method, flags;
+    char *name;
+
+    if (archive->size < ZIP_END_SIZE) {
+        return FALSE;
+    }
+    //End record is searched backwards over comment
+    for (pos = archive->size - ZIP_END_SIZE + 1; pos > 0 && 
+            archive->size - pos < ZIP_END_SEARCH; --pos) {
+        if (get_le32 (data + pos - 1) == ZIP_END_MAGIC) {
+            end = pos;
+            break;
+        }
+    }
+    if (end == 0) {
+        return FALSE;
+    }
+    --end;
+    count = get_le16 (data + end + 10);
+    offset = get_le32 (data + end + 16);
+
+    //Archives over 4 GiB have zip64 end record found by locator
+    if ((count == 0xffff || offset == 0xffffffff) && 
+            end >= ZIP64_LOCATOR_SIZE && get_le32 (data + end - 
+                ZIP64_LOCATOR_SIZE) == ZIP64_LOCATOR_MAGIC) {
+        zip64 = get_le64 (data + end - ZIP64_LOCATOR_SIZE + 8);
+        if (zip_fits (archive, zip64, ZIP64_END_SIZE) && 
+                get_le32 (data + zip64) == ZIP64_END_MAGIC) {
+            count = get_le64 (data + zip64 + 32);
+            offset = get_le64 (data + zip64 + 48);
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (!zip_fits (archive, offset, ZIP_CENTRAL_SIZE) ||
+                get_le32 (data + offset) != ZIP_CENTRAL_MAGIC) {
+            put_warning ("Broken zip directory in '%s'", archive->filename);
+            break;
+        }
+        entry = data + offset;
+        flags = get_le16 (entry + 8);
+        method = get_le16 (entry + 10);
+        csize = get_le32 (entry + 20);
+        size = get_le32 (entry + 24);
+        name_length = get_le16 (entry + 28);
+        extra_length = get_le16 (entry + 30);
+        comment_length = get_le16 (entry + 32);
+        local_offset = get_le32 (entry + 42);
+        if (offset + ZIP_CENTRAL_SIZE + name_length + extra_length > 
+                archive->size) {
+            put_warning ("Broken zip directory in '%s'", archive->filename);
+            break;
+        }
+        zip64_extra (entry + ZIP_CENTRAL_SIZE + name_length, extra_length,
+                &size, &csize, &local_offset);
+        name = g_strndup ((const char *) entry + ZIP_CENTRAL_SIZE, 
+                name_length);
+        offset += ZIP_CENTRAL_SIZE + name_length + extra_length + 
+                comment_length;
+
+        //Directories end with slash
+        if (g_str_has_suffix (name, "/")) {
+            g_free (name);
+            continue;
+        }
+        if ((flags & ZIP_FLAG_ENCRYPTED) || (method != ZIP_METHOD_STORED &&
+                    method != ZIP_METHOD_DEFLATED)) {
+            put_warning ("Member '%s' of '%s' is encrypted or compressed "
+                    "with unsupported method", name, archive->filename);
+            g_free (name);
+            continue;
+        }
+        //Data follows local header, its extra field may differ
+        if (!zip_fits (archive, local_offset, ZIP_LOCAL_SIZE) ||
+                get_le32 (data + local_offset) != ZIP_LOCAL_MAGIC) {
+            put_warning ("Broken member '%s' of '%s'", name, 
+                    archive->filename);
+            g_free (name);
+            continue;
+        }
+        local = data + local_offset;
+        data_offset = local_offset + ZIP_LOCAL_SIZE + 
+                get_le16 (local + 26) + get_le16 (local + 28);
+        if (data_offset > archive->size || 
+                csize > archive->size - data_offset) {
+            put_warning ("Member '%s' of '%s' is truncated", name, 
+                    archive->filename);
+            g_free (name);
+            continue;
+        }
+        archive_add (archive, name, data_offset, csize, 
+                method == ZIP_METHOD_DEFLATED);
+    }
+    return TRUE;
+}
+
+static gboolean
+has_suffix (const char *filename, const char *suffix)
+{
+    size_t length = strlen (filename), suffix_length = strlen (suffix);
+
+    return length > suffix_length && g_ascii_strcasecmp (
+            filename + length - suffix_length, suffix) == 0;
+}
+
+gboolean
+archive_is_archive (const char *filename)
+{
+    return has_suffix (filename, ".tar") || has_suffix (filename, ".zip");
+}
+
+gboolean
+archive_split_path (const char *path, char **filename, char **member)
+{
+    const char *colon;
+    char *prefix;
+
+    //Archive path itself may have colons
+    for (colon = strchr (path, ':'); colon != NULL; 
+            colon = strchr (colon + 1, ':')) {
+        prefix = g_strndup (path, colon - path);
+        if (archive_is_archive (prefix) && 
+                g_file_test (prefix, G_FILE_TEST_IS_REGULAR)) {
+            *filename = prefix;
+            *member = g_strdup (colon + 1);
+            return TRUE;
+        }
+        g_free (prefix);
+    }
+    return FALSE;
+}
+
+Archive *
+archive_open (const char *filename)
+{
+    Archive *archive;
+    GError *error = NULL;
+    gboolean indexed;
+    TRACE_BEGIN (stamp);
+
+    archive = calloc (1, sizeof (Archive));
+    if (archive == NULL) {
+        put_error (1, "Can not allocate memory for archive");
+    }
+    archive->mapped = g_mapped_file_new (filename, FALSE, &error);
+    if (archive->mapped == NULL) {
+        put_warning ("Can not read '%s'. %s", filename, error->message);
+        g_error_free (error);
+        free (archive);
+        TRACE_END (stamp, "archive_open");
+        return NULL;
+    }
+    archive->ref_count = 1;
+    archive->filename = g_strdup (filename);
+    archive->data = (const byte *) g_mapped_file_get_contents (
+            archive->mapped);
+    archive->size = g_mapped_file_get_length (archive->mapped);
+    archive->members = g_array_new (FALSE, FALSE, sizeof (ArchiveMember));
+    archive->names = g_hash_table_new (g_str_hash, g_str_equal);
+
+    //Tar may hold zip at its end, so format is told by name
+    indexed = has_suffix (filename, ".zip") ? zip_index (archive) : 
+            tar_index (archive);
+    TRACE_END (stamp, "archive_open");
+    if (!indexed) {
+        put_warning ("'%s' is not tar or zip archive", filename);
+        archive_unref (archive);
+        return NULL;
+    }
+    return archive;
+}
+
+Archive *
+archive_ref (Archive *archive)
+{
+    g_atomic_int_inc (&archive->ref_count);
+    return archive;
+}
+
+void
+archive_unref (Archive *archive)
+{
+    guint i;
+
+    if (archive == NULL || !g_atomic_int_dec_and_test (&archive->ref_count)) {
+        return;
+    }
+    for (i = 0; i < archive->members->len; ++i) {
+        g_free (g_array_index (archive->members, ArchiveMember, i).name);
+    }
+    g_array_free (archive->members, TRUE);
+    g_hash_table_destroy (archive->names);
+    g_mapped_file_unref (archive->mapped);
+    g_free (archive->filename);
+    free (archive);
+}
+
+const char *
+archive_get_filename (const Archive *archive)
+{
+    return archive->filename;
+}
+
+int
+archive_get_count (const Archive *archive)
+{
+    return archive->members->len;
+}
+
+const char *
+archive_get_name (const Archive *archive, int member)
+{
+    return g_array_index (archive->members, ArchiveMember, member).name;
+}
+
+int
+archive_find (const Archive *archive, const char *name)
+{
+    gpointer member;
+
+    if (!g_hash_table_lookup_extended (archive->names, name, NULL, &member)) {
+        return -1;
+    }
+    return GPOINTER_TO_INT (member);
+}
+
+ArchiveReader *
+archive_reader_new (Archive *archive, int member)
+{
+    const ArchiveMember *info;
+    ArchiveReader *reader;
+    GInputStream *compressed;
+    GZlibDecompressor *decompressor;
+
+    info = &g_array_index (archive->members, ArchiveMember, member);
+    reader = calloc (1, sizeof (ArchiveReader));
+    if (reader == NULL) {
+        put_error (1, "Can not allocate memory for archive reader");
+    }
+    reader->archive = archive_ref (archive);
+    reader->data = archive->data + info->offset;
+    reader->size = info->size;
+    if (info->deflated) {
+        //Compressed data is taken from mapping too, nothing is copied
+        compressed = g_memory_input_stream_new_from_data (reader->data,
+                reader->size, NULL);
+        decompressor = g_zlib_decompressor_new (
+                G_ZLIB_COMPRESSOR_FORMAT_RAW);
+        reader->stream = g_converter_input_stream_new (compressed,
+                G_CONVERTER (decompressor));
+        g_object_unref (decompressor);
+        g_object_unref (compressed);
+    }
+    return reader;
+}
+
+int
+archive_reader_read (ArchiveReader *reader, void *buffer, int size)
+{
+    GError *error = NULL;
+    gsize count;
+
+    if (reader->stream == NULL) {
+        count = MIN ((size_t) size, reader->size - reader->pos);
+        memcpy (buffer, reader->data + reader->pos, count);
+        reader->pos += count;
+        return count;
+    }
+    if (!g_input_stream_read_all (reader->stream, buffer, size, &count,
+                NULL, &error)) {
+        put_warning ("Can not decompress member of '%s'. %s", 
+                reader->archive->filename, error->message);
+        g_error_free (error);
+        return -1;
+    }
+    return count;
+}
+
+void
+archive_reader_free (ArchiveReader *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    if (reader->stream != NULL) {
+        g_object_unref (reader->stream);
+    }
+    archive_unref (reader->archive);
+    free (reader);
+}
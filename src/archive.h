@@ -0,0 +1,59 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "gifseeker.h"
+
+/**
+ *  Members of tar and zip archives. Used by read_gif to load gifs
+ *  without extracting them.
+ *
+ *  Archive is mapped into memory and its index of regular members is
+ *  read on open. Stored members are read straight from the mapping,
+ *  deflated zip members are decompressed while they are read, so no
+ *  member is held in memory whole. Reader keeps its archive open.
+ *  archive_split_path splits "bundle.tar:path/to/x.gif" into path of
+ *  archive and name of member, if such archive exists. Archive and
+ *  readers are not thread safe, but different readers of one archive
+ *  may be used on different threads.
+ */
+
+typedef struct Archive Archive;
+typedef struct ArchiveReader ArchiveReader;
+
+gboolean archive_is_archive (const char *filename);
+gboolean archive_split_path (const char *path, char **filename, 
+        char **member);
+
+Archive *archive_open (const char *filename);
+Archive *archive_ref (Archive *archive);
+void archive_unref (Archive *archive);
+const char *archive_get_filename (const Archive *archive);
+int archive_get_count (const Archive *archive);
+const char *archive_get_name (const Archive *archive, int member);
+int archive_find (const Archive *archive, const char *name);
+
+ArchiveReader *archive_reader_new (Archive *archive, int member);
+int archive_reader_read (ArchiveReader *reader, void *buffer, int size);
+void archive_reader_free (ArchiveReader *reader);
+
+#endif /*ARCHIVE_H*/
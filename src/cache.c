@@ -0,0 +1,843 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cache.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct CacheEntry {
+    gint64 key;
+    GList link;             //Link in tier queue, data points to entry
+    gboolean cold;
+
+    GifSnapshoot *snap;     //Hot snapshoot
+
+    byte *packed;           //Cold snapshoot
+    size_t packed_size;
+    int width, height;
+    GifSnapshootFormat format;
+    GifPalette *palette;
+    gint64 decode_time, convert_time;
+} CacheEntry;
+
+struct SnapshootCache {
+    GMutex lock;
+    GHashTable *entries;    //Key to entry of any tier
+    GQueue hot, cold;       //Most recent at head
+    size_t hot_size, cold_size;
+    guint generation;       //Incremented by cache_clear
+    SnapshootCacheStats stats;
+    SpillStore *spill;      //Tier of entries dropped from cold one
+    GArray *gifs;           //CacheGif per gif
+};
+
+typedef struct CacheGif {
+    guint64 id;             //Spill id, 0 if gif is not spilled
+    int width, height;      //Screen size, spilled snapshoots must match
+} CacheGif;
+
+/**
+ *  Cold entry in spill store. Palette colors and packed data follow.
+ */
+typedef struct SpillRecord {
+    gint32 width, height;
+    gint32 format;
+    gint32 palette;         //Palette colors are present
+    gint64 decode_time, convert_time;
+} SpillRecord;
+
+#define make_key(gif, gif_pos) (((gint64) (gif) << 32) | (guint32) (gif_pos))
+
+/**
+ *  Run-length codec. Works with units of 1 (indices) or 4 (BGRX) bytes.
+ *  Control byte c < 128 is followed by c + 1 literal units,
+ *  c >= 128 is followed by one unit repeated c - 126 times.
+ *  Literal is broken only by run of 3 units, so packed data is never
+ *  bigger than rle_bound.
+ */
+#define RLE_MAX_LITERAL 128
+#define RLE_MAX_RUN 129
+
+#define unit_equal(src, unit, a, b) \
+    ((unit) == 1 ? (src)[a] == (src)[b] : \
+        ((const guint32 *) (src))[a] == ((const guint32 *) (src))[b])
+
+static size_t
+rle_bound (size_t count, int unit)
+{
+    return count * unit + count / RLE_MAX_LITERAL + 1;
+}
+
+static size_t
+rle_pack (const byte *src, size_t count, int unit, byte *dst)
+{
+    byte *out = dst;
+    size_t i = 0, start, run;
+
+    while (i < count) {
+        run = 1;
+        while (i + run < count && run < RLE_MAX_RUN &&
+                unit_equal (src, unit, i, i + run)) {
+            ++run;
+        }
+        if (run >= 2) {
+            *out++ = (byte) (run + 126);
+            memcpy (out, src + i * unit, unit);
+            out += unit;
+            i += run;
+            continue;
+        }
+        start = i;
+        do {
+            ++i;
+        } while (i < count && i - start < RLE_MAX_LITERAL &&
+                !(i + 2 < count && unit_equal (src, unit, i, i + 1) &&
+                    unit_equal (src, unit, i, i + 2)));
+        *out++ = (byte) (i - start - 1);
+        memcpy (out, src + start * unit, (i - start) * unit);
+        out += (i - start) * unit;
+    }
+    return out - dst;
+}
+
+/**
+ *  Returns FALSE if src_size bytes of packed data end before count
+ *  units are unpacked.
+ */
+static gboolean
+rle_unpack (const byte *src, size_t src_size, size_t count, int unit, 
+        byte *dst)
+{
+    const byte *end = src + src_size;
+    size_t i = 0, n, k;
+    byte control;
+
+    while (i < count) {
+        if (src == end) {
+            return FALSE;
+        }
+        control = *src++;
+        if (control < RLE_MAX_LITERAL) {
+            n = MIN ((size_t) control + 1, count - i);
+            if ((size_t) (end - src) < n * unit) {
+                return FALSE;
+            }
+            memcpy (dst + i * unit, src, n * unit);
+            src += n * unit;
+        } else {
+            n = MIN ((size_t) control - 126, count - i);
+            if ((size_t) (end - src) < (size_t) unit) {
+                return FALSE;
+            }
+            if (unit == 1) {
+                memset (dst + i, *src, n);
+            } else {
+                for (k = 0; k < n; ++k) {
+                    memcpy (dst + (i + k) * unit, src, unit);
+                }
+            }
+            src += unit;
+        }
+        i += n;
+    }
+    return TRUE;
+}
+
+static int
+snapshoot_unit (GifSnapshootFormat format)
+{
+    return format == GIF_SNAPSHOOT_INDEXED ? 1 : 4;
+}
+
+static void
+entry_free (CacheEntry *entry)
+{
+    if (entry->snap != NULL) {
+        free_snapshoot (entry->snap);
+    }
+    palette_unref (entry->palette);
+    free (entry->packed);
+    free (entry);
+}
+
+static size_t
+entry_cold_size (const CacheEntry *entry)
+{
+    return entry->packed_size +
+        (entry->palette != NULL ? sizeof (GifPalette) : 0);
+}
+
+/**
+ *  Snapshoot shared by hot entries is charged to hot tier once,
+ *  bytes of other entries are counted as shared. Lock must be held.
+ */
+static void
+hot_charge (SnapshootCache *cache, CacheEntry *entry)
+{
+    size_t size = get_snapshoot_size (entry->snap);
+
+    if (entry->snap->cache_holders++ > 0) {
+        cache->stats.shared_bytes += size;
+    } else {
+        cache->stats.hot_bytes += size;
+    }
+}
+
+/**
+ *  Returns TRUE, if other hot entries still hold snapshoot.
+ *  Lock must be held.
+ */
+static gboolean
+hot_discharge (SnapshootCache *cache, CacheEntry *entry)
+{
+    size_t size = get_snapshoot_size (entry->snap);
+
+    if (--entry->snap->cache_holders > 0) {
+        cache->stats.shared_bytes -= size;
+        return TRUE;
+    }
+    cache->stats.hot_bytes -= size;
+    return FALSE;
+}
+
+static CacheEntry *
+entry_pack (gint64 key, GifSnapshoot *snap)
+{
+    CacheEntry *entry;
+    int unit = snapshoot_unit (snap->format);
+    size_t count = (size_t) snap->width * snap->height;
+    const byte *data = snap->format == GIF_SNAPSHOOT_INDEXED ?
+            snap->indices : snap->pixmap;
+    byte *packed;
+    TRACE_BEGIN (stamp);
+
+    packed = malloc (rle_bound (count, unit));
+    if (packed == NULL) {
+        return NULL;
+    }
+    entry = calloc (1, sizeof (CacheEntry));
+    if (entry == NULL) {
+        free (packed);
+        return NULL;
+    }
+    entry->key = key;
+    entry->link.data = entry;
+    entry->cold = TRUE;
+    entry->packed_size = rle_pack (data, count, unit, packed);
+    entry->packed = realloc (packed, entry->packed_size);
+    if (entry->packed == NULL) {
+        entry->packed = packed;
+    }
+    entry->width = snap->width;
+    entry->height = snap->height;
+    entry->format = snap->format;
+    if (snap->palette != NULL) {
+        entry->palette = palette_ref (snap->palette);
+    }
+    entry->decode_time = snap->decode_time;
+    entry->convert_time = snap->convert_time;
+    TRACE_END (stamp, "cache_pack");
+    return entry;
+}
+
+/**
+ *  Returns NULL if packed data is broken.
+ */
+static GifSnapshoot *
+entry_unpack (const CacheEntry *entry)
+{
+    GifSnapshoot *snap;
+    int unit = snapshoot_unit (entry->format);
+    size_t count = (size_t) entry->width * entry->height;
+    byte *data;
+    TRACE_BEGIN (stamp);
+
+    data = malloc (count * unit);
+    snap = calloc (1, sizeof (GifSnapshoot));
+    if (data == NULL || snap == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for gif snapshoot.");
+    }
+    if (!rle_unpack (entry->packed, entry->packed_size, count, unit, data)) {
+        free (data);
+        free (snap);
+        return NULL;
+    }
+
+    snap->ref_count = 1;
+    snap->width = entry->width;
+    snap->height = entry->height;
+    snap->format = entry->format;
+    if (entry->format == GIF_SNAPSHOOT_INDEXED) {
+        snap->indices = data;
+        snap->palette = palette_ref (entry->palette);
+    } else {
+        snap->pixmap = data;
+    }
+    snap->decode_time = entry->decode_time;
+    snap->convert_time = entry->convert_time;
+    TRACE_END (stamp, "cache_unpack");
+    return snap;
+}
+
+SnapshootCache *
+cache_new (size_t hot_size, size_t cold_size)
+{
+    SnapshootCache *cache;
+
+    cache = calloc (1, sizeof (SnapshootCache));
+    if (cache == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for cache.");
+    }
+    g_mutex_init (&cache->lock);
+    cache->entries = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+            NULL, (GDestroyNotify) entry_free);
+    g_queue_init (&cache->hot);
+    g_queue_init (&cache->cold);
+    cache->hot_size = hot_size;
+    cache->cold_size = cold_size;
+    cache->gifs = g_array_new (FALSE, TRUE, sizeof (CacheGif));
+    return cache;
+}
+
+static CacheGif
+cache_get_gif (SnapshootCache *cache, int gif)
+{
+    CacheGif cache_gif = {0, 0, 0};
+
+    g_mutex_lock (&cache->lock);
+    if (gif >= 0 && gif < cache->gifs->len) {
+        cache_gif = g_array_index (cache->gifs, CacheGif, gif);
+    }
+    g_mutex_unlock (&cache->lock);
+    return cache_gif;
+}
+
+/**
+ *  Writes cold entry to spill store.
+ */
+static void
+entry_spill (SnapshootCache *cache, const CacheEntry *entry)
+{
+    guint64 gif_id = cache_get_gif (cache, (int) (entry->key >> 32)).id;
+    SpillRecord record;
+    GOutputVector vectors[3];
+    int count = 0;
+
+    if (gif_id == 0) {
+        return;
+    }
+    record.width = entry->width;
+    record.height = entry->height;
+    record.format = entry->format;
+    record.palette = entry->palette != NULL;
+    record.decode_time = entry->decode_time;
+    record.convert_time = entry->convert_time;
+
+    vectors[count].buffer = &record;
+    vectors[count++].size = sizeof (SpillRecord);
+    if (entry->palette != NULL) {
+        vectors[count].buffer = entry->palette->colors;
+        vectors[count++].size = sizeof (entry->palette->colors);
+    }
+    vectors[count].buffer = entry->packed;
+    vectors[count++].size = entry->packed_size;
+
+    if (spill_put (cache->spill, gif_id, (int) (guint32) entry->key,
+                vectors, count)) {
+        g_mutex_lock (&cache->lock);
+        ++cache->stats.spilled;
+        g_mutex_unlock (&cache->lock);
+    }
+}
+
+/**
+ *  Checks record header read from spill store, which may be left
+ *  broken by crash or other version.
+ */
+static gboolean
+spill_record_check (const SpillRecord *record, size_t size, 
+        const CacheGif *cache_gif)
+{
+    if (size < sizeof (SpillRecord) || 
+            record->width != cache_gif->width ||
+            record->height != cache_gif->height) {
+        return FALSE;
+    }
+    switch (record->format) {
+    case GIF_SNAPSHOOT_BGRX:
+        return !record->palette;
+    case GIF_SNAPSHOOT_INDEXED:
+        return record->palette && size >= sizeof (SpillRecord) + 
+            sizeof (((GifPalette *) NULL)->colors);
+    default:
+        return FALSE;
+    }
+}
+
+/**
+ *  Reads snapshoot from spill store. Record is unpacked like
+ *  cold entry. Broken record is dropped.
+ */
+static GifSnapshoot *
+cache_unspill (SnapshootCache *cache, int gif, int gif_pos)
+{
+    CacheGif cache_gif = cache_get_gif (cache, gif);
+    CacheEntry entry;
+    SpillRecord *record;
+    GifSnapshoot *snap = NULL;
+    size_t size, head;
+
+    if (cache_gif.id == 0 || (record = spill_get (cache->spill, 
+                    cache_gif.id, gif_pos, &size)) == NULL) {
+        return NULL;
+    }
+    if (spill_record_check (record, size, &cache_gif)) {
+        head = sizeof (SpillRecord) + (record->palette ? 
+                sizeof (entry.palette->colors) : 0);
+        memset (&entry, 0, sizeof (CacheEntry));
+        entry.width = record->width;
+        entry.height = record->height;
+        entry.format = record->format;
+        entry.decode_time = record->decode_time;
+        entry.convert_time = record->convert_time;
+        entry.packed = (byte *) record + head;
+        entry.packed_size = size - head;
+        if (record->palette) {
+            entry.palette = malloc (sizeof (GifPalette));
+            if (entry.palette == NULL) {
+                put_error (1, "Can not allocate mamory"
+                    "for gif palette.");
+            }
+            entry.palette->ref_count = 1;
+            memcpy (entry.palette->colors, record + 1, 
+                    sizeof (entry.palette->colors));
+        }
+        snap = entry_unpack (&entry);
+        palette_unref (entry.palette);
+    }
+    if (snap == NULL) {
+        put_warning ("Spilled snapshoot %d of gif %d is broken", 
+                gif_pos, gif);
+        spill_remove (cache->spill, cache_gif.id, gif_pos);
+    }
+    free (record);
+    return snap;
+}
+
+/**
+ *  Spills dropped cold entries and frees them.
+ */
+static void
+cache_spill (SnapshootCache *cache, GSList *dropped)
+{
+    GSList *it;
+
+    for (it = dropped; it != NULL; it = it->next) {
+        if (cache->spill != NULL) {
+            entry_spill (cache, (CacheEntry *) it->data);
+        }
+        entry_free ((CacheEntry *) it->data);
+    }
+    g_slist_free (dropped);
+}
+
+void
+cache_free (SnapshootCache *cache)
+{
+    GList *link;
+
+    //Packed snapshoots are kept for next session
+    if (cache->spill != NULL) {
+        for (link = cache->cold.head; link != NULL; link = link->next) {
+            entry_spill (cache, (CacheEntry *) link->data);
+        }
+    }
+    g_hash_table_destroy (cache->entries);
+    g_array_free (cache->gifs, TRUE);
+    g_mutex_clear (&cache->lock);
+    free (cache);
+}
+
+void
+cache_set_spill (SnapshootCache *cache, SpillStore *spill)
+{
+    g_mutex_lock (&cache->lock);
+    cache->spill = spill;
+    g_mutex_unlock (&cache->lock);
+}
+
+void
+cache_set_gif_id (SnapshootCache *cache, int gif, guint64 gif_id,
+        int width, int height)
+{
+    CacheGif *cache_gif;
+
+    g_mutex_lock (&cache->lock);
+    if (gif >= cache->gifs->len) {
+        g_array_set_size (cache->gifs, gif + 1);
+    }
+    cache_gif = &g_array_index (cache->gifs, CacheGif, gif);
+    cache_gif->id = gif_id;
+    cache_gif->width = width;
+    cache_gif->height = height;
+    g_mutex_unlock (&cache->lock);
+}
+
+/**
+ *  Removes cold entries over the limit and adds them to dropped list.
+ *  Lock must be held.
+ */
+static void
+cache_trim_cold (SnapshootCache *cache, GSList **dropped)
+{
+    CacheEntry *entry;
+    GList *link;
+
+    while (cache->stats.cold_bytes > cache->cold_size &&
+            (link = g_queue_pop_tail_link (&cache->cold)) != NULL) {
+        entry = (CacheEntry *) link->data;
+        cache->stats.cold_bytes -= entry_cold_size (entry);
+        cache->stats.packed_bytes -= (size_t) entry->width * entry->height
+                * snapshoot_unit (entry->format);
+        ++cache->stats.evictions;
+        g_hash_table_steal (cache->entries, &entry->key);
+        *dropped = g_slist_prepend (*dropped, entry);
+    }
+}
+
+/**
+ *  Moves hot entries over the limit to cold tier.
+ *  Packing is done without lock held. Entry of snapshoot, which
+ *  other hot entries hold, is dropped instead: its memory is not
+ *  freed by packing and pool gives the snapshoot again.
+ */
+static void
+cache_trim (SnapshootCache *cache)
+{
+    CacheEntry *entry, *cold;
+    GList *link;
+    GSList *evicted = NULL, *dropped = NULL, *shared = NULL, *it;
+    guint generation;
+
+    g_mutex_lock (&cache->lock);
+    //Newest entry stays even if it is bigger than the whole tier
+    while (cache->stats.hot_bytes > cache->hot_size &&
+            cache->hot.length > 1) {
+        link = g_queue_pop_tail_link (&cache->hot);
+        entry = (CacheEntry *) link->data;
+        g_hash_table_steal (cache->entries, &entry->key);
+        if (hot_discharge (cache, entry)) {
+            shared = g_slist_prepend (shared, entry);
+        } else {
+            evicted = g_slist_prepend (evicted, entry);
+        }
+    }
+    generation = cache->generation;
+    g_mutex_unlock (&cache->lock);
+
+    for (it = shared; it != NULL; it = it->next) {
+        entry_free ((CacheEntry *) it->data);
+    }
+    g_slist_free (shared);
+
+    for (it = evicted; it != NULL; it = it->next) {
+        entry = (CacheEntry *) it->data;
+        cold = cache->cold_size > 0 ? entry_pack (entry->key, entry->snap) :
+                NULL;
+        entry_free (entry);
+        if (cold == NULL) {
+            continue;
+        }
+
+        g_mutex_lock (&cache->lock);
+        //Cache was cleared or snapshoot made again while packing
+        if (generation != cache->generation ||
+                g_hash_table_lookup (cache->entries, &cold->key) != NULL) {
+            g_mutex_unlock (&cache->lock);
+            entry_free (cold);
+            continue;
+        }
+        g_hash_table_insert (cache->entries, &cold->key, cold);
+        g_queue_push_head_link (&cache->cold, &cold->link);
+        cache->stats.cold_bytes += entry_cold_size (cold);
+        cache->stats.packed_bytes += (size_t) cold->width * cold->height
+                * snapshoot_unit (cold->format);
+        cache_trim_cold (cache, &dropped);
+        g_mutex_unlock (&cache->lock);
+    }
+    g_slist_free (evicted);
+    cache_spill (cache, dropped);
+}
+
+void
+cache_set_size (SnapshootCache *cache, size_t hot_size, size_t cold_size)
+{
+    GSList *dropped = NULL;
+
+    g_mutex_lock (&cache->lock);
+    cache->hot_size = hot_size;
+    cache->cold_size = cold_size;
+    cache_trim_cold (cache, &dropped);
+    g_mutex_unlock (&cache->lock);
+    cache_spill (cache, dropped);
+
+    cache_trim (cache);
+}
+
+static void
+cache_insert_hot (SnapshootCache *cache, gint64 key, GifSnapshoot *snap,
+        guint generation)
+{
+    CacheEntry *entry;
+
+    g_mutex_lock (&cache->lock);
+    //Other worker made the same snapshoot or gif was removed meanwhile
+    if (g_hash_table_lookup (cache->entries, &key) != NULL ||
+            cache->hot_size == 0 || generation != cache->generation) {
+        g_mutex_unlock (&cache->lock);
+        return;
+    }
+    entry = calloc (1, sizeof (CacheEntry));
+    if (entry == NULL) {
+        g_mutex_unlock (&cache->lock);
+        return;
+    }
+    entry->key = key;
+    entry->link.data = entry;
+    entry->snap = snapshoot_ref (snap);
+    g_hash_table_insert (cache->entries, &entry->key, entry);
+    g_queue_push_head_link (&cache->hot, &entry->link);
+    hot_charge (cache, entry);
+    g_mutex_unlock (&cache->lock);
+
+    cache_trim (cache);
+}
+
+void
+cache_insert (SnapshootCache *cache, int gif, int gif_pos,
+        GifSnapshoot *snap)
+{
+    guint generation;
+
+    g_mutex_lock (&cache->lock);
+    generation = cache->generation;
+    g_mutex_unlock (&cache->lock);
+    cache_insert_hot (cache, make_key (gif, gif_pos), snap, generation);
+}
+
+GifSnapshoot *
+cache_lookup (SnapshootCache *cache, int gif, int gif_pos)
+{
+    gint64 key = make_key (gif, gif_pos);
+    CacheEntry *entry;
+    GifSnapshoot *snap;
+    guint generation;
+
+    g_mutex_lock (&cache->lock);
+    generation = cache->generation;
+    entry = (CacheEntry *) g_hash_table_lookup (cache->entries, &key);
+    if (entry == NULL) {
+        g_mutex_unlock (&cache->lock);
+        snap = cache->spill != NULL ? 
+                cache_unspill (cache, gif, gif_pos) : NULL;
+
+        g_mutex_lock (&cache->lock);
+        if (snap != NULL) {
+            ++cache->stats.spill_hits;
+        } else {
+            ++cache->stats.misses;
+        }
+        g_mutex_unlock (&cache->lock);
+        if (snap != NULL) {
+            cache_insert_hot (cache, key, snap, generation);
+        }
+        return snap;
+    }
+    if (!entry->cold) {
+        g_queue_unlink (&cache->hot, &entry->link);
+        g_queue_push_head_link (&cache->hot, &entry->link);
+        ++cache->stats.hot_hits;
+        snap = snapshoot_ref (entry->snap);
+        g_mutex_unlock (&cache->lock);
+        return snap;
+    }
+
+    //Promotion to hot tier
+    g_queue_unlink (&cache->cold, &entry->link);
+    g_hash_table_steal (cache->entries, &entry->key);
+    cache->stats.cold_bytes -= entry_cold_size (entry);
+    cache->stats.packed_bytes -= (size_t) entry->width * entry->height
+            * snapshoot_unit (entry->format);
+    ++cache->stats.cold_hits;
+    g_mutex_unlock (&cache->lock);
+
+    snap = entry_unpack (entry);
+    entry_free (entry);
+    if (snap != NULL) {
+        cache_insert_hot (cache, key, snap, generation);
+    }
+    return snap;
+}
+
+GifSnapshoot *
+cache_lookup_nearest (SnapshootCache *cache, int gif, int gif_pos,
+        int *found_pos)
+{
+    GHashTableIter iter;
+    CacheEntry *entry;
+    gpointer value;
+    int pos, best = -1;
+
+    g_mutex_lock (&cache->lock);
+    g_hash_table_iter_init (&iter, cache->entries);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        entry = (CacheEntry *) value;
+        if ((int) (entry->key >> 32) != gif) {
+            continue;
+        }
+        pos = (int) (guint32) entry->key;
+        if (best < 0 || ABS (pos - gif_pos) < ABS (best - gif_pos)) {
+            best = pos;
+        }
+    }
+    g_mutex_unlock (&cache->lock);
+
+    if (best < 0) {
+        return NULL;
+    }
+    *found_pos = best;
+    //Entry may be dropped meanwhile, then nothing is found
+    return cache_lookup (cache, gif, best);
+}
+
+void
+cache_clear (SnapshootCache *cache)
+{
+    GList *link;
+
+    g_mutex_lock (&cache->lock);
+    //Snapshoots may outlive their entries
+    for (link = cache->hot.head; link != NULL; link = link->next) {
+        hot_discharge (cache, (CacheEntry *) link->data);
+    }
+    g_queue_init (&cache->hot);
+    g_queue_init (&cache->cold);
+    g_hash_table_remove_all (cache->entries);
+    cache->stats.hot_bytes = 0;
+    cache->stats.shared_bytes = 0;
+    cache->stats.cold_bytes = 0;
+    cache->stats.packed_bytes = 0;
+    ++cache->generation;
+    g_mutex_unlock (&cache->lock);
+}
+
+/**
+ *  Moves entries of gif from queue to removed list. Lock must be held.
+ */
+static void
+cache_steal_gif (SnapshootCache *cache, GQueue *queue, int gif,
+        GSList **removed)
+{
+    CacheEntry *entry;
+    GList *link, *next;
+
+    for (link = queue->head; link != NULL; link = next) {
+        next = link->next;
+        entry = (CacheEntry *) link->data;
+        if ((int) (entry->key >> 32) != gif) {
+            continue;
+        }
+        g_queue_unlink (queue, link);
+        if (entry->cold) {
+            cache->stats.cold_bytes -= entry_cold_size (entry);
+            cache->stats.packed_bytes -= (size_t) entry->width * 
+                    entry->height * snapshoot_unit (entry->format);
+        } else {
+            hot_discharge (cache, entry);
+        }
+        g_hash_table_steal (cache->entries, &entry->key);
+        *removed = g_slist_prepend (*removed, entry);
+    }
+}
+
+void
+cache_remove_gif (SnapshootCache *cache, int gif)
+{
+    GSList *removed = NULL, *it;
+
+    g_mutex_lock (&cache->lock);
+    cache_steal_gif (cache, &cache->hot, gif, &removed);
+    cache_steal_gif (cache, &cache->cold, gif, &removed);
+    //Snapshoots being packed or promoted are not put back
+    ++cache->generation;
+    g_mutex_unlock (&cache->lock);
+
+    for (it = removed; it != NULL; it = it->next) {
+        entry_free ((CacheEntry *) it->data);
+    }
+    g_slist_free (removed);
+}
+
+void
+cache_get_stats (SnapshootCache *cache, SnapshootCacheStats *stats)
+{
+    g_mutex_lock (&cache->lock);
+    *stats = cache->stats;
+    g_mutex_unlock (&cache->lock);
+}
+
+static void
+cache_add_usage (GQueue *queue, gboolean cold, int gif_count, size_t *bytes)
+{
+    CacheEntry *entry;
+    GList *link;
+    int gif;
+
+    for (link = queue->head; link != NULL; link = link->next) {
+        entry = (CacheEntry *) link->data;
+        gif = (int) (entry->key >> 32);
+        if (gif >= 0 && gif < gif_count) {
+            //Shared snapshoot is divided among its entries
+            bytes[gif] += cold ? entry_cold_size (entry) : 
+                    get_snapshoot_size (entry->snap) / 
+                    MAX (entry->snap->cache_holders, 1);
+        }
+    }
+}
+
+size_t
+cache_get_gif_usage (SnapshootCache *cache, int gif_count,
+        size_t *hot, size_t *cold)
+{
+    size_t entries;
+
+    g_mutex_lock (&cache->lock);
+    cache_add_usage (&cache->hot, FALSE, gif_count, hot);
+    cache_add_usage (&cache->cold, TRUE, gif_count, cold);
+    entries = g_hash_table_size (cache->entries);
+    g_mutex_unlock (&cache->lock);
+
+    //Entries and their hash table nodes
+    return sizeof (SnapshootCache) + 
+            entries * (sizeof (CacheEntry) + 4 * sizeof (gpointer));
+}
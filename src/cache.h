@@ -0,0 +1,83 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "gifseeker.h"
+#include "spill.h"
+
+/**
+ *  Cache of snapshoots. Used by context internally.
+ *
+ *  Hot tier keeps ready snapshoots in LRU order. Snapshoots evicted
+ *  from it are compressed with run-length codec and go to cold tier.
+ *  Cold snapshoots are unpacked and promoted back to hot tier on hit.
+ *  Both tiers are limited in bytes. Snapshoot shared by equal images
+ *  is charged to hot tier once. All functions are thread safe.
+ *  cache_lookup_nearest finds cached snapshoot of gif with position
+ *  closest to gif_pos, it is slow for big caches.
+ *  cache_get_gif_usage adds bytes held by snapshoots of each gif to
+ *  hot and cold arrays and returns bytes of cache own structures.
+ *  With cache_set_spill entries dropped from cold tier and cold tier
+ *  left by cache_free go to spill store, misses are looked up there.
+ *  Only gifs given nonzero id with cache_set_gif_id are spilled, id
+ *  must differ for other file or snapshoot format. Spilled snapshoots
+ *  of other size than gif screen are dropped.
+ *  cache_remove_gif drops snapshoots of gif, which was changed, and
+ *  snapshoots of it being inserted meanwhile.
+ */
+
+typedef struct SnapshootCache SnapshootCache;
+
+typedef struct SnapshootCacheStats {
+    unsigned long hot_hits;     //Found in hot tier
+    unsigned long cold_hits;    //Promoted from cold tier
+    unsigned long misses;
+    unsigned long evictions;    //Dropped from cold tier
+    unsigned long spill_hits;   //Read from spill store
+    unsigned long spilled;      //Written to spill store
+    size_t hot_bytes;           //Snapshoot held by many entries once
+    size_t shared_bytes;        //Hot entries, which other entries hold
+    size_t cold_bytes;
+    size_t packed_bytes;        //Size of cold snapshoots before packing
+} SnapshootCacheStats;
+
+#define CACHE_DEFAULT_HOT_SIZE (64 << 20)
+#define CACHE_DEFAULT_COLD_SIZE (256 << 20)
+
+SnapshootCache *cache_new (size_t hot_size, size_t cold_size);
+void cache_free (SnapshootCache *cache);
+void cache_set_size (SnapshootCache *cache, size_t hot_size, size_t cold_size);
+void cache_set_spill (SnapshootCache *cache, SpillStore *spill);
+void cache_set_gif_id (SnapshootCache *cache, int gif, guint64 gif_id,
+        int width, int height);
+
+GifSnapshoot *cache_lookup (SnapshootCache *cache, int gif, int gif_pos);
+GifSnapshoot *cache_lookup_nearest (SnapshootCache *cache, int gif, 
+        int gif_pos, int *found_pos);
+void cache_insert (SnapshootCache *cache, int gif, int gif_pos,
+        GifSnapshoot *snap);
+void cache_clear (SnapshootCache *cache);
+void cache_remove_gif (SnapshootCache *cache, int gif);
+void cache_get_stats (SnapshootCache *cache, SnapshootCacheStats *stats);
+size_t cache_get_gif_usage (SnapshootCache *cache, int gif_count,
+        size_t *hot, size_t *cold);
+
+#endif /*CACHE_H*/
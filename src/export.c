@@ -0,0 +1,513 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "export.h"
+#include "gifscan.h"
+#include "giflzw.h"
+#include "trace.h"
+
+#define EMPTY_PIXEL 0       //Nothing drawn, colors are 0xffRRGGBB
+#define MAX_PAINT_COLORS 255    //Index 0 is transparent
+
+/**
+ *  Canvas of source gif. Images are drawn on it one by one
+ *  like viewer does. Source is decoded on first use.
+ */
+typedef struct ExportCanvas {
+    const char *filename;
+    GifFileType *gifFile;
+    int width, height;
+    guint32 *pixels;        //State before image pos is drawn
+    guint32 *saved;         //Copy for "restore to previous" disposal
+    int pos;
+} ExportCanvas;
+
+typedef struct ExportRect {
+    int x0, y0, x1, y1;
+} ExportRect;
+
+static int
+parse_frames (const char *spec, int count, GArray *frames)
+{
+    char **ranges, *end;
+    long first, last;
+    int i, j, result = 0;
+
+    if (spec == NULL) {
+        for (i = 0; i < count; ++i) {
+            g_array_append_val (frames, i);
+        }
+        return 0;
+    }
+
+    ranges = g_strsplit (spec, ",", -1);
+    for (j = 0; ranges[j] != NULL; ++j) {
+        first = last = strtol (ranges[j], &end, 10);
+        if (end == ranges[j]) {
+            result = -1;
+        } else if (*end == '-') {
+            if (end[1] == '\0') {
+                last = count - 1;
+                ++end;
+            } else {
+                last = strtol (end + 1, &end, 10);
+            }
+        }
+        if (result < 0 || *end != '\0') {
+            put_warning ("Wrong frames '%s'", ranges[j]);
+            result = -1;
+            break;
+        }
+        if (first < 0 || last < 0 || first >= count || last >= count) {
+            put_warning ("Frames '%s' are out of range 0-%d",
+                    ranges[j], count - 1);
+            result = -1;
+            break;
+        }
+        //Reversed range is exported backwards
+        for (i = first; ; i += first <= last ? 1 : -1) {
+            g_array_append_val (frames, i);
+            if (i == last) {
+                break;
+            }
+        }
+    }
+    g_strfreev (ranges);
+    return result;
+}
+
+/**
+ *  Image is opaque, covers whole screen and does not restore what was
+ *  under it, so canvas after it does not depend on canvas before.
+ */
+static gboolean
+frame_covers_screen (const GifScan *scan, const GifScanFrame *frame)
+{
+    return frame->left == 0 && frame->top == 0 &&
+        frame->width >= scan->width && frame->height >= scan->height &&
+        frame->transparent < 0 && frame->disposal != 3;
+}
+
+static int
+canvas_open (ExportCanvas *canvas, const GifScan *scan)
+{
+    size_t pixels = (size_t) scan->width * scan->height;
+    int error;
+
+    if (canvas->gifFile != NULL) {
+        return 0;
+    }
+    canvas->gifFile = DGifOpenFileName (canvas->filename, &error);
+    if (canvas->gifFile == NULL) {
+        put_warning ("Can not open '%s'. %s", canvas->filename,
+                GifErrorString (error));
+        return -1;
+    }
+    if (DGifSlurp (canvas->gifFile) == GIF_ERROR) {
+        put_warning ("Can not decode '%s'. %s", canvas->filename,
+                GifErrorString (canvas->gifFile->Error));
+        return -1;
+    }
+    if (canvas->gifFile->ImageCount < gif_scan_count (scan)) {
+        put_warning ("Only %d of %d images of '%s' are decoded",
+                canvas->gifFile->ImageCount, gif_scan_count (scan),
+                canvas->filename);
+        return -1;
+    }
+    canvas->width = scan->width;
+    canvas->height = scan->height;
+    canvas->pixels = calloc (pixels, sizeof (guint32));
+    canvas->saved = calloc (pixels, sizeof (guint32));
+    if (canvas->pixels == NULL || canvas->saved == NULL) {
+        put_error (1, "Can not allocate memory for canvas");
+    }
+    canvas->pos = 0;
+    return 0;
+}
+
+static void
+canvas_close (ExportCanvas *canvas)
+{
+    if (canvas->gifFile != NULL) {
+        DGifCloseFile (canvas->gifFile);
+    }
+    free (canvas->pixels);
+    free (canvas->saved);
+}
+
+static void
+canvas_clip (const ExportCanvas *canvas, const GifImageDesc *desc,
+        ExportRect *rect)
+{
+    rect->x0 = MAX (desc->Left, 0);
+    rect->y0 = MAX (desc->Top, 0);
+    rect->x1 = MIN (desc->Left + desc->Width, canvas->width);
+    rect->y1 = MIN (desc->Top + desc->Height, canvas->height);
+}
+
+/**
+ *  Draws image and applies its disposal method.
+ */
+static void
+canvas_advance (ExportCanvas *canvas, const GifScanFrame *frame, int i)
+{
+    const SavedImage *image = canvas->gifFile->SavedImages + i;
+    const GifImageDesc *desc = &image->ImageDesc;
+    const ColorMapObject *colormap;
+    const GifColorType *color;
+    size_t pixels = (size_t) canvas->width * canvas->height;
+    ExportRect rect;
+    guint32 *row;
+    const byte *src;
+    int x, y;
+
+    colormap = desc->ColorMap != NULL ? desc->ColorMap :
+            canvas->gifFile->SColorMap;
+    canvas_clip (canvas, desc, &rect);
+
+    if (frame->disposal == 3) {
+        memcpy (canvas->saved, canvas->pixels, pixels * sizeof (guint32));
+    }
+    for (y = rect.y0; y < rect.y1; ++y) {
+        row = canvas->pixels + (size_t) y * canvas->width;
+        src = image->RasterBits + (size_t) (y - desc->Top) * desc->Width +
+                (rect.x0 - desc->Left);
+        for (x = rect.x0; x < rect.x1; ++x, ++src) {
+            if (*src == frame->transparent) {
+                continue;
+            }
+            //Wrong indices are drawn black
+            row[x] = 0xff000000;
+            if (colormap != NULL && *src < colormap->ColorCount) {
+                color = colormap->Colors + *src;
+                row[x] |= (color->Red << 16) | (color->Green << 8) |
+                    color->Blue;
+            }
+        }
+    }
+    if (frame->disposal == 2) {
+        for (y = rect.y0; y < rect.y1; ++y) {
+            row = canvas->pixels + (size_t) y * canvas->width;
+            for (x = rect.x0; x < rect.x1; ++x) {
+                row[x] = EMPTY_PIXEL;
+            }
+        }
+    } else if (frame->disposal == 3) {
+        memcpy (canvas->pixels, canvas->saved, pixels * sizeof (guint32));
+    }
+}
+
+/**
+ *  Returns canvas, image pos is drawn over.
+ */
+static const guint32 *
+canvas_seek (ExportCanvas *canvas, const GifScan *scan, int pos)
+{
+    TRACE_BEGIN (stamp);
+
+    if (pos < canvas->pos) {
+        memset (canvas->pixels, 0, 
+                (size_t) canvas->width * canvas->height * sizeof (guint32));
+        canvas->pos = 0;
+    }
+    for (; canvas->pos < pos; ++canvas->pos) {
+        canvas_advance (canvas, gif_scan_frame (scan, canvas->pos),
+                canvas->pos);
+    }
+    TRACE_END (stamp, "canvas_seek");
+    return canvas->pixels;
+}
+
+static void
+put_word (GByteArray *out, int value)
+{
+    byte word[2] = {value & 0xff, (value >> 8) & 0xff};
+
+    g_byte_array_append (out, word, 2);
+}
+
+static void
+put_control (GByteArray *out, int disposal)
+{
+    //Zero delay and transparent index 0
+    byte control[8] = {0x21, 0xf9, 4, (disposal << 2) | 0x01, 0, 0, 0, 0};
+
+    g_byte_array_append (out, control, sizeof (control));
+}
+
+static void
+put_image (GByteArray *out, const ExportRect *rect,
+        const guint32 *colors, int bits, const byte *indices)
+{
+    byte flags = 0x80 | (bits - 1);
+    byte separator = 0x2c, rgb[3];
+    int i;
+
+    g_byte_array_append (out, &separator, 1);
+    put_word (out, rect->x0);
+    put_word (out, rect->y0);
+    put_word (out, rect->x1 - rect->x0);
+    put_word (out, rect->y1 - rect->y0);
+    g_byte_array_append (out, &flags, 1);
+    for (i = 0; i < 1 << bits; ++i) {
+        rgb[0] = (colors[i] >> 16) & 0xff;
+        rgb[1] = (colors[i] >> 8) & 0xff;
+        rgb[2] = colors[i] & 0xff;
+        g_byte_array_append (out, rgb, 3);
+    }
+    lzw_encode (indices, (size_t) (rect->x1 - rect->x0) * 
+            (rect->y1 - rect->y0), MAX (bits, 2), out);
+}
+
+/**
+ *  Bounding rectangle of pixels to clear (have is drawn, need is empty)
+ *  or to paint (differ).
+ */
+static gboolean
+find_rect (const guint32 *have, const guint32 *need, int width, int height,
+        gboolean clear, ExportRect *rect)
+{
+    size_t i;
+    int x, y;
+
+    rect->x0 = width;
+    rect->y0 = height;
+    rect->x1 = rect->y1 = 0;
+    for (y = 0; y < height; ++y) {
+        for (x = 0; x < width; ++x) {
+            i = (size_t) y * width + x;
+            if (clear ? have[i] != EMPTY_PIXEL && need[i] == EMPTY_PIXEL :
+                    have[i] != need[i]) {
+                rect->x0 = MIN (rect->x0, x);
+                rect->y0 = MIN (rect->y0, y);
+                rect->x1 = MAX (rect->x1, x + 1);
+                rect->y1 = MAX (rect->y1, y + 1);
+            }
+        }
+    }
+    return rect->x0 < rect->x1;
+}
+
+/**
+ *  Adds images, which turn canvas have into canvas need.
+ *  Pixels, which must become empty, are cleared by transparent image
+ *  with "restore to background" disposal. The rest is painted by
+ *  images with up to 255 colors each.
+ */
+static void
+put_canvas (GByteArray *out, guint32 *have, const guint32 *need,
+        int width, int height)
+{
+    guint32 colors[GIF_PALETTE_SIZE];
+    byte *indices;
+    ExportRect rect;
+    size_t i;
+    int x, y, count, bits, k, index;
+    TRACE_BEGIN (stamp);
+
+    indices = malloc ((size_t) width * height);
+    if (indices == NULL) {
+        put_error (1, "Can not allocate memory for image");
+    }
+
+    if (find_rect (have, need, width, height, TRUE, &rect)) {
+        memset (colors, 0, sizeof (colors));
+        memset (indices, 0, (size_t) width * height);
+        put_control (out, 2);
+        put_image (out, &rect, colors, 1, indices);
+        for (y = rect.y0; y < rect.y1; ++y) {
+            for (x = rect.x0; x < rect.x1; ++x) {
+                have[(size_t) y * width + x] = EMPTY_PIXEL;
+            }
+        }
+    }
+
+    while (find_rect (have, need, width, height, FALSE, &rect)) {
+        memset (colors, 0, sizeof (colors));
+        count = 0;
+        k = 0;
+        for (y = rect.y0; y < rect.y1; ++y) {
+            for (x = rect.x0; x < rect.x1; ++x, ++k) {
+                i = (size_t) y * width + x;
+                indices[k] = 0;
+                if (have[i] == need[i]) {
+                    continue;
+                }
+                //Colors are few, linear search is fine
+                for (index = 1; index <= count; ++index) {
+                    if (colors[index] == need[i]) {
+                        break;
+                    }
+                }
+                if (index > count) {
+                    //Left for next image
+                    if (count == MAX_PAINT_COLORS) {
+                        continue;
+                    }
+                    colors[++count] = need[i];
+                }
+                indices[k] = index;
+                have[i] = need[i];
+            }
+        }
+        for (bits = 1; 1 << bits <= count; ++bits);
+        put_control (out, 1);
+        put_image (out, &rect, colors, bits, indices);
+    }
+
+    free (indices);
+    TRACE_END (stamp, "put_canvas");
+}
+
+static int
+write_block (FILE *file, const GifScan *scan, const GifScanBlock *block)
+{
+    size_t size = block->end - block->begin;
+
+    if (size > 0 && fwrite (scan->data + block->begin, 1, size, file) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+int
+export_gif (const char *src_filename, const char *frames_spec,
+        const char *dst_filename)
+{
+    GMappedFile *mapped;
+    GError *error = NULL;
+    GifScan scan;
+    GArray *frames;
+    GByteArray *extra;
+    ExportCanvas canvas;
+    guint32 *have = NULL;
+    const GifScanFrame *frame;
+    FILE *file = NULL;
+    int i, f, next = 0, result = 0;
+    TRACE_BEGIN (stamp);
+
+    mapped = g_mapped_file_new (src_filename, FALSE, &error);
+    if (mapped == NULL) {
+        put_warning ("Can not read '%s'. %s", src_filename, error->message);
+        g_error_free (error);
+        return -1;
+    }
+    frames = g_array_new (FALSE, FALSE, sizeof (int));
+    extra = g_byte_array_new ();
+    memset (&canvas, 0, sizeof (ExportCanvas));
+    canvas.filename = src_filename;
+
+    if (gif_scan (&scan, (const byte *) g_mapped_file_get_contents (mapped),
+                g_mapped_file_get_length (mapped)) < 0 ||
+            parse_frames (frames_spec, gif_scan_count (&scan), frames) < 0) {
+        result = -1;
+        goto out;
+    }
+    if (frames->len == 0) {
+        put_warning ("There are no images to export in '%s'", src_filename);
+        result = -1;
+        goto out;
+    }
+    if (scan.truncated) {
+        put_warning ("File '%s' is truncated, it has %d complete images",
+                src_filename, gif_scan_count (&scan));
+    }
+
+    file = fopen (dst_filename, "wb");
+    if (file == NULL) {
+        put_warning ("Can not open '%s' for writing", dst_filename);
+        result = -1;
+        goto out;
+    }
+    //Screen descriptor and colormap are kept, version may be raised
+    if (fwrite ("GIF89a", 1, 6, file) != 6 ||
+            fwrite (scan.data + 6, 1, scan.screen_end - 6, file) != 
+                scan.screen_end - 6) {
+        result = -1;
+    }
+    for (i = 0; i < scan.extensions->len && result == 0; ++i) {
+        result = write_block (file, &scan, 
+                &g_array_index (scan.extensions, GifScanBlock, i));
+    }
+
+    for (i = 0; i < frames->len && result == 0; ++i) {
+        f = g_array_index (frames, int, i);
+        frame = gif_scan_frame (&scan, f);
+        if (f != next && !frame_covers_screen (&scan, frame)) {
+            if (canvas_open (&canvas, &scan) < 0) {
+                result = -1;
+                break;
+            }
+            if (have == NULL) {
+                have = malloc ((size_t) scan.width * scan.height * 
+                        sizeof (guint32));
+                if (have == NULL) {
+                    put_error (1, "Can not allocate memory for canvas");
+                }
+            }
+            memcpy (have, canvas_seek (&canvas, &scan, next), 
+                    (size_t) scan.width * scan.height * sizeof (guint32));
+            g_byte_array_set_size (extra, 0);
+            put_canvas (extra, have, canvas_seek (&canvas, &scan, f),
+                    scan.width, scan.height);
+            if (fwrite (extra->data, 1, extra->len, file) != extra->len) {
+                result = -1;
+                break;
+            }
+        }
+        if (write_block (file, &scan, &frame->control) < 0 ||
+                write_block (file, &scan, &frame->image) < 0) {
+            result = -1;
+        }
+        next = f + 1;
+    }
+    if (result == 0 && fputc (0x3b, file) == EOF) {
+        result = -1;
+    }
+    if (fclose (file) != 0) {
+        result = -1;
+    }
+    if (result < 0) {
+        put_warning ("Can not export to '%s'", dst_filename);
+    }
+
+out:
+    canvas_close (&canvas);
+    free (have);
+    gif_scan_clear (&scan);
+    g_byte_array_free (extra, TRUE);
+    g_array_free (frames, TRUE);
+    g_mapped_file_unref (mapped);
+    TRACE_END (stamp, "export_gif");
+    return result;
+}
+
+int
+export_gif_frames (const PContext c, int gif, const char *frames,
+        const char *dst_filename)
+{
+    const char *filename = get_gif_filename (c, gif);
+
+    if (filename == NULL) {
+        put_warning ("Gif %d was not read from file, can not export it", gif);
+        return -1;
+    }
+    return export_gif (filename, frames, dst_filename);
+}
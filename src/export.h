@@ -0,0 +1,45 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "gifseeker.h"
+
+/**
+ *  Lossless extraction of images to a new gif file.
+ *
+ *  Compressed data of chosen images is copied byte to byte. When the
+ *  image does not follow its predecessor in new file, canvas it is
+ *  drawn over is restored with extra zero-delay images first, so new
+ *  file looks exactly like the source one. Only these extra images are
+ *  encoded and only they require the source to be decoded.
+ *
+ *  Frames are listed as comma separated numbers and ranges starting
+ *  from 0: "0,3-5,10-". Open range ends at the last image.
+ *  NULL list means all images.
+ */
+
+int export_gif (const char *src_filename, const char *frames,
+        const char *dst_filename);
+int export_gif_frames (const PContext c, int gif, const char *frames,
+        const char *dst_filename);
+
+#endif /*EXPORT_H*/
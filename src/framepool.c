@@ -0,0 +1,306 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "framepool.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct FramePoolEntry {
+    FramePool *pool;
+    guint64 hash;
+    const byte *raster;     //Raster of source image, owned by gif
+    gconstpointer owner;
+    gboolean forgotten;     //Removed from pool with its owner
+    int left, top, image_width, image_height;
+    GifPalette *palette;
+    int background;
+    int width, height;
+    GifSnapshootFormat format;
+    GifSnapshoot *snap;
+} FramePoolEntry;
+
+struct FramePool {
+    GMutex lock;            //Guards entries and references of snapshoots
+    GHashTable *entries;    //Entry to itself
+    GHashTable *forgotten;  //Entries of forgotten owners still in use
+    FramePoolStats stats;
+};
+
+#define HASH_PRIME 0x100000001b3ULL
+
+static guint64
+hash_bytes (guint64 hash, const byte *data, size_t size)
+{
+    guint64 word;
+    size_t i;
+
+    //Word at a time, raster is hashed for each conversion
+    for (i = 0; i + sizeof (word) <= size; i += sizeof (word)) {
+        memcpy (&word, data + i, sizeof (word));
+        hash = (hash ^ word) * HASH_PRIME;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+static guint
+entry_hash (gconstpointer key)
+{
+    const FramePoolEntry *entry = (const FramePoolEntry *) key;
+    return (guint) (entry->hash ^ (entry->hash >> 32));
+}
+
+static gboolean
+entry_equal (gconstpointer a, gconstpointer b)
+{
+    const FramePoolEntry *entry_a = (const FramePoolEntry *) a;
+    const FramePoolEntry *entry_b = (const FramePoolEntry *) b;
+
+    if (entry_a->hash != entry_b->hash || 
+            entry_a->left != entry_b->left ||
+            entry_a->top != entry_b->top ||
+            entry_a->image_width != entry_b->image_width ||
+            entry_a->image_height != entry_b->image_height ||
+            entry_a->background != entry_b->background ||
+            entry_a->width != entry_b->width ||
+            entry_a->height != entry_b->height ||
+            entry_a->format != entry_b->format) {
+        return FALSE;
+    }
+    if (entry_a->palette != entry_b->palette &&
+            memcmp (entry_a->palette->colors, entry_b->palette->colors,
+                sizeof (entry_a->palette->colors)) != 0) {
+        return FALSE;
+    }
+    return entry_a->raster == entry_b->raster ||
+            memcmp (entry_a->raster, entry_b->raster, 
+                (size_t) entry_a->image_width * entry_a->image_height) == 0;
+}
+
+void
+frame_pool_hash (FrameSource *source)
+{
+    const GifImageDesc *desc = &source->image->ImageDesc;
+    gint32 fields[8];
+    guint64 hash;
+    TRACE_BEGIN (stamp);
+
+    fields[0] = desc->Left;
+    fields[1] = desc->Top;
+    fields[2] = desc->Width;
+    fields[3] = desc->Height;
+    fields[4] = source->background;
+    fields[5] = source->width;
+    fields[6] = source->height;
+    fields[7] = source->format;
+    hash = hash_bytes (0xcbf29ce484222325ULL, (const byte *) fields,
+            sizeof (fields));
+    hash = hash_bytes (hash, (const byte *) source->palette->colors, 
+            sizeof (source->palette->colors));
+    source->hash = hash_bytes (hash, source->image->RasterBits,
+            (size_t) desc->Width * desc->Height);
+    TRACE_END (stamp, "frame_pool_hash");
+}
+
+/**
+ *  Fills entry of hashed source for lookup.
+ */
+static void
+entry_init (FramePoolEntry *entry, const FrameSource *source)
+{
+    const GifImageDesc *desc = &source->image->ImageDesc;
+
+    memset (entry, 0, sizeof (FramePoolEntry));
+    entry->raster = source->image->RasterBits;
+    entry->left = desc->Left;
+    entry->top = desc->Top;
+    entry->image_width = desc->Width;
+    entry->image_height = desc->Height;
+    entry->palette = (GifPalette *) source->palette;
+    entry->background = source->background;
+    entry->width = source->width;
+    entry->height = source->height;
+    entry->format = source->format;
+    entry->owner = source->owner;
+    entry->hash = source->hash;
+}
+
+FramePool *
+frame_pool_new (void)
+{
+    FramePool *pool;
+
+    pool = calloc (1, sizeof (FramePool));
+    if (pool == NULL) {
+        put_error (1, "Can not allocate memory for frame pool");
+    }
+    g_mutex_init (&pool->lock);
+    pool->entries = g_hash_table_new (entry_hash, entry_equal);
+    pool->forgotten = g_hash_table_new (NULL, NULL);
+    return pool;
+}
+
+static void
+entry_free (FramePoolEntry *entry)
+{
+    palette_unref (entry->palette);
+    free (entry);
+}
+
+static void
+entries_detach (GHashTable *entries)
+{
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init (&iter, entries);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        ((FramePoolEntry *) key)->snap->pooled = NULL;
+        entry_free ((FramePoolEntry *) key);
+    }
+    g_hash_table_destroy (entries);
+}
+
+void
+frame_pool_free (FramePool *pool)
+{
+    //Snapshoots, which are still used, are not shared any more
+    entries_detach (pool->entries);
+    entries_detach (pool->forgotten);
+    g_mutex_clear (&pool->lock);
+    free (pool);
+}
+
+GifSnapshoot *
+frame_pool_lookup (FramePool *pool, const FrameSource *source)
+{
+    FramePoolEntry key, *entry;
+    GifSnapshoot *snap = NULL;
+
+    entry_init (&key, source);
+    g_mutex_lock (&pool->lock);
+    entry = (FramePoolEntry *) g_hash_table_lookup (pool->entries, &key);
+    if (entry != NULL) {
+        snap = snapshoot_ref (entry->snap);
+        ++pool->stats.shared;
+    }
+    g_mutex_unlock (&pool->lock);
+    return snap;
+}
+
+GifSnapshoot *
+frame_pool_insert (FramePool *pool, const FrameSource *source,
+        GifSnapshoot *snap)
+{
+    FramePoolEntry *entry, *other;
+    GifSnapshoot *shared;
+
+    entry = malloc (sizeof (FramePoolEntry));
+    if (entry == NULL) {
+        //Snapshoot is just not shared
+        return snap;
+    }
+    entry_init (entry, source);
+    entry->pool = pool;
+    entry->palette = palette_ref (entry->palette);
+    entry->snap = snap;
+
+    g_mutex_lock (&pool->lock);
+    other = (FramePoolEntry *) g_hash_table_lookup (pool->entries, entry);
+    if (other != NULL) {
+        //Other thread converted the same source
+        shared = snapshoot_ref (other->snap);
+        ++pool->stats.shared;
+        g_mutex_unlock (&pool->lock);
+        entry_free (entry);
+        free_snapshoot (snap);
+        return shared;
+    }
+    g_hash_table_add (pool->entries, entry);
+    snap->pooled = entry;
+    ++pool->stats.frames;
+    pool->stats.bytes += get_snapshoot_size (snap);
+    g_mutex_unlock (&pool->lock);
+    return snap;
+}
+
+gboolean
+frame_pool_release (GifSnapshoot *snap)
+{
+    FramePoolEntry *entry = snap->pooled;
+    FramePool *pool = entry->pool;
+    gboolean last;
+
+    g_mutex_lock (&pool->lock);
+    last = g_atomic_int_dec_and_test (&snap->ref_count);
+    if (last && entry->forgotten) {
+        g_hash_table_remove (pool->forgotten, entry);
+    } else if (last) {
+        g_hash_table_remove (pool->entries, entry);
+        --pool->stats.frames;
+        pool->stats.bytes -= get_snapshoot_size (snap);
+    }
+    if (last) {
+        snap->pooled = NULL;
+    }
+    g_mutex_unlock (&pool->lock);
+
+    if (last) {
+        entry_free (entry);
+    }
+    return last;
+}
+
+void
+frame_pool_forget (FramePool *pool, gconstpointer owner)
+{
+    GHashTableIter iter;
+    FramePoolEntry *entry;
+    gpointer key;
+
+    g_mutex_lock (&pool->lock);
+    g_hash_table_iter_init (&iter, pool->entries);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        entry = (FramePoolEntry *) key;
+        if (entry->owner != owner) {
+            continue;
+        }
+        //Snapshoot stays valid, but is not given to new users
+        g_hash_table_iter_remove (&iter);
+        g_hash_table_add (pool->forgotten, entry);
+        entry->forgotten = TRUE;
+        --pool->stats.frames;
+        pool->stats.bytes -= get_snapshoot_size (entry->snap);
+    }
+    g_mutex_unlock (&pool->lock);
+}
+
+void
+frame_pool_get_stats (FramePool *pool, FramePoolStats *stats)
+{
+    g_mutex_lock (&pool->lock);
+    *stats = pool->stats;
+    g_mutex_unlock (&pool->lock);
+}
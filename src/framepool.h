@@ -0,0 +1,72 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include "gifseeker.h"
+
+/**
+ *  Pool of snapshoots addressed by content of their source. Used by
+ *  context internally.
+ *
+ *  Snapshoot is defined by raster and rectangle of image, colors of
+ *  its palette, background and screen size, so images with equal
+ *  sources give equal snapshoots. frame_pool_hash fills hash of
+ *  source, raster is hashed once for lookup and insert.
+ *  frame_pool_lookup returns new reference to equal snapshoot, if
+ *  there is one, then conversion is not needed. frame_pool_insert
+ *  adds converted snapshoot, it returns snapshoot already added by other thread
+ *  and frees given one in that case. Pool does not hold references,
+ *  snapshoot leaves pool, when it is freed. Raster of source must
+ *  stay while its snapshoot is in pool, call frame_pool_forget before
+ *  freeing owner of rasters. All functions are thread safe.
+ */
+
+typedef struct FramePool FramePool;
+
+typedef struct FrameSource {
+    const SavedImage *image;
+    const GifPalette *palette;
+    int background;             //Index of background color
+    int width, height;          //Screen size
+    GifSnapshootFormat format;
+    gconstpointer owner;        //Gif, which owns raster
+    guint64 hash;               //Filled by frame_pool_hash
+} FrameSource;
+
+typedef struct FramePoolStats {
+    unsigned long shared;       //Snapshoots given instead of conversion
+    size_t frames;              //Snapshoots in pool
+    size_t bytes;               //Pixels of snapshoots in pool
+} FramePoolStats;
+
+FramePool *frame_pool_new (void);
+void frame_pool_free (FramePool *pool);
+
+void frame_pool_hash (FrameSource *source);
+GifSnapshoot *frame_pool_lookup (FramePool *pool, const FrameSource *source);
+GifSnapshoot *frame_pool_insert (FramePool *pool, const FrameSource *source,
+        GifSnapshoot *snap);
+gboolean frame_pool_release (GifSnapshoot *snap);
+void frame_pool_forget (FramePool *pool, gconstpointer owner);
+void frame_pool_get_stats (FramePool *pool, FramePoolStats *stats);
+
+#endif /*FRAMEPOOL_H*/
@@ -0,0 +1,778 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "giflzw.h"
+#include "parallel.h"
+#include "trace.h"
+
+//Must be power of two and bigger than LZW_MAX_CODES
+#define LZW_HASH_SIZE 8192
+#define LZW_HASH_MASK (LZW_HASH_SIZE - 1)
+
+typedef struct LzwEncoder {
+    GByteArray *out;
+    guint32 bits;           //Pending bits, LSB first
+    int bit_count;
+    byte block[256];        //Sub-block being filled, block[0] is size
+    //Dictionary: key is prefix code << 8 | index, -1 if slot is free
+    gint32 keys[LZW_HASH_SIZE];
+    gint16 codes[LZW_HASH_SIZE];
+} LzwEncoder;
+
+static void
+lzw_flush_block (LzwEncoder *enc)
+{
+    if (enc->block[0] > 0) {
+        g_byte_array_append (enc->out, enc->block, enc->block[0] + 1);
+        enc->block[0] = 0;
+    }
+}
+
+static void
+lzw_put_code (LzwEncoder *enc, int code, int code_size)
+{
+    enc->bits |= (guint32) code << enc->bit_count;
+    enc->bit_count += code_size;
+    while (enc->bit_count >= 8) {
+        enc->block[++enc->block[0]] = enc->bits & 0xff;
+        enc->bits >>= 8;
+        enc->bit_count -= 8;
+        if (enc->block[0] == 255) {
+            lzw_flush_block (enc);
+        }
+    }
+}
+
+static void
+lzw_reset (LzwEncoder *enc)
+{
+    memset (enc->keys, 0xff, sizeof (enc->keys));
+}
+
+static int
+lzw_find (LzwEncoder *enc, gint32 key)
+{
+    int slot = (key * 2654435761u) >> 19 & LZW_HASH_MASK;
+
+    while (enc->keys[slot] != -1 && enc->keys[slot] != key) {
+        slot = (slot + 1) & LZW_HASH_MASK;
+    }
+    return slot;
+}
+
+void
+lzw_encode (const byte *indices, size_t count, int min_code_size,
+        GByteArray *out)
+{
+    LzwEncoder *enc;
+    int clear_code = 1 << min_code_size;
+    int code_size = min_code_size + 1;
+    int next_code = clear_code + 2;
+    int prefix, slot;
+    gint32 key;
+    size_t i;
+    byte size = min_code_size;
+    TRACE_BEGIN (stamp);
+
+    enc = calloc (1, sizeof (LzwEncoder));
+    if (enc == NULL) {
+        put_error (1, "Can not allocate memory for LZW encoder");
+    }
+    enc->out = out;
+    g_byte_array_append (out, &size, 1);
+    lzw_reset (enc);
+    lzw_put_code (enc, clear_code, code_size);
+
+    if (count > 0) {
+        prefix = indices[0];
+        for (i = 1; i < count; ++i) {
+            key = prefix << 8 | indices[i];
+            slot = lzw_find (enc, key);
+            if (enc->keys[slot] == key) {
+                prefix = enc->codes[slot];
+                continue;
+            }
+            lzw_put_code (enc, prefix, code_size);
+            if (next_code < LZW_MAX_CODES) {
+                //Decoder widens codes one code later, than it adds them
+                if (next_code == 1 << code_size) {
+                    ++code_size;
+                }
+                enc->keys[slot] = key;
+                enc->codes[slot] = next_code++;
+            } else {
+                lzw_put_code (enc, clear_code, code_size);
+                lzw_reset (enc);
+                code_size = min_code_size + 1;
+                next_code = clear_code + 2;
+            }
+            prefix = indices[i];
+        }
+        lzw_put_code (enc, prefix, code_size);
+    }
+    //Decoder adds entry for the last code and may widen before end code
+    if (next_code == 1 << code_size && code_size < 12) {
+        ++code_size;
+    }
+    lzw_put_code (enc, clear_code + 1, code_size);
+    if (enc->bit_count > 0) {
+        lzw_put_code (enc, 0, 8 - enc->bit_count);
+    }
+    lzw_flush_block (enc);
+    size = 0;
+    g_byte_array_append (out, &size, 1);
+
+    free (enc);
+    TRACE_END (stamp, "lzw_encode");
+}
+
+typedef struct LzwDecoder {
+    const byte *data, *data_end;
+    size_t block_left;      //Bytes left in current sub-block
+    guint64 bits;           //Bit buffer, next code in low bits
+    int bit_count;
+    int min_code_size, code_size, clear_code, next_code;
+    int prev;               //Previous code, -1 after clear code
+    byte *out, *out_begin, *out_end;
+    gboolean over;          //Raster is full, data ended or is broken
+    //String of code is string of prefix followed by suffix
+    guint16 prefix[LZW_MAX_CODES];
+    byte suffix[LZW_MAX_CODES];
+    byte first[LZW_MAX_CODES];      //First byte of string
+    guint16 length[LZW_MAX_CODES];
+} LzwDecoder;
+
+/**
+ *  Fills bit buffer up to 57 bits or the end of data. Four codes of
+ *  the largest size fit in, so they are taken without refill.
+ */
+static inline void
+lzw_refill (LzwDecoder *dec)
+{
+    while (dec->bit_count <= 56) {
+        if (dec->block_left == 0) {
+            if (dec->data >= dec->data_end || *dec->data == 0) {
+                return;
+            }
+            dec->block_left = *dec->data++;
+        }
+        if (dec->data >= dec->data_end) {
+            return;
+        }
+        dec->bits |= (guint64) *dec->data++ << dec->bit_count;
+        dec->bit_count += 8;
+        --dec->block_left;
+    }
+}
+
+/**
+ *  Writes string of code ending at dst + length - 1.
+ *  Chain is walked backwards, so no stack is needed.
+ */
+static inline void
+lzw_put_string (const LzwDecoder *dec, int code, int clear_code, byte *dst)
+{
+    byte *p = dst + dec->length[code] - 1;
+
+    while (code >= clear_code) {
+        *p-- = dec->suffix[code];
+        code = dec->prefix[code];
+    }
+    *p = code;
+}
+
+static void
+lzw_deinterlace (const byte *src, byte *raster, int width, int height)
+{
+    static const int start[] = {0, 4, 2, 1}, step[] = {8, 8, 4, 2};
+    int pass, y;
+
+    for (pass = 0; pass < 4; ++pass) {
+        for (y = start[pass]; y < height; y += step[pass]) {
+            memcpy (raster + (size_t) y * width, src, width);
+            src += width;
+        }
+    }
+}
+
+/**
+ *  Prepares decoding of data into count pixels of out. Returns NULL, if
+ *  there is nothing to decode.
+ */
+static LzwDecoder *
+lzw_decoder_new (const byte *data, size_t size, byte *out, size_t count)
+{
+    LzwDecoder *dec;
+    int i;
+
+    if (size < 1 || count == 0 || data[0] < 1 || data[0] > 11) {
+        return NULL;
+    }
+    dec = malloc (sizeof (LzwDecoder));
+    if (dec == NULL) {
+        put_error (1, "Can not allocate memory for LZW decoder");
+    }
+    dec->data = data + 1;
+    dec->data_end = data + size;
+    dec->block_left = 0;
+    dec->bits = 0;
+    dec->bit_count = 0;
+
+    dec->min_code_size = data[0];
+    dec->clear_code = 1 << dec->min_code_size;
+    for (i = 0; i < dec->clear_code; ++i) {
+        dec->suffix[i] = dec->first[i] = i;
+        dec->length[i] = 1;
+    }
+    dec->code_size = dec->min_code_size + 1;
+    dec->next_code = dec->clear_code + 2;
+    dec->prev = -1;
+    dec->out = dec->out_begin = out;
+    dec->out_end = out + count;
+    dec->over = FALSE;
+    return dec;
+}
+
+/**
+ *  Decodes about limit pixels more, the last string may go over it.
+ *  State is kept in decoder, so decoding goes on with next call.
+ *  Returns number of pixels decoded by this call.
+ */
+static size_t
+lzw_decoder_run (LzwDecoder *dec, size_t limit)
+{
+    byte *out = dec->out, *out_end = dec->out_end, *stop;
+    byte tail[LZW_MAX_CODES];
+    int code_size = dec->code_size, clear_code = dec->clear_code;
+    int next_code = dec->next_code, prev = dec->prev, code, length;
+    guint32 mask = (1 << code_size) - 1;
+    size_t decoded;
+
+    stop = out + MIN (limit, (size_t) (out_end - out));
+    while (out < stop) {
+        lzw_refill (dec);
+        if (dec->bit_count < code_size) {
+            dec->over = TRUE;
+            break;
+        }
+        //Take all codes, which are in bit buffer
+        while (dec->bit_count >= code_size && out < stop) {
+            code = dec->bits & mask;
+            dec->bits >>= code_size;
+            dec->bit_count -= code_size;
+
+            if (code == clear_code) {
+                code_size = dec->min_code_size + 1;
+                mask = (1 << code_size) - 1;
+                next_code = clear_code + 2;
+                prev = -1;
+                continue;
+            }
+            if (code == clear_code + 1) {
+                dec->over = TRUE;
+                goto done;
+            }
+            if (prev < 0) {
+                if (code > clear_code) {
+                    dec->over = TRUE;
+                    goto done;
+                }
+                *out++ = code;
+                prev = code;
+                continue;
+            }
+            if (code > next_code || 
+                    (code == next_code && next_code >= LZW_MAX_CODES)) {
+                //Broken data
+                dec->over = TRUE;
+                goto done;
+            }
+
+            if (next_code < LZW_MAX_CODES) {
+                //New string is previous one and first byte of current,
+                //which is the first byte of previous if code is new
+                dec->prefix[next_code] = prev;
+                dec->first[next_code] = dec->first[prev];
+                dec->suffix[next_code] = code == next_code ?
+                        dec->first[prev] : dec->first[code];
+                dec->length[next_code] = dec->length[prev] + 1;
+                ++next_code;
+                if (next_code == (1 << code_size) && code_size < 12) {
+                    ++code_size;
+                    mask = (1 << code_size) - 1;
+                }
+            }
+
+            length = dec->length[code];
+            if (length == 1) {
+                *out++ = code;
+            } else if (out + length <= out_end) {
+                lzw_put_string (dec, code, clear_code, out);
+                out += length;
+            } else {
+                //Extra pixels are dropped
+                lzw_put_string (dec, code, clear_code, tail);
+                memcpy (out, tail, out_end - out);
+                out = out_end;
+            }
+            prev = code;
+        }
+    }
+
+done:
+    if (out == out_end) {
+        dec->over = TRUE;
+    }
+    decoded = out - dec->out;
+    dec->out = out;
+    dec->code_size = code_size;
+    dec->next_code = next_code;
+    dec->prev = prev;
+    return decoded;
+}
+
+size_t
+lzw_decode (const byte *data, size_t size, byte *raster,
+        int width, int height, gboolean interlace)
+{
+    LzwDecoder *dec;
+    size_t count = (size_t) width * height;
+    byte *out_begin;
+    TRACE_BEGIN (stamp);
+
+    if (size < 1 || count == 0 || data[0] < 1 || data[0] > 11) {
+        return 0;
+    }
+    out_begin = interlace ? malloc (count) : raster;
+    if (out_begin == NULL) {
+        put_error (1, "Can not allocate memory for LZW decoder");
+    }
+    dec = lzw_decoder_new (data, size, out_begin, count);
+    count = lzw_decoder_run (dec, count);
+
+    if (interlace) {
+        if (dec->out < dec->out_end) {
+            memset (dec->out, 0, dec->out_end - dec->out);
+        }
+        lzw_deinterlace (out_begin, raster, width, height);
+        free (out_begin);
+    }
+    free (dec);
+    TRACE_END (stamp, "lzw_decode");
+    return count;
+}
+
+typedef struct LzwSlurpJob {
+    SavedImage *images;
+    const byte *data;       //Raw data of all images one after another
+    const size_t *offsets;  //Image i data is between offsets i and i + 1
+    volatile gint first_defect; //The first broken image, or image count
+} LzwSlurpJob;
+
+static void
+lzw_slurp_image (int i, gpointer data)
+{
+    LzwSlurpJob *job = (LzwSlurpJob *) data;
+    GifImageDesc *desc = &job->images[i].ImageDesc;
+    gint first;
+
+    if (lzw_decode (job->data + job->offsets[i], 
+                job->offsets[i + 1] - job->offsets[i],
+                job->images[i].RasterBits, desc->Width, desc->Height,
+                desc->Interlace) < (size_t) desc->Width * desc->Height) {
+        do {
+            first = g_atomic_int_get (&job->first_defect);
+        } while (i < first && !g_atomic_int_compare_and_exchange (
+                    &job->first_defect, first, i));
+    }
+}
+
+void
+lzw_trim_images (GifFileType *gifFile, int count)
+{
+    SavedImage *image;
+
+    count = MAX (count, 0);
+    while (gifFile->ImageCount > count) {
+        image = &gifFile->SavedImages[--gifFile->ImageCount];
+        free (image->RasterBits);
+        image->RasterBits = NULL;
+        GifFreeExtensions (&image->ExtensionBlockCount, 
+                &image->ExtensionBlocks);
+        GifFreeMapObject (image->ImageDesc.ColorMap);
+        image->ImageDesc.ColorMap = NULL;
+    }
+}
+
+int
+lzw_slurp (GifFileType *gifFile)
+{
+    return lzw_slurp_threads (gifFile, 1);
+}
+
+/**
+ *  Reads image descriptor and raw data of image like it is stored in
+ *  file, raster is allocated, but not decoded. Extensions read before
+ *  are given to image.
+ */
+static int
+lzw_read_image_data (GifFileType *gifFile, GByteArray *data)
+{
+    SavedImage *image;
+    GifByteType *block;
+    size_t size;
+    int code_size;
+    byte terminator = 0, code_size_byte;
+
+    if (DGifGetImageDesc (gifFile) == GIF_ERROR) {
+        return GIF_ERROR;
+    }
+    image = &gifFile->SavedImages[gifFile->ImageCount - 1];
+    size = (size_t) image->ImageDesc.Width * image->ImageDesc.Height;
+    image->RasterBits = malloc (size > 0 ? size : 1);
+    if (image->RasterBits == NULL) {
+        gifFile->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        return GIF_ERROR;
+    }
+
+    if (DGifGetCode (gifFile, &code_size, &block) == GIF_ERROR) {
+        return GIF_ERROR;
+    }
+    code_size_byte = code_size;
+    g_byte_array_append (data, &code_size_byte, 1);
+    while (block != NULL) {
+        g_byte_array_append (data, block, block[0] + 1);
+        if (DGifGetCodeNext (gifFile, &block) == GIF_ERROR) {
+            return GIF_ERROR;
+        }
+    }
+    g_byte_array_append (data, &terminator, 1);
+
+    //Extensions before image belong to it
+    if (gifFile->ExtensionBlocks != NULL) {
+        image->ExtensionBlocks = gifFile->ExtensionBlocks;
+        image->ExtensionBlockCount = gifFile->ExtensionBlockCount;
+        gifFile->ExtensionBlocks = NULL;
+        gifFile->ExtensionBlockCount = 0;
+    }
+    return GIF_OK;
+}
+
+static int
+lzw_read_extension (GifFileType *gifFile)
+{
+    GifByteType *ext_data;
+    int ext_code;
+
+    if (DGifGetExtension (gifFile, &ext_code, &ext_data) == GIF_ERROR) {
+        return GIF_ERROR;
+    }
+    if (ext_data != NULL && GifAddExtensionBlock (
+                &gifFile->ExtensionBlockCount, 
+                &gifFile->ExtensionBlocks, ext_code,
+                ext_data[0], &ext_data[1]) == GIF_ERROR) {
+        return GIF_ERROR;
+    }
+    while (ext_data != NULL) {
+        if (DGifGetExtensionNext (gifFile, &ext_data) == GIF_ERROR) {
+            return GIF_ERROR;
+        }
+        if (ext_data != NULL && GifAddExtensionBlock (
+                    &gifFile->ExtensionBlockCount, 
+                    &gifFile->ExtensionBlocks, 
+                    CONTINUE_EXT_FUNC_CODE,
+                    ext_data[0], &ext_data[1]) == GIF_ERROR) {
+            return GIF_ERROR;
+        }
+    }
+    return GIF_OK;
+}
+
+int
+lzw_slurp_threads (GifFileType *gifFile, int threads)
+{
+    GifRecordType record;
+    GByteArray *data;
+    GArray *offsets;
+    LzwSlurpJob job;
+    size_t intact_len = 0;
+    int result = GIF_OK, intact = 0;
+    TRACE_BEGIN (stamp);
+
+    data = g_byte_array_new ();
+    offsets = g_array_new (FALSE, FALSE, sizeof (size_t));
+    //Images are read in order, but decoded later all together
+    do {
+        if (DGifGetRecordType (gifFile, &record) == GIF_ERROR) {
+            result = GIF_ERROR;
+            break;
+        }
+        switch (record) {
+        case IMAGE_DESC_RECORD_TYPE:
+            g_array_append_val (offsets, data->len);
+            result = lzw_read_image_data (gifFile, data);
+            if (result == GIF_OK) {
+                ++intact;
+                intact_len = data->len;
+            }
+            break;
+
+        case EXTENSION_RECORD_TYPE:
+            result = lzw_read_extension (gifFile);
+            break;
+
+        default:
+            break;
+        }
+    } while (result == GIF_OK && record != TERMINATE_RECORD_TYPE);
+
+    //Images read completely before error are decoded too
+    g_array_set_size (offsets, intact);
+    g_array_append_val (offsets, intact_len);
+    job.images = gifFile->SavedImages;
+    job.data = data->data;
+    job.offsets = (const size_t *) offsets->data;
+    job.first_defect = intact;
+    parallel_for (intact, threads, lzw_slurp_image, &job);
+    if (job.first_defect < intact && result == GIF_OK) {
+        gifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+        result = GIF_ERROR;
+    }
+    if (result == GIF_ERROR) {
+        lzw_trim_images (gifFile, job.first_defect);
+    }
+
+    g_array_free (offsets, TRUE);
+    g_byte_array_free (data, TRUE);
+    TRACE_END (stamp, "lzw_slurp");
+    return result;
+}
+
+int
+lzw_read_image (GifFileType *gifFile, gboolean *done)
+{
+    GifRecordType record;
+    SavedImage *image;
+    GByteArray *data;
+    int result = GIF_OK;
+    TRACE_BEGIN (stamp);
+
+    *done = FALSE;
+    //Only data of one image is kept
+    data = g_byte_array_new ();
+    do {
+        if (DGifGetRecordType (gifFile, &record) == GIF_ERROR) {
+            result = GIF_ERROR;
+            break;
+        }
+        switch (record) {
+        case IMAGE_DESC_RECORD_TYPE:
+            result = lzw_read_image_data (gifFile, data);
+            if (result == GIF_ERROR) {
+                break;
+            }
+            image = &gifFile->SavedImages[gifFile->ImageCount - 1];
+            if (lzw_decode (data->data, data->len, image->RasterBits,
+                        image->ImageDesc.Width, image->ImageDesc.Height,
+                        image->ImageDesc.Interlace) < 
+                    (size_t) image->ImageDesc.Width * 
+                    image->ImageDesc.Height) {
+                gifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                result = GIF_ERROR;
+            }
+            g_byte_array_free (data, TRUE);
+            TRACE_END (stamp, "lzw_read_image");
+            return result;
+
+        case EXTENSION_RECORD_TYPE:
+            result = lzw_read_extension (gifFile);
+            break;
+
+        case TERMINATE_RECORD_TYPE:
+            *done = TRUE;
+            break;
+
+        default:
+            break;
+        }
+    } while (result == GIF_OK && record != TERMINATE_RECORD_TYPE);
+
+    g_byte_array_free (data, TRUE);
+    TRACE_END (stamp, "lzw_read_image");
+    return result;
+}
+
+struct LzwStepDecoder {
+    GifFileType *gifFile;
+    GByteArray *data;       //Raw data of image being decoded
+    LzwDecoder *dec;        //NULL between images
+    byte *buffer;           //Rows of interlaced image in order of data
+    int intact;             //Images decoded completely
+    int error;              //Error, which stopped decoding, 0 if there is no
+};
+
+LzwStepDecoder *
+lzw_step_new (GifFileType *gifFile)
+{
+    LzwStepDecoder *step;
+
+    step = calloc (1, sizeof (LzwStepDecoder));
+    if (step == NULL) {
+        put_error (1, "Can not allocate memory for LZW decoder");
+    }
+    step->gifFile = gifFile;
+    step->data = g_byte_array_new ();
+    return step;
+}
+
+void
+lzw_step_free (LzwStepDecoder *step)
+{
+    if (step == NULL) {
+        return;
+    }
+    free (step->dec);
+    free (step->buffer);
+    g_byte_array_free (step->data, TRUE);
+    free (step);
+}
+
+/**
+ *  Reads records up to next image and starts decoding of it.
+ */
+static int
+lzw_step_begin (LzwStepDecoder *step, gboolean *done)
+{
+    GifFileType *gifFile = step->gifFile;
+    GifRecordType record;
+    GifImageDesc *desc;
+    byte *out;
+    size_t count;
+    int result = GIF_OK;
+
+    do {
+        if (DGifGetRecordType (gifFile, &record) == GIF_ERROR) {
+            return GIF_ERROR;
+        }
+        switch (record) {
+        case IMAGE_DESC_RECORD_TYPE:
+            g_byte_array_set_size (step->data, 0);
+            if (lzw_read_image_data (gifFile, step->data) == GIF_ERROR) {
+                return GIF_ERROR;
+            }
+            desc = &gifFile->SavedImages[gifFile->ImageCount - 1].ImageDesc;
+            count = (size_t) desc->Width * desc->Height;
+            if (count == 0) {
+                ++step->intact;
+                return GIF_OK;
+            }
+            out = gifFile->SavedImages[gifFile->ImageCount - 1].RasterBits;
+            if (desc->Interlace) {
+                out = step->buffer = malloc (count);
+                if (out == NULL) {
+                    put_error (1, "Can not allocate memory for LZW decoder");
+                }
+            }
+            step->dec = lzw_decoder_new (step->data->data, step->data->len,
+                    out, count);
+            if (step->dec == NULL) {
+                gifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+                return GIF_ERROR;
+            }
+            return GIF_OK;
+
+        case EXTENSION_RECORD_TYPE:
+            result = lzw_read_extension (gifFile);
+            break;
+
+        case TERMINATE_RECORD_TYPE:
+            *done = TRUE;
+            break;
+
+        default:
+            break;
+        }
+    } while (result == GIF_OK && record != TERMINATE_RECORD_TYPE);
+    return result;
+}
+
+/**
+ *  Finishes image, which decoder is over with.
+ */
+static int
+lzw_step_end (LzwStepDecoder *step)
+{
+    GifFileType *gifFile = step->gifFile;
+    SavedImage *image = &gifFile->SavedImages[gifFile->ImageCount - 1];
+    LzwDecoder *dec = step->dec;
+    int result = GIF_OK;
+
+    if (dec->out < dec->out_end) {
+        memset (dec->out, 0, dec->out_end - dec->out);
+        gifFile->Error = D_GIF_ERR_IMAGE_DEFECT;
+        result = GIF_ERROR;
+    }
+    if (step->buffer != NULL) {
+        lzw_deinterlace (step->buffer, image->RasterBits,
+                image->ImageDesc.Width, image->ImageDesc.Height);
+        free (step->buffer);
+        step->buffer = NULL;
+    }
+    free (dec);
+    step->dec = NULL;
+    if (result == GIF_OK) {
+        ++step->intact;
+    }
+    return result;
+}
+
+int
+lzw_step (LzwStepDecoder *step, size_t limit, gboolean *done)
+{
+    size_t decoded = 0;
+    int result = GIF_OK;
+    TRACE_BEGIN (stamp);
+
+    *done = FALSE;
+    if (step->error != 0) {
+        step->gifFile->Error = step->error;
+        return GIF_ERROR;
+    }
+    while (result == GIF_OK && !*done && decoded < limit) {
+        if (step->dec == NULL) {
+            result = lzw_step_begin (step, done);
+            continue;
+        }
+        decoded += lzw_decoder_run (step->dec, limit - decoded);
+        if (step->dec->over) {
+            result = lzw_step_end (step);
+        }
+    }
+    if (result == GIF_ERROR) {
+        step->error = step->gifFile->Error;
+        free (step->dec);
+        step->dec = NULL;
+        free (step->buffer);
+        step->buffer = NULL;
+        lzw_trim_images (step->gifFile, step->intact);
+    }
+    TRACE_END (stamp, "lzw_step");
+    return result;
+}
@@ -0,0 +1,77 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef GIFLZW_H
+#define GIFLZW_H
+
+#include "gifseeker.h"
+
+/**
+ *  Gif flavour of LZW codec.
+ *
+ *  lzw_encode appends minimum code size byte, data sub-blocks and
+ *  block terminator to out, like they are stored after image
+ *  descriptor. Indices must be less than 1 << min_code_size.
+ *
+ *  lzw_decode decodes such data of size bytes into raster of
+ *  width * height pixels. Rows of interlaced image are put in their
+ *  places. Returns number of decoded pixels, it is less than raster
+ *  size if data is broken or truncated.
+ *
+ *  lzw_slurp is a replacement of DGifSlurp, which reads records with
+ *  giflib, but decodes images with lzw_decode. Data of images is
+ *  independent, so lzw_slurp_threads decodes them on several threads,
+ *  on one per processor if threads is 0. On error images before the
+ *  first broken or truncated one are kept decoded, ImageCount is their
+ *  number. lzw_step keeps them the same way.
+ *  lzw_trim_images frees images from count on.
+ *
+ *  lzw_read_image reads records up to next image and decodes it, so
+ *  image is appended to SavedImages. It sets done, when trailer of
+ *  gif is read instead. Gif from slow stream is decoded image by image
+ *  with it, only data of one image is kept meanwhile.
+ *
+ *  LzwStepDecoder decodes gif in small steps, for callers, which can
+ *  not block for long, like main loop without worker threads. Each
+ *  lzw_step decodes about limit pixels and reads records it needs,
+ *  decoding goes on from the same place with next call. Images are
+ *  appended to SavedImages like by lzw_slurp, the last one may be
+ *  incomplete until done is set at the trailer.
+ *  After error lzw_step fails with the same error.
+ */
+
+#define LZW_MAX_CODES 4096
+
+void lzw_encode (const byte *indices, size_t count, int min_code_size,
+        GByteArray *out);
+size_t lzw_decode (const byte *data, size_t size, byte *raster,
+        int width, int height, gboolean interlace);
+int lzw_slurp (GifFileType *gifFile);
+int lzw_slurp_threads (GifFileType *gifFile, int threads);
+int lzw_read_image (GifFileType *gifFile, gboolean *done);
+void lzw_trim_images (GifFileType *gifFile, int count);
+
+typedef struct LzwStepDecoder LzwStepDecoder;
+
+LzwStepDecoder *lzw_step_new (GifFileType *gifFile);
+int lzw_step (LzwStepDecoder *step, size_t limit, gboolean *done);
+void lzw_step_free (LzwStepDecoder *step);
+
+#endif /*GIFLZW_H*/
@@ -0,0 +1,160 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "gifscan.h"
+
+#define GIF_EXTENSION 0x21
+#define GIF_IMAGE 0x2c
+#define GIF_TRAILER 0x3b
+#define GIF_CONTROL_LABEL 0xf9
+
+#define read_word(p) ((p)[0] | ((p)[1] << 8))
+#define colormap_bytes(flags) (3 << (((flags) & 0x07) + 1))
+
+/**
+ *  Skips data sub-blocks starting at offset.
+ *  Returns offset after block terminator or 0 if data ends before.
+ */
+static size_t
+skip_sub_blocks (const byte *data, size_t size, size_t offset)
+{
+    while (offset < size) {
+        if (data[offset] == 0) {
+            return offset + 1;
+        }
+        offset += data[offset] + 1;
+    }
+    return 0;
+}
+
+static void
+scan_control (GifScanFrame *frame, const byte *data, GifScanBlock *block)
+{
+    const byte *p = data + block->begin;
+
+    frame->control = *block;
+    //Block size must be 4, but be tolerant to wrong ones
+    if (block->end - block->begin < 8 || p[2] < 4) {
+        return;
+    }
+    frame->disposal = (p[3] >> 2) & 0x07;
+    frame->transparent = (p[3] & 0x01) ? p[6] : -1;
+    frame->delay = read_word (p + 4);
+}
+
+int
+gif_scan (GifScan *scan, const byte *data, size_t size)
+{
+    GifScanFrame frame;
+    GifScanBlock block, control = {0, 0};
+    size_t offset;
+    byte flags;
+
+    memset (scan, 0, sizeof (GifScan));
+    scan->data = data;
+    scan->size = size;
+    scan->extensions = g_array_new (FALSE, FALSE, sizeof (GifScanBlock));
+    scan->frames = g_array_new (FALSE, FALSE, sizeof (GifScanFrame));
+
+    if (size < 13 || memcmp (data, "GIF", 3) != 0) {
+        put_warning ("Data is not in gif format");
+        return -1;
+    }
+    scan->width = read_word (data + 6);
+    scan->height = read_word (data + 8);
+    flags = data[10];
+    offset = 13;
+    if (flags & 0x80) {
+        scan->colormap_size = 1 << ((flags & 0x07) + 1);
+        offset += colormap_bytes (flags);
+    }
+    if (offset > size) {
+        put_warning ("Gif screen descriptor is truncated");
+        return -1;
+    }
+    scan->screen_end = offset;
+
+    while (offset < size && data[offset] != GIF_TRAILER) {
+        block.begin = offset;
+        if (data[offset] == GIF_EXTENSION) {
+            if (offset + 2 > size) {
+                break;
+            }
+            block.end = skip_sub_blocks (data, size, offset + 2);
+            if (block.end == 0) {
+                break;
+            }
+            if (data[offset + 1] == GIF_CONTROL_LABEL) {
+                control = block;
+            } else if (scan->frames->len == 0) {
+                g_array_append_val (scan->extensions, block);
+            }
+        } else if (data[offset] == GIF_IMAGE) {
+            if (offset + 10 > size) {
+                break;
+            }
+            memset (&frame, 0, sizeof (GifScanFrame));
+            frame.transparent = -1;
+            if (control.end != 0) {
+                scan_control (&frame, data, &control);
+            }
+            frame.left = read_word (data + offset + 1);
+            frame.top = read_word (data + offset + 3);
+            frame.width = read_word (data + offset + 5);
+            frame.height = read_word (data + offset + 7);
+            flags = data[offset + 9];
+            frame.interlace = (flags & 0x40) != 0;
+            frame.lzw_data = offset + 10;
+            if (flags & 0x80) {
+                frame.colormap_size = 1 << ((flags & 0x07) + 1);
+                frame.lzw_data += colormap_bytes (flags);
+            }
+            if (frame.lzw_data >= size) {
+                break;
+            }
+            block.end = skip_sub_blocks (data, size, frame.lzw_data + 1);
+            if (block.end == 0) {
+                break;
+            }
+            frame.image = block;
+            g_array_append_val (scan->frames, frame);
+            control.begin = control.end = 0;
+        } else {
+            put_warning ("Unknown gif block 0x%02x at %lu",
+                    data[offset], (unsigned long) offset);
+            break;
+        }
+        offset = block.end;
+    }
+    scan->truncated = offset >= size || data[offset] != GIF_TRAILER;
+    return 0;
+}
+
+void
+gif_scan_clear (GifScan *scan)
+{
+    if (scan->extensions != NULL) {
+        g_array_free (scan->extensions, TRUE);
+    }
+    if (scan->frames != NULL) {
+        g_array_free (scan->frames, TRUE);
+    }
+    memset (scan, 0, sizeof (GifScan));
+}
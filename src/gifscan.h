@@ -0,0 +1,66 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GIFSCAN_H
+#define GIFSCAN_H
+
+#include "gifseeker.h"
+
+/**
+ *  Block structure of gif file. Call gif_scan to find offsets
+ *  of images in raw file data without decoding them and
+ *  gif_scan_clear to free the result.
+ *  Truncated file is scanned up to its last complete image.
+ */
+
+typedef struct GifScanBlock {
+    size_t begin, end;      //Offsets of block and after its terminator
+} GifScanBlock;
+
+typedef struct GifScanFrame {
+    GifScanBlock control;   //Graphics control extension, empty if none
+    GifScanBlock image;     //Image descriptor, colormap and LZW data
+    size_t lzw_data;        //Offset of LZW minimum code size byte
+    int left, top, width, height;
+    gboolean interlace;
+    int colormap_size;      //Size of local colormap, 0 if none
+    int disposal;           //Disposal method from control extension
+    int transparent;        //Transparent index, -1 if none
+    int delay;              //In hundredths of second
+} GifScanFrame;
+
+typedef struct GifScan {
+    const byte *data;
+    size_t size;
+    size_t screen_end;      //Offset after screen descriptor and colormap
+    int width, height;
+    int colormap_size;      //Size of global colormap, 0 if none
+    GArray *extensions;     //GifScanBlock's before first image
+    GArray *frames;         //GifScanFrame's
+    gboolean truncated;
+} GifScan;
+
+#define gif_scan_frame(scan, i) \
+    (&g_array_index ((scan)->frames, GifScanFrame, (i)))
+#define gif_scan_count(scan) ((int) (scan)->frames->len)
+
+int gif_scan (GifScan *scan, const byte *data, size_t size);
+void gif_scan_clear (GifScan *scan);
+
+#endif /*GIFSCAN_H*/
@@ -18,30 +18,178 @@
  */
 
 #include "gifseeker.h"
+#include "cache.h"
+#include "spill.h"
+#include "framepool.h"
+#include "gifscan.h"
+#include "giflzw.h"
+#include "archive.h"
+#include "parallel.h"
+#include "scheduler.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <gio/gio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 struct Context {
     GPtrArray *gifs;
     void *interface_data;
+    GifContextStats stats;
+    GifSnapshootFormat format;
+    SnapshootCache *cache;
+    SpillStore *spill;      //Disk tier of cache, NULL if disabled
+    FramePool *pool;        //Snapshoots shared by equal images
+    GPtrArray *watches;     //Monitors of gif files, NULL if not watching
+    GHashTable *members;    //Names of gifs read from archives
+    Scheduler *scheduler;   //Workers of async requests
+    gboolean idle_decode;   //Async requests decode in main loop slices
+    GHashTable *idle_tasks; //Sources of requests decoded in main loop
+    GifReloadFunc reload_func;
+    gpointer reload_data;
+    GCancellable *reload_cancellable;   //Cancelled by free_context
+    int reloads;            //Reloads, whose callback is not run yet
+    GMutex lock;            //Guards gifs array and stats
+    GCond idle;             //Signaled when async requests are over
+    int pending;            //Async requests in progress
 };
 
 typedef struct GifExtra {
+    volatile gint ref_count;    //Context and users of gif
+    volatile gint replaced;     //Reloaded gif took its place and filename
     char *filename;
+    char *name;             //Name of gif read from handle or archive
+    ArchiveReader *member;  //Archive member gif is read from until decoded
+    guint64 file_id;        //Hash of file identity, 0 if unknown
+    gint64 decode_time;     //Microseconds DGifSlurp took
+    LzwStepDecoder *stepper;    //Decoder of gif in slices, if started
+    volatile gint damage_error; //Error, which stopped decoding, 0 if none
+    int damage_begin, damage_end;   //Images lost, set before error
+    GMutex lock;            //Serializes decoding and conversion of gif
+    volatile gint decoded;  //Gif is slurped completely
+    volatile gint scanned_count;    //Images found by gif_scan, 0 if unknown,
+                                    //-1 if gif can not be scanned
+    GifPalette *palette;    //Global colormap look-up table
+    GifFileType *reader;    //Stream images are loaded from, if progressive
+    gboolean progressive;   //Images are loaded in background from stream
+    GCond loaded;           //Signaled when loader adds image or stops
+    volatile gint finished; //Loader reached end of stream
+    volatile gint abandoned;    //Context is freed, images are not waited
 } GifExtra;
 
+#ifdef ENABLE_BUILTIN_LZW
+//Images of gif are decoded on all processors
+#define gif_slurp(gifFile) lzw_slurp_threads (gifFile, 0)
+//Only intact images are kept after error
+#define gif_salvage(gifFile)
+#else
+#define gif_slurp(gifFile) DGifSlurp (gifFile)
+//Image being decoded, when error happened, is broken
+#define gif_salvage(gifFile) \
+    lzw_trim_images ((gifFile), (gifFile)->ImageCount - 1)
+#endif
+
+#define get_gif_extra(gifFile) ((GifExtra *) (gifFile)->UserData)
+
+//Pixels decoded between checks of time in slices
+#define GIF_STEP_PIXELS (64 << 10)
+//Microseconds of main loop iteration taken by idle decoding
+#define GIF_IDLE_SLICE_TIME 8000
+
+//Changes of file are waited to settle before it is reloaded
+#define GIF_RELOAD_DELAY 300
+
+/**
+ *  Monitor of gif file.
+ */
+typedef struct GifWatch {
+    PContext c;
+    int gif;
+    GFileMonitor *monitor;
+    guint timer;            //Reload timeout, 0 if there is no
+} GifWatch;
+
+typedef struct ReloadRequest {
+    PContext c;
+    int gif;
+    char *filename;
+} ReloadRequest;
+
+//Snapshoots of other format are spilled apart
+#define spill_id(file_id, format) \
+    ((file_id) != 0 ? (file_id) ^ ((guint64) (format) << 1) : 0)
+
+static void
+gif_extra_free (GifExtra *extra)
+{
+    g_mutex_clear (&extra->lock);
+    g_cond_clear (&extra->loaded);
+    palette_unref (extra->palette);
+    if (!extra->replaced) {
+        free (extra->filename);
+    }
+    g_free (extra->name);
+    archive_reader_free (extra->member);
+    lzw_step_free (extra->stepper);
+    free (extra);
+}
+
 void 
 destroy_GifFileType_notify (gpointer data)
 {
     GifFileType *gifFile = (GifFileType *) data;
-    int error = 0;
+    GifExtra *extra = get_gif_extra (gifFile);
+    gboolean progressive = FALSE;
 
-    if ((error = EGifCloseFile(gifFile)) != 0) {
-        put_warning ("Can not close file.");
+    if (extra != NULL) {
+        progressive = extra->progressive;
+        gif_extra_free (extra);
+        gifFile->UserData = NULL;
+    }
+    //Images of progressive gif were published by loader, it has no file
+    if (progressive) {
+        GifFreeMapObject (gifFile->SColorMap);
+        GifFreeExtensions (&gifFile->ExtensionBlockCount, 
+                &gifFile->ExtensionBlocks);
+        GifFreeSavedImages (gifFile);
         free (gifFile);
+        return;
+    }
+    if (DGifCloseFile(gifFile) == GIF_ERROR) {
+        put_warning ("Can not close file.");
+    }
+}
+
+/**
+ *  Releases reference to gif taken by context_get_gif.
+ */
+static void
+context_put_gif (GifFileType *gifFile)
+{
+    if (g_atomic_int_dec_and_test (&get_gif_extra (gifFile)->ref_count)) {
+        destroy_GifFileType_notify (gifFile);
+    }
+}
+
+static void
+context_task_begin (PContext c)
+{
+    g_mutex_lock (&c->lock);
+    ++c->pending;
+    g_mutex_unlock (&c->lock);
+}
+
+static void
+context_task_end (PContext c)
+{
+    g_mutex_lock (&c->lock);
+    if (--c->pending == 0) {
+        g_cond_broadcast (&c->idle);
     }
+    g_mutex_unlock (&c->lock);
 }
 
 PContext 
@@ -49,57 +197,460 @@ create_context (interface_init_f init, void *init_data)
 {
     PContext context;
 
-    context = malloc (sizeof (*context));
+    context = calloc (1, sizeof (*context));
     context->gifs = g_ptr_array_new_with_free_func (
-        destroy_GifFileType_notify);
+        (GDestroyNotify) context_put_gif);
+    context->cache = cache_new (CACHE_DEFAULT_HOT_SIZE, 
+            CACHE_DEFAULT_COLD_SIZE);
+    context->pool = frame_pool_new ();
+    context->members = g_hash_table_new (g_str_hash, g_str_equal);
+    context->idle_tasks = g_hash_table_new (NULL, NULL);
+    context->reload_cancellable = g_cancellable_new ();
+    context->scheduler = scheduler_get_default ();
+    g_mutex_init (&context->lock);
+    g_cond_init (&context->idle);
 
     init (init_data, context);
     
     return context;
 }
 
+/**
+ *  Takes reference to gif, it stays valid even if gif is reloaded
+ *  meanwhile. Release it with context_put_gif.
+ */
+static GifFileType *
+context_get_gif (const PContext c, int gif)
+{
+    GifFileType *gifFile = NULL;
+
+    g_mutex_lock (&c->lock);
+    if (gif >= 0 && gif < c->gifs->len) {
+        gifFile = (GifFileType *) c->gifs->pdata[gif];
+        g_atomic_int_inc (&get_gif_extra (gifFile)->ref_count);
+    }
+    g_mutex_unlock (&c->lock);
+    return gifFile;
+}
+
 void
 free_context (PContext c)
 {
+    GifFileType *gifFile;
+    GifExtra *extra;
+    GHashTableIter iter;
+    gpointer task, source;
+    int i;
+
+    //Idle requests can not run any more, main loop is over
+    g_hash_table_iter_init (&iter, c->idle_tasks);
+    while (g_hash_table_iter_next (&iter, &task, &source)) {
+        g_object_ref (task);
+        g_hash_table_iter_remove (&iter);
+        g_source_remove (GPOINTER_TO_UINT (source));
+        if (!g_task_return_error_if_cancelled (G_TASK (task))) {
+            g_task_return_new_error (G_TASK (task), G_IO_ERROR, 
+                    G_IO_ERROR_CANCELLED, "Context is freed");
+        }
+        context_task_end (c);
+        g_object_unref (task);
+    }
+
+    //No reload is started any more, finished ones are called back
+    //with cancelled error in main loop
+    if (c->watches != NULL) {
+        g_ptr_array_free (c->watches, TRUE);
+        c->watches = NULL;
+    }
+    g_cancellable_cancel (c->reload_cancellable);
+    while (c->reloads > 0) {
+        g_main_context_iteration (NULL, TRUE);
+    }
+
+    //Stream may never end, so workers waiting for its images stop
+    for (i = 0; (gifFile = context_get_gif (c, i)) != NULL; ++i) {
+        extra = get_gif_extra (gifFile);
+        if (extra->progressive) {
+            g_mutex_lock (&extra->lock);
+            extra->abandoned = TRUE;
+            g_cond_broadcast (&extra->loaded);
+            g_mutex_unlock (&extra->lock);
+        }
+        context_put_gif (gifFile);
+    }
+    //Workers may still use gifs, wait for them
+    g_mutex_lock (&c->lock);
+    while (c->pending > 0) {
+        g_cond_wait (&c->idle, &c->lock);
+    }
+    g_mutex_unlock (&c->lock);
+
+    g_object_unref (c->reload_cancellable);
+    cache_free (c->cache);
+    spill_close (c->spill);
+    frame_pool_free (c->pool);
+    g_hash_table_destroy (c->members);
+    g_hash_table_destroy (c->idle_tasks);
     g_ptr_array_free (c->gifs, TRUE);
+    g_cond_clear (&c->idle);
+    g_mutex_clear (&c->lock);
+    free (c);
+}
+
+static int
+context_add_gif (PContext c, GifFileType *gifFile)
+{
+    int result;
+
+    g_mutex_lock (&c->lock);
+    g_ptr_array_add (c->gifs, gifFile);
+    result = c->gifs->len - 1;
+    g_mutex_unlock (&c->lock);
+    return result;
+}
+
+static GifExtra *
+gif_extra_new (const char *filename)
+{
+    GifExtra *gif_extra;
+
+    gif_extra = calloc (1,sizeof(GifExtra));
+    if (gif_extra == NULL) {
+        put_error (1, "Can not allocate memory for gif data");
+    }
+    if (filename != NULL) {
+        gif_extra->filename = calloc (strlen (filename)+1,sizeof(char));
+        if (gif_extra->filename == NULL) {
+            put_error (1, "Can not allocate memory for filename");
+        }
+        strcpy (gif_extra->filename, filename);
+    }
+    gif_extra->ref_count = 1;
+    g_mutex_init (&gif_extra->lock);
+    g_cond_init (&gif_extra->loaded);
+    return gif_extra;
 }
 
+/**
+ *  Caches snapshoot of gif, unless reloaded gif replaced it.
+ *  Lock of gif must be held.
+ */
+static void
+gif_cache_insert (PContext c, GifFileType *gifFile, int gif, int gif_pos,
+        GifSnapshoot *snap)
+{
+    if (!g_atomic_int_get (&get_gif_extra (gifFile)->replaced)) {
+        cache_insert (c->cache, gif, gif_pos, snap);
+    }
+}
+
+static size_t
+gif_raster_bytes (const GifFileType *gifFile)
+{
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < gifFile->ImageCount; ++i) {
+        bytes += (size_t) gifFile->SavedImages[i].ImageDesc.Width *
+            gifFile->SavedImages[i].ImageDesc.Height;
+    }
+    return bytes;
+}
+
+/**
+ *  Marks gif as decoded completely. Lock of gif must be held.
+ */
+static void
+gif_decoded (PContext c, GifFileType *gifFile)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+
+    //Archive member is not read any more
+    archive_reader_free (extra->member);
+    extra->member = NULL;
+    g_atomic_int_set (&extra->decoded, TRUE);
+    metrics_observe (METRICS_DECODE, extra->decode_time);
+    g_mutex_lock (&c->lock);
+    ++c->stats.decodes;
+    //Raster of replaced gif is dropped with it
+    if (!g_atomic_int_get (&extra->replaced)) {
+        c->stats.decoded_bytes += gif_raster_bytes (gifFile);
+    }
+    g_mutex_unlock (&c->lock);
+}
+
+/**
+ *  Counts images of gif file by scanning its blocks. Returns -1, if
+ *  gif is not read from file or it can not be scanned.
+ */
+static int
+gif_scan_images (GifExtra *extra)
+{
+    GMappedFile *mapped;
+    GifScan scan;
+    int result;
+
+    result = g_atomic_int_get (&extra->scanned_count);
+    //Gif read from handle can not be mapped
+    if (result != 0 || extra->filename == NULL) {
+        return result > 0 ? result : -1;
+    }
+    //Failure is kept too, reloaded file gets new extra
+    mapped = g_mapped_file_new (extra->filename, FALSE, NULL);
+    if (mapped == NULL) {
+        g_atomic_int_set (&extra->scanned_count, -1);
+        return -1;
+    }
+    TRACE_BEGIN (stamp);
+    if (gif_scan (&scan, (const byte *) g_mapped_file_get_contents (mapped),
+                g_mapped_file_get_length (mapped)) < 0) {
+        result = -1;
+    } else {
+        result = gif_scan_count (&scan);
+    }
+    g_atomic_int_set (&extra->scanned_count, result > 0 ? result : -1);
+    gif_scan_clear (&scan);
+    g_mapped_file_unref (mapped);
+    TRACE_END (stamp, "gif_scan_images");
+    return result;
+}
+
+/**
+ *  Records error, which stopped decoding. Images before the broken one
+ *  were kept by decoder and stay viewable. Gif is not decoded again,
+ *  until its file changes and is reloaded. Lock of gif must be held.
+ */
+static void
+gif_damaged (PContext c, GifFileType *gifFile)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+    const char *name = extra->filename != NULL ? 
+            extra->filename : extra->name;
+
+    extra->damage_begin = gifFile->ImageCount;
+    //Scan finds complete images only, the broken one is lost too
+    extra->damage_end = MAX (gif_scan_images (extra), 
+            gifFile->ImageCount + 1);
+    g_atomic_int_set (&extra->damage_error, gifFile->Error != 0 ? 
+            gifFile->Error : D_GIF_ERR_READ_FAILED);
+    lzw_step_free (extra->stepper);
+    extra->stepper = NULL;
+    if (gifFile->ImageCount > 0) {
+        put_warning ("Gif '%s' is damaged, images %d-%d are lost. %s",
+                name, extra->damage_begin, extra->damage_end - 1,
+                GifErrorString (extra->damage_error));
+        gif_decoded (c, gifFile);
+    } else {
+        put_warning ("Can not decode gif '%s'. %s", name,
+                GifErrorString (extra->damage_error));
+        archive_reader_free (extra->member);
+        extra->member = NULL;
+    }
+}
+
+/**
+ *  Decodes gif in steps until deadline. Returns 1 if gif is decoded,
+ *  0 if time is over before, -1 on error. Lock of gif must be held.
+ */
+static int
+gif_step_check (PContext c, GifFileType *gifFile, gint64 deadline)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+    gboolean done = FALSE;
+    gint64 begin;
+    int result = GIF_OK;
+
+    if (extra->progressive || g_atomic_int_get (&extra->decoded)) {
+        return 1;
+    }
+    if (extra->damage_error != 0) {
+        return -1;
+    }
+    if (extra->stepper == NULL) {
+        extra->stepper = lzw_step_new (gifFile);
+    }
+    TRACE_BEGIN (stamp);
+    begin = g_get_monotonic_time ();
+    do {
+        result = lzw_step (extra->stepper, GIF_STEP_PIXELS, &done);
+    } while (result == GIF_OK && !done && 
+            g_get_monotonic_time () < deadline);
+    extra->decode_time += g_get_monotonic_time () - begin;
+    TRACE_END (stamp, "gif_step");
+
+    if (result == GIF_ERROR) {
+        gif_damaged (c, gifFile);
+        return gifFile->ImageCount > 0 ? 1 : -1;
+    }
+    if (!done) {
+        return 0;
+    }
+    lzw_step_free (extra->stepper);
+    extra->stepper = NULL;
+    gif_decoded (c, gifFile);
+    return 1;
+}
+
+/**
+ *  Decodes gif, if it was not yet. Lock of gif must be held.
+ */
 static int 
-gif_slurp_check (GifFileType *gifFile) {
-    if ( gifFile->ImageCount <= 0 ) {
-        if ( DGifSlurp (gifFile) == GIF_ERROR) {
-            put_warning ("%s", GifErrorString(gifFile->Error));
+gif_slurp_check (PContext c, GifFileType *gifFile, gboolean *decoded) {
+    GifExtra *extra = get_gif_extra (gifFile);
+    gint64 begin;
+
+    if (decoded != NULL) {
+        *decoded = FALSE;
+    }
+    //Progressive gif is decoded by its loader
+    if (extra->progressive) {
+        while (!extra->finished && !extra->abandoned) {
+            g_cond_wait (&extra->loaded, &extra->lock);
+        }
+        return gifFile->ImageCount > 0 ? 0 : -1;
+    }
+    //Broken gif is not decoded again
+    if (extra->damage_error != 0) {
+        return gifFile->ImageCount > 0 ? 0 : -1;
+    }
+    //Decoding started in slices goes on from where it stopped
+    if (extra->stepper != NULL) {
+        if (gif_step_check (c, gifFile, G_MAXINT64) < 0) {
             return -1;
+        }
+        if (decoded != NULL) {
+            *decoded = TRUE;
+        }
+        return 0;
+    }
+    if (gifFile->ImageCount <= 0 && !g_atomic_int_get (&extra->decoded)) {
+        TRACE_BEGIN (slurp_stamp);
+        begin = g_get_monotonic_time ();
+        if ( gif_slurp (gifFile) == GIF_ERROR) {
+            TRACE_END (slurp_stamp, "DGifSlurp");
+            extra->decode_time = g_get_monotonic_time () - begin;
+            gif_salvage (gifFile);
+            gif_damaged (c, gifFile);
+            return gifFile->ImageCount > 0 ? 0 : -1;
         };
+        TRACE_END (slurp_stamp, "DGifSlurp");
+        extra->decode_time = g_get_monotonic_time () - begin;
+        gif_decoded (c, gifFile);
+        if (decoded != NULL) {
+            *decoded = TRUE;
+        }
     }
     return 0;
 }
 
+/**
+ *  Makes image gif_pos available. Progressive gif is waited, until the
+ *  image arrives or stream ends, others are decoded completely. Lock of
+ *  gif must be held.
+ */
+static int
+gif_image_check (PContext c, GifFileType *gifFile, int gif_pos)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+
+    if (!extra->progressive) {
+        return gif_slurp_check (c, gifFile, NULL);
+    }
+    while (gifFile->ImageCount <= gif_pos && !extra->finished &&
+            !extra->abandoned) {
+        g_cond_wait (&extra->loaded, &extra->lock);
+    }
+    return gifFile->ImageCount > 0 ? 0 : -1;
+}
+
+/**
+ *  Identity of file for spill store. Changes with file.
+ */
+static guint64
+gif_file_id (const char *filename)
+{
+    GFile *file;
+    GFileInfo *info;
+    GChecksum *checksum;
+    const char *inode;
+    char *identity;
+    guint8 digest[32];
+    gsize digest_size = sizeof (digest);
+    guint64 file_id = 0;
+
+    file = g_file_new_for_path (filename);
+    info = g_file_query_info (file, G_FILE_ATTRIBUTE_ID_FILE ","
+            G_FILE_ATTRIBUTE_STANDARD_SIZE "," 
+            G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (info != NULL) {
+        inode = g_file_info_get_attribute_string (info, 
+                G_FILE_ATTRIBUTE_ID_FILE);
+        identity = g_strdup_printf ("%s:%s:%" G_GUINT64_FORMAT ":%" 
+                G_GUINT64_FORMAT ":%u", filename, 
+                inode != NULL ? inode : "",
+                (guint64) g_file_info_get_size (info),
+                g_file_info_get_attribute_uint64 (info,
+                    G_FILE_ATTRIBUTE_TIME_MODIFIED),
+                g_file_info_get_attribute_uint32 (info,
+                    G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+        checksum = g_checksum_new (G_CHECKSUM_SHA256);
+        g_checksum_update (checksum, (const guchar *) identity, -1);
+        g_checksum_get_digest (checksum, digest, &digest_size);
+        memcpy (&file_id, digest, sizeof (file_id));
+        g_checksum_free (checksum);
+        g_free (identity);
+        g_object_unref (info);
+    }
+    g_object_unref (file);
+    return file_id;
+}
+
+static void context_watch_gif (PContext c, int gif);
+
+static void
+context_update_spill_id (PContext c, int gif)
+{
+    GifFileType *gifFile = context_get_gif (c, gif);
+
+    if (gifFile != NULL) {
+        cache_set_gif_id (c->cache, gif, 
+                spill_id (get_gif_extra (gifFile)->file_id, c->format),
+                gifFile->SWidth, gifFile->SHeight);
+        context_put_gif (gifFile);
+    }
+}
+
 gboolean
 duplicated_file_check (PContext c, const char *filename) 
 {
-    GError *error = NULL;
     GFile *new_file, *old_file;
     GFileInfo *new_file_info, *old_file_info;
     char *new_file_id, *old_file_id;
     int i;
     gboolean result = TRUE;
+    TRACE_BEGIN (stamp);
 
     new_file = g_file_new_for_path(filename);
-    new_file_info = g_file_query_info (new_file,G_FILE_ATTRIBUTE_ID_FILE,G_FILE_QUERY_INFO_NONE,NULL, &error);
+    new_file_info = g_file_query_info (new_file,G_FILE_ATTRIBUTE_ID_FILE,G_FILE_QUERY_INFO_NONE,NULL, NULL);
     if (new_file_info != NULL) {
-        old_file_id = g_file_info_get_attribute_as_string(new_file_info,G_FILE_ATTRIBUTE_ID_FILE);
+        new_file_id = g_file_info_get_attribute_as_string(new_file_info,G_FILE_ATTRIBUTE_ID_FILE);
     } else {
-        old_file_id = NULL;
+        new_file_id = NULL;
     }
 
     for (i=0; i < c->gifs->len; ++i) {
+        //Gif read from handle has no file name
+        if (get_gif_filename(c,i) == NULL) {
+            continue;
+        }
         old_file = g_file_new_for_path (get_gif_filename(c,i));
         if (!g_file_equal (new_file, old_file)) {
             if ( new_file_id != NULL) {
-                old_file_info = g_file_query_info (old_file,G_FILE_ATTRIBUTE_ID_FILE,G_FILE_QUERY_INFO_NONE,NULL, &error);
+                old_file_info = g_file_query_info (old_file,G_FILE_ATTRIBUTE_ID_FILE,G_FILE_QUERY_INFO_NONE,NULL, NULL);
                 if (old_file_info != NULL) {
-                    old_file_id = g_file_info_get_attribute_as_string(new_file_info,G_FILE_ATTRIBUTE_ID_FILE);
+                    old_file_id = g_file_info_get_attribute_as_string(old_file_info,G_FILE_ATTRIBUTE_ID_FILE);
                     if (old_file_id != NULL) {
                         if (!strcmp(new_file_id,old_file_id)){
                             result = FALSE;
@@ -125,204 +676,1375 @@ duplicated_file_check (PContext c, const char *filename)
     }
     g_object_unref(new_file);
 
+    TRACE_END (stamp, "duplicated_file_check");
     return result;
 }
 
-int
-read_gif (PContext c, const char *filename, int *error)
+static int read_gif_stream (PContext c, int handle, const char *name,
+        int *error);
+
+/**
+ *  Input function of giflib for gifs read from archive.
+ */
+static int
+gif_member_input (GifFileType *gifFile, GifByteType *buffer, int size)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+
+    if (extra->member == NULL) {
+        return -1;
+    }
+    return archive_reader_read (extra->member, buffer, size);
+}
+
+static int
+read_gif_member (PContext c, Archive *archive, int member, int *error)
 {
     GifFileType *gif;
+    GifExtra *extra;
+    char *name;
     int result;
-    int filename_size;
-    GifExtra *gif_extra;
 
-    if (!duplicated_file_check(c, filename)) {
-        printf ("File '%s' is already loaded\n",filename);
+    name = g_strdup_printf ("%s:%s", archive_get_filename (archive),
+            archive_get_name (archive, member));
+    //Archives are big, so members are not compared one by one
+    g_mutex_lock (&c->lock);
+    if (g_hash_table_contains (c->members, name)) {
+        g_mutex_unlock (&c->lock);
+        printf ("File '%s' is already loaded\n", name);
+        g_free (name);
         return 0;
     }
+    g_mutex_unlock (&c->lock);
 
-    gif = DGifOpenFileName (filename, error);
-    if (gif != NULL) {
-        g_ptr_array_add (c->gifs, gif);
-        result = c->gifs->len - 1;
-    } else {
-        result = -1;
-        return result;
+    extra = gif_extra_new (NULL);
+    extra->name = name;
+    extra->member = archive_reader_new (archive, member);
+    //Giflib gives extra to input function as user data of gif
+    gif = DGifOpen (extra, gif_member_input, error);
+    if (gif == NULL) {
+        gif_extra_free (extra);
+        return -1;
     }
+    result = context_add_gif (c, gif);
+    g_mutex_lock (&c->lock);
+    g_hash_table_add (c->members, extra->name);
+    g_mutex_unlock (&c->lock);
+    return result;
+}
 
-    gif->UserData = NULL;
-    gif_extra = calloc (1,sizeof(GifExtra));
-    if (gif_extra == NULL) {
-        put_warning ("Can not allocate memory for filename");
-        return result;
+/**
+ *  Reads member of archive or all gifs in it, if member is NULL.
+ *  Returns number of first gif read.
+ */
+static int
+read_gif_archive (PContext c, const char *filename, const char *member,
+        int *error)
+{
+    Archive *archive;
+    const char *name;
+    int i, gif, result = -1;
+    TRACE_BEGIN (stamp);
+
+    archive = archive_open (filename);
+    if (archive == NULL) {
+        *error = D_GIF_ERR_OPEN_FAILED;
+        TRACE_END (stamp, "read_gif_archive");
+        return -1;
     }
-    filename_size = strlen (filename);
-    gif_extra->filename = calloc (filename_size+1,sizeof(char));
-    if (gif_extra->filename == NULL) {
-        free(gif_extra);
-        put_warning ("Can not allocate memory for filename");
-        return result;
+    if (member != NULL) {
+        i = archive_find (archive, member);
+        if (i < 0) {
+            put_warning ("There is no '%s' in '%s'", member, filename);
+            *error = D_GIF_ERR_OPEN_FAILED;
+        } else {
+            result = read_gif_member (c, archive, i, error);
+        }
+    } else {
+        for (i = 0; i < archive_get_count (archive); ++i) {
+            name = archive_get_name (archive, i);
+            //Only gifs of archive go to collection
+            if (strlen (name) < 4 || g_ascii_strcasecmp (
+                        name + strlen (name) - 4, ".gif") != 0) {
+                continue;
+            }
+            gif = read_gif_member (c, archive, i, error);
+            if (gif < 0) {
+                put_warning ("Can not read '%s:%s'. %s", filename, name,
+                        GifErrorString (*error));
+            } else if (result < 0) {
+                result = gif;
+            }
+        }
+        if (result < 0) {
+            put_warning ("There is no gif in '%s'", filename);
+            *error = D_GIF_ERR_NOT_GIF_FILE;
+        }
     }
-    strcpy (gif_extra->filename, filename);
-    gif->UserData = gif_extra;
-
+    archive_unref (archive);
+    TRACE_END (stamp, "read_gif_archive");
     return result;
 }
 
 int
-read_gif_handle (PContext c, int handle, int *error)
+read_gif (PContext c, const char *filename, int *error)
 {
     GifFileType *gif;
-    int result = 0;
-    gif = DGifOpenFileHandle (handle, error);
+    char *archive_filename, *member;
+    int result, handle;
+    TRACE_BEGIN (stamp);
+
+    if (strcmp (filename, "-") == 0) {
+        TRACE_END (stamp, "read_gif");
+        return read_gif_stream (c, STDIN_FILENO, "stdin", error);
+    }
+    //Whole archive is expanded, "bundle.tar:x.gif" is its member
+    if (archive_is_archive (filename) && 
+            g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+        TRACE_END (stamp, "read_gif");
+        return read_gif_archive (c, filename, NULL, error);
+    }
+    if (!g_file_test (filename, G_FILE_TEST_EXISTS) &&
+            archive_split_path (filename, &archive_filename, &member)) {
+        result = read_gif_archive (c, archive_filename, member, error);
+        g_free (archive_filename);
+        g_free (member);
+        TRACE_END (stamp, "read_gif");
+        return result;
+    }
+    //Pipe can be read only once, so it is loaded while it is read
+    if (g_file_test (filename, G_FILE_TEST_EXISTS) &&
+            !g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+        handle = open (filename, O_RDONLY);
+        if (handle < 0) {
+            *error = D_GIF_ERR_OPEN_FAILED;
+            TRACE_END (stamp, "read_gif");
+            return -1;
+        }
+        TRACE_END (stamp, "read_gif");
+        return read_gif_stream (c, handle, filename, error);
+    }
+
+    if (!duplicated_file_check(c, filename)) {
+        printf ("File '%s' is already loaded\n",filename);
+        TRACE_END (stamp, "read_gif");
+        return 0;
+    }
+
+    gif = DGifOpenFileName (filename, error);
     if (gif != NULL) {
-        g_ptr_array_add (c->gifs, gif);
+        gif->UserData = gif_extra_new (filename);
+        get_gif_extra (gif)->file_id = gif_file_id (filename);
+        result = context_add_gif (c, gif);
+        context_update_spill_id (c, result);
+        if (c->watches != NULL) {
+            context_watch_gif (c, result);
+        }
     } else {
         result = -1;
     }
+
+    TRACE_END (stamp, "read_gif");
     return result;
 }
 
-#define BITSPERPIXEL 4
-
-int
-colormap_to_GRB24(GifSnapshoot *snap, 
-        GifColorType *colortable, int colors,
-        GifWord s_background_color,
-        GifWord s_width, GifWord s_height,
-        GifWord left_offset, GifWord top_offset) 
+/**
+ *  Moves image, which reader has just decoded, to gif, which is seen by
+ *  context. Reader keeps no images, so stream is never held in memory.
+ */
+static void
+gif_publish_image (GifFileType *gifFile, GifFileType *reader)
 {
-    GifPixelType *raw = snap->pixmap;
-    int 
-        width = snap->width,
-        height = snap->height;
-    int i, j, y, z;
-
-    snap->pixmap = calloc (s_width*s_height*BITSPERPIXEL, 
-            sizeof(unsigned char));
-    if (snap->pixmap == NULL) {
-        put_error (1, "Can not allocate mamory"
-            "for gif snapshoot.");
-    }
+    GifExtra *extra = get_gif_extra (gifFile);
+    SavedImage *images;
+    size_t bytes;
 
-    for (i=0; i<s_width*s_height; ++i) {
-        ((GifWord*)snap->pixmap)[i] = s_background_color;
+    bytes = (gifFile->ImageCount + 1) * sizeof (SavedImage);
+    g_mutex_lock (&extra->lock);
+    images = realloc (gifFile->SavedImages, bytes);
+    if (images == NULL) {
+        put_error (1, "Can not allocate memory for gif images");
     }
+    images[gifFile->ImageCount] = reader->SavedImages[reader->ImageCount - 1];
+    gifFile->SavedImages = images;
+    g_atomic_int_inc (&gifFile->ImageCount);
+    g_cond_broadcast (&extra->loaded);
+    g_mutex_unlock (&extra->lock);
 
-    for (i=top_offset; i<top_offset + height; ++i)
-        for (j=left_offset; j<left_offset + width; ++j){
-            y = i*s_width + j;
-            z = i*width + j;
-            if (0>raw[z], colors<raw[y]) {
-                put_warning("Wrong colormap index: %d", 
-                    raw[z]);
-                free (snap->pixmap);
-                return GIF_ERROR;
-            }
-            snap->pixmap[y*BITSPERPIXEL + 0] =
-                colortable[raw[z]].Blue;
-            snap->pixmap[y*BITSPERPIXEL + 1] =
-                colortable[raw[z]].Green;
-            snap->pixmap[y*BITSPERPIXEL + 2] =
-                colortable[raw[z]].Red;
-        }
-    return GIF_OK;
+    free (reader->SavedImages);
+    reader->SavedImages = NULL;
+    reader->ImageCount = 0;
 }
 
-GifSnapshoot * 
-get_snapshoot (const PContext c, 
-        int gif, 
-        float gif_pos)
+/**
+ *  Decodes images of gif one by one, as they arrive from stream.
+ *  Runs in its own thread, because stream may block for long.
+ */
+static gpointer
+gif_load_thread (gpointer data)
 {
-    GifFileType *gifFile;
+    GifFileType *gifFile = (GifFileType *) data;
+    GifExtra *extra = get_gif_extra (gifFile);
+    GifFileType *reader = extra->reader;
+    gint64 begin = g_get_monotonic_time ();
+    gboolean done = FALSE;
+    int result = GIF_OK;
 
-    if (!gifptr_correct(gif,c)
-        && gif_pos < 0 && gif_pos >= 1 ) {
-        put_warning ("Wrong gif pointer "
-                "%d:%1.4f",gif,gif_pos );
-        return NULL;
+    while (!done && (result = lzw_read_image (reader, &done)) == GIF_OK) {
+        if (!done) {
+            gif_publish_image (gifFile, reader);
+        }
     }
-    gifFile = ((GifFileType *) c->gifs->pdata[gif]);
-
-    if (gif_slurp_check(gifFile) < 0) {
-        return NULL;
+    //Images read before error stay viewable
+    if (result == GIF_ERROR) {
+        put_warning ("Stream '%s' is broken after %d images. %s", 
+                extra->name, gifFile->ImageCount,
+                GifErrorString (reader->Error));
     }
 
-    return get_snapshoot_pos (c, gif, (int) (gifFile->ImageCount * gif_pos) );
+    g_mutex_lock (&extra->lock);
+    extra->decode_time = g_get_monotonic_time () - begin;
+    extra->reader = NULL;
+    g_atomic_int_set (&extra->finished, TRUE);
+    g_atomic_int_set (&extra->decoded, TRUE);
+    g_cond_broadcast (&extra->loaded);
+    g_mutex_unlock (&extra->lock);
+
+    if (DGifCloseFile (reader) == GIF_ERROR) {
+        put_warning ("Can not close stream '%s'.", extra->name);
+    }
+    context_put_gif (gifFile);
+    return NULL;
 }
-GifSnapshoot * 
-get_snapshoot_pos (const PContext c, 
-        int gif, 
-        int gif_pos)
+
+static int
+read_gif_stream (PContext c, int handle, const char *name, int *error)
 {
-    GifFileType *gifFile;
-    SavedImage *image;
-    GifSnapshoot *snap;
-    ColorMapObject *colormap;
+    GifFileType *reader, *gif;
+    GifExtra *extra;
+    GThread *thread;
+    int result;
 
-    if (!gifptr_correct(gif, c)
-        && gif_pos < 0 && gif_pos >= 1 ) {
-        put_warning ("Wrong gif pointer "
-                "%d:%d",gif,gif_pos );
-        return NULL;
+    reader = DGifOpenFileHandle (handle, error);
+    if (reader == NULL) {
+        return -1;
     }
-    gifFile = ((GifFileType *) c->gifs->pdata[gif]);
-
-    if (gif_slurp_check(gifFile) < 0) {
-        return NULL;
+    gif = calloc (1, sizeof (GifFileType));
+    if (gif == NULL) {
+        put_error (1, "Can not allocate memory for gif");
     }
+    //Screen descriptor is read on open
+    gif->SWidth = reader->SWidth;
+    gif->SHeight = reader->SHeight;
+    gif->SColorResolution = reader->SColorResolution;
+    gif->SBackGroundColor = reader->SBackGroundColor;
+    gif->AspectByte = reader->AspectByte;
+    gif->SColorMap = reader->SColorMap;
+    reader->SColorMap = NULL;
 
-    image = gifFile->SavedImages + gif_pos;
+    gif->UserData = extra = gif_extra_new (NULL);
+    extra->name = g_strdup (name);
+    extra->reader = reader;
+    extra->progressive = TRUE;
+    //Loader holds its own reference
+    extra->ref_count = 2;
+    result = context_add_gif (c, gif);
 
-    snap = calloc (1,sizeof(GifSnapshoot));
-    if (snap == NULL) {
-        put_error (1, "Can not allocate mamory"
-            "for gif snapshoot.");
-    }
+    thread = g_thread_new ("gif_load", gif_load_thread, gif);
+    g_thread_unref (thread);
+    return result;
+}
 
-	snap->width = image->ImageDesc.Width;
-	snap->height = image->ImageDesc.Height;
-    snap->pixmap = image->RasterBits;
+int
+read_gif_handle (PContext c, int handle, int *error)
+{
+    char *name;
+    int result;
+
+    name = g_strdup_printf ("fd %d", handle);
+    result = read_gif_stream (c, handle, name, error);
+    g_free (name);
+    return result;
+}
+
+#define BITSPERPIXEL 4
+
+static GifPalette *
+palette_new (const ColorMapObject *colormap)
+{
+    GifPalette *palette;
+    const GifColorType *color;
+    int i, count = 0;
+
+    palette = calloc (1, sizeof (GifPalette));
+    if (palette == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for gif palette.");
+    }
+    palette->ref_count = 1;
+
+    if (colormap != NULL) {
+        count = MIN (colormap->ColorCount, GIF_PALETTE_SIZE);
+    }
+    //Wrong indices are drawn black
+    for (i = 0; i < GIF_PALETTE_SIZE; ++i) {
+        palette->colors[i] = 0xff000000;
+    }
+    for (i = 0; i < count; ++i) {
+        color = colormap->Colors + i;
+        palette->colors[i] |= 
+            (color->Red << 16) | (color->Green << 8) | color->Blue;
+    }
+    return palette;
+}
+
+GifPalette *
+palette_ref (GifPalette *palette)
+{
+    g_atomic_int_inc (&palette->ref_count);
+    return palette;
+}
+
+void
+palette_unref (GifPalette *palette)
+{
+    if (palette != NULL && g_atomic_int_dec_and_test (&palette->ref_count)) {
+        free (palette);
+    }
+}
+
+/**
+ *  Palette of image. Global one is built once per gif.
+ *  Lock of gif must be held.
+ */
+static GifPalette *
+get_image_palette (GifFileType *gifFile, SavedImage *image)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+
+    if (image->ImageDesc.ColorMap != NULL) {
+        return palette_new (image->ImageDesc.ColorMap);
+    }
+    if (extra->palette == NULL) {
+        extra->palette = palette_new (gifFile->SColorMap);
+    }
+    return palette_ref (extra->palette);
+}
+
+/**
+ *  Look-up table kernel, expands indices of row to BGRX pixels.
+ */
+static inline void
+expand_row (const byte *src, guint32 *dst, int n, const guint32 *lut)
+{
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        dst[i + 0] = lut[src[i + 0]];
+        dst[i + 1] = lut[src[i + 1]];
+        dst[i + 2] = lut[src[i + 2]];
+        dst[i + 3] = lut[src[i + 3]];
+    }
+    for (; i < n; ++i) {
+        dst[i] = lut[src[i]];
+    }
+}
+
+/**
+ *  Clips image rectangle by screen.
+ *  Returns FALSE if nothing is left.
+ */
+static gboolean
+clip_image_rect (const GifImageDesc *desc, 
+        GifWord s_width, GifWord s_height,
+        int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = MAX (desc->Left, 0);
+    *y0 = MAX (desc->Top, 0);
+    *x1 = MIN (desc->Left + desc->Width, s_width);
+    *y1 = MIN (desc->Top + desc->Height, s_height);
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+//Canvas is converted by bands of rows, on several threads if it is big
+#define CONVERT_BAND_ROWS 64
+#define CONVERT_PARALLEL_PIXELS (1 << 20)
+
+typedef struct ConvertJob {
+    GifSnapshoot *snap;
+    const GifPalette *palette;
+    const SavedImage *image;
+    int background;
+    int x0, y0, x1, y1;     //Visible part of image
+} ConvertJob;
+
+static void
+convert_band_GRB24 (int band, gpointer data)
+{
+    ConvertJob *job = (ConvertJob *) data;
+    const GifImageDesc *desc = &job->image->ImageDesc;
+    int width = job->snap->width;
+    int y0 = band * CONVERT_BAND_ROWS;
+    int y1 = MIN (y0 + CONVERT_BAND_ROWS, job->snap->height);
+    guint32 background = job->palette->colors[job->background];
+    guint32 *row;
+    int i, x;
+
+    for (i = y0; i < y1; ++i) {
+        row = (guint32 *) job->snap->pixmap + (size_t) i * width;
+        if (i < job->y0 || i >= job->y1) {
+            for (x = 0; x < width; ++x) {
+                row[x] = background;
+            }
+            continue;
+        }
+        for (x = 0; x < job->x0; ++x) {
+            row[x] = background;
+        }
+        expand_row (job->image->RasterBits + 
+                (size_t) (i - desc->Top) * desc->Width + (job->x0 - desc->Left),
+                row + job->x0, job->x1 - job->x0, job->palette->colors);
+        for (x = job->x1; x < width; ++x) {
+            row[x] = background;
+        }
+    }
+}
+
+static void
+convert_band_indexed (int band, gpointer data)
+{
+    ConvertJob *job = (ConvertJob *) data;
+    const GifImageDesc *desc = &job->image->ImageDesc;
+    int width = job->snap->width;
+    int y0 = band * CONVERT_BAND_ROWS;
+    int y1 = MIN (y0 + CONVERT_BAND_ROWS, job->snap->height);
+    byte *row;
+    int i;
+
+    for (i = y0; i < y1; ++i) {
+        row = job->snap->indices + (size_t) i * width;
+        if (i < job->y0 || i >= job->y1) {
+            memset (row, job->background, width);
+            continue;
+        }
+        memset (row, job->background, job->x0);
+        memcpy (row + job->x0, job->image->RasterBits + 
+                (size_t) (i - desc->Top) * desc->Width + (job->x0 - desc->Left),
+                job->x1 - job->x0);
+        memset (row + job->x1, job->background, width - job->x1);
+    }
+}
+
+/**
+ *  Puts image on background of screen size band by band.
+ */
+static void
+convert_snapshoot (GifSnapshoot *snap, const GifPalette *palette, 
+        const SavedImage *image, GifWord s_background_color,
+        GifWord s_width, GifWord s_height, ParallelFunc convert_band)
+{
+    ConvertJob job;
+    int bands = (s_height + CONVERT_BAND_ROWS - 1) / CONVERT_BAND_ROWS;
+
+    job.snap = snap;
+    job.palette = palette;
+    job.image = image;
+    job.background = s_background_color & 0xff;
+    if (!clip_image_rect (&image->ImageDesc, s_width, s_height,
+                &job.x0, &job.y0, &job.x1, &job.y1)) {
+        job.x0 = job.y0 = job.x1 = job.y1 = 0;
+    }
+    snap->width = s_width;
+    snap->height = s_height;
+    parallel_for (bands, (size_t) s_width * s_height >= 
+            CONVERT_PARALLEL_PIXELS ? 0 : 1, convert_band, &job);
+}
+
+int
+colormap_to_GRB24(GifSnapshoot *snap, 
+        const GifPalette *palette, const SavedImage *image,
+        GifWord s_background_color,
+        GifWord s_width, GifWord s_height) 
+{
+    TRACE_BEGIN (stamp);
+
+    snap->pixmap = malloc ((size_t) s_width*s_height*BITSPERPIXEL);
+    if (snap->pixmap == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for gif snapshoot.");
+    }
+    convert_snapshoot (snap, palette, image, s_background_color,
+            s_width, s_height, convert_band_GRB24);
+    snap->format = GIF_SNAPSHOOT_BGRX;
+    TRACE_END (stamp, "colormap_to_GRB24");
+    return GIF_OK;
+}
+
+int
+colormap_to_indexed(GifSnapshoot *snap, 
+        GifPalette *palette, const SavedImage *image,
+        GifWord s_background_color,
+        GifWord s_width, GifWord s_height) 
+{
+    TRACE_BEGIN (stamp);
+
+    snap->indices = malloc ((size_t) s_width*s_height);
+    if (snap->indices == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for gif snapshoot.");
+    }
+    convert_snapshoot (snap, palette, image, s_background_color,
+            s_width, s_height, convert_band_indexed);
+    snap->format = GIF_SNAPSHOOT_INDEXED;
+    snap->palette = palette_ref (palette);
+    TRACE_END (stamp, "colormap_to_indexed");
+    return GIF_OK;
+}
+
+void
+snapshoot_expand (const GifSnapshoot *sh, 
+        int x, int y, int width, int height,
+        unsigned char *dst, int dst_stride)
+{
+    int i;
+
+    x = MAX (x, 0);
+    y = MAX (y, 0);
+    width = MIN (width, sh->width - x);
+    height = MIN (height, sh->height - y);
+
+    for (i = 0; i < height; ++i) {
+        if (sh->format == GIF_SNAPSHOOT_INDEXED) {
+            expand_row (sh->indices + (size_t) (y + i) * sh->width + x, 
+                    (guint32 *) (dst + (size_t) i * dst_stride), width,
+                    sh->palette->colors);
+        } else {
+            memcpy (dst + (size_t) i * dst_stride, sh->pixmap + 
+                    ((size_t) (y + i) * sh->width + x) * BITSPERPIXEL,
+                    width * BITSPERPIXEL);
+        }
+    }
+}
+
+size_t
+get_snapshoot_size (const GifSnapshoot *sh)
+{
+    size_t pixels = (size_t) sh->width * sh->height;
+
+    if (sh->format == GIF_SNAPSHOOT_INDEXED) {
+        return pixels + sizeof (GifPalette);
+    }
+    return pixels * BITSPERPIXEL;
+}
+
+GifSnapshoot * 
+get_snapshoot (const PContext c, 
+        int gif, 
+        float gif_pos)
+{
+    int count;
+
+    if (gif_pos < 0 || gif_pos >= 1) {
+        put_warning ("Wrong gif pointer "
+                "%d:%1.4f",gif,gif_pos );
+        return NULL;
+    }
+    count = get_gif_image_count (c, gif);
+    if (count <= 0) {
+        return NULL;
+    }
+
+    return get_snapshoot_pos (c, gif, (int) (count * gif_pos) );
+}
+
+/**
+ *  Makes snapshoot of gif, which is taken from context.
+ */
+static GifSnapshoot *
+gif_get_snapshoot (const PContext c, GifFileType *gifFile,
+        int gif, int gif_pos)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+    SavedImage *image;
+    GifSnapshoot *snap;
+    GifPalette *palette;
+    FrameSource source;
+    gint64 convert_begin;
+    int result;
+
+    snap = cache_lookup (c->cache, gif, gif_pos);
+    if (snap != NULL) {
+        g_mutex_lock (&c->lock);
+        ++c->stats.snapshoots;
+        g_mutex_unlock (&c->lock);
+        return snap;
+    }
+
+    g_mutex_lock (&extra->lock);
+    if (gif_image_check (c, gifFile, gif_pos) < 0) {
+        g_mutex_unlock (&extra->lock);
+        return NULL;
+    }
+    if (gif_pos < 0 || gif_pos >= gifFile->ImageCount) {
+        g_mutex_unlock (&extra->lock);
+        put_warning ("Wrong gif pointer "
+                "%d:%d",gif,gif_pos );
+        return NULL;
+    }
+
+    image = gifFile->SavedImages + gif_pos;
+    palette = get_image_palette (gifFile, image);
+    source.image = image;
+    source.palette = palette;
+    source.background = gifFile->SBackGroundColor & 0xff;
+    source.width = gifFile->SWidth;
+    source.height = gifFile->SHeight;
+    source.format = c->format;
+    source.owner = gifFile;
+    frame_pool_hash (&source);
+
+    //Equal image is converted already
+    snap = frame_pool_lookup (c->pool, &source);
+    if (snap != NULL) {
+        palette_unref (palette);
+        gif_cache_insert (c, gifFile, gif, gif_pos, snap);
+        g_mutex_unlock (&extra->lock);
+
+        g_mutex_lock (&c->lock);
+        ++c->stats.snapshoots;
+        g_mutex_unlock (&c->lock);
+        return snap;
+    }
+
+    snap = calloc (1,sizeof(GifSnapshoot));
+    if (snap == NULL) {
+        put_error (1, "Can not allocate mamory"
+            "for gif snapshoot.");
+    }
+    snap->ref_count = 1;
+
+    convert_begin = g_get_monotonic_time ();
+    if (c->format == GIF_SNAPSHOOT_INDEXED) {
+        result = colormap_to_indexed (snap, palette, image,
+            gifFile->SBackGroundColor,
+            gifFile->SWidth, gifFile->SHeight);
+    } else {
+        result = colormap_to_GRB24 (snap, palette, image,
+            gifFile->SBackGroundColor,
+            gifFile->SWidth, gifFile->SHeight);
+    }
+
+    if (result != GIF_OK) {
+        palette_unref (palette);
+        g_mutex_unlock (&extra->lock);
+        free (snap);
+        return NULL;
+    }
+    snap->decode_time = extra->decode_time;
+    snap->convert_time = g_get_monotonic_time () - convert_begin;
+    metrics_observe (METRICS_CONVERT, snap->convert_time);
+    snap = frame_pool_insert (c->pool, &source, snap);
+    palette_unref (palette);
+    gif_cache_insert (c, gifFile, gif, gif_pos, snap);
+    g_mutex_unlock (&extra->lock);
+
+    g_mutex_lock (&c->lock);
+    ++c->stats.snapshoots;
+    ++c->stats.cache_misses;
+    g_mutex_unlock (&c->lock);
+    return snap;
+}
+
+GifSnapshoot * 
+get_snapshoot_pos (const PContext c, 
+        int gif, 
+        int gif_pos)
+{
+    GifFileType *gifFile;
+    GifSnapshoot *snap;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        put_warning ("Wrong gif pointer "
+                "%d:%d",gif,gif_pos );
+        return NULL;
+    }
+    snap = gif_get_snapshoot (c, gifFile, gif, gif_pos);
+    context_put_gif (gifFile);
+    return snap;
+}
+
+GifSnapshoot *
+get_cached_snapshoot (const PContext c, int gif, int gif_pos, int *found_pos)
+{
+    GifSnapshoot *snap;
+
+    snap = cache_lookup_nearest (c->cache, gif, gif_pos, found_pos);
+    if (snap != NULL) {
+        g_mutex_lock (&c->lock);
+        ++c->stats.snapshoots;
+        g_mutex_unlock (&c->lock);
+    }
+    return snap;
+}
+
+/**
+ *  Canvas of get_snapshoot_range pass.
+ */
+typedef struct RangeCanvas {
+    byte *pixels;
+    int width, height, stride;
+    byte *saved;                //Rectangle restored after disposal 3
+    GifPalette *global;         //Palette of images without own colormap
+    GifPalette *local;          //Last palette built for own colormap
+    const ColorMapObject *local_colormap;
+    guint32 background;         //Color of uncovered pixels
+} RangeCanvas;
+
+#define range_row(canvas, y) \
+    ((guint32 *) ((canvas)->pixels + (size_t) (y) * (canvas)->stride))
+
+static const GifPalette *
+range_palette (RangeCanvas *canvas, const SavedImage *image)
+{
+    if (image->ImageDesc.ColorMap == NULL) {
+        return canvas->global;
+    }
+    //Neighbour images often share colormap
+    if (image->ImageDesc.ColorMap != canvas->local_colormap) {
+        palette_unref (canvas->local);
+        canvas->local = palette_new (image->ImageDesc.ColorMap);
+        canvas->local_colormap = image->ImageDesc.ColorMap;
+    }
+    return canvas->local;
+}
+
+static void
+range_fill (RangeCanvas *canvas, int x0, int y0, int x1, int y1)
+{
+    guint32 *row;
+    int x, y;
+
+    for (y = y0; y < y1; ++y) {
+        row = range_row (canvas, y);
+        for (x = x0; x < x1; ++x) {
+            row[x] = canvas->background;
+        }
+    }
+}
+
+/**
+ *  Copies rectangle between canvas and saved area.
+ */
+static void
+range_save (RangeCanvas *canvas, int x0, int y0, int x1, int y1,
+        gboolean restore)
+{
+    size_t row_size = (size_t) (x1 - x0) * BITSPERPIXEL;
+    byte *saved = canvas->saved;
+    int y;
+
+    for (y = y0; y < y1; ++y, saved += row_size) {
+        if (restore) {
+            memcpy (range_row (canvas, y) + x0, saved, row_size);
+        } else {
+            memcpy (saved, range_row (canvas, y) + x0, row_size);
+        }
+    }
+}
+
+static void
+range_draw (RangeCanvas *canvas, const SavedImage *image, 
+        const guint32 *lut, int transparent, int x0, int y0, int x1, int y1)
+{
+    const GifImageDesc *desc = &image->ImageDesc;
+    const byte *src;
+    guint32 *dst;
+    int x, y;
+
+    for (y = y0; y < y1; ++y) {
+        src = image->RasterBits + 
+                (size_t) (y - desc->Top) * desc->Width + (x0 - desc->Left);
+        dst = range_row (canvas, y) + x0;
+        if (transparent < 0) {
+            expand_row (src, dst, x1 - x0, lut);
+            continue;
+        }
+        for (x = 0; x < x1 - x0; ++x) {
+            if (src[x] != transparent) {
+                dst[x] = lut[src[x]];
+            }
+        }
+    }
+}
+
+static int
+gif_get_range (const PContext c, GifFileType *gifFile, int begin, int end,
+        int flags, unsigned char *buffer, int stride,
+        GifRangeFunc callback, gpointer user_data)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+    GraphicsControlBlock gcb;
+    SavedImage *image;
+    const GifPalette *palette;
+    RangeCanvas canvas;
+    gboolean composite = flags & GIF_RANGE_COMPOSITE, visible;
+    int i, count = 0, x0, y0, x1, y1, px0 = 0, py0 = 0, px1 = 0, py1 = 0;
+    guint32 background;
+
+    g_mutex_lock (&extra->lock);
+    if (gif_slurp_check (c, gifFile, NULL) < 0) {
+        g_mutex_unlock (&extra->lock);
+        return -1;
+    }
+    if (extra->palette == NULL) {
+        extra->palette = palette_new (gifFile->SColorMap);
+    }
+    memset (&canvas, 0, sizeof (RangeCanvas));
+    canvas.global = palette_ref (extra->palette);
+    g_mutex_unlock (&extra->lock);
+    //Images are not changed after decoding, lock is not needed further
+
+    begin = MAX (begin, 0);
+    end = MIN (end, gifFile->ImageCount);
+    if (begin >= end) {
+        palette_unref (canvas.global);
+        return 0;
+    }
+    TRACE_BEGIN (stamp);
+
+    canvas.width = gifFile->SWidth;
+    canvas.height = gifFile->SHeight;
+    canvas.pixels = buffer;
+    canvas.stride = stride;
+    if (buffer == NULL) {
+        canvas.stride = canvas.width * BITSPERPIXEL;
+        canvas.pixels = malloc ((size_t) canvas.stride * canvas.height);
+        if (canvas.pixels == NULL) {
+            put_error (1, "Can not allocate mamory for images range.");
+        }
+    }
+    canvas.background = 
+            canvas.global->colors[gifFile->SBackGroundColor & 0xff];
+
+    //Composition starts from the first image
+    for (i = composite ? 0 : begin; i < end; ++i) {
+        image = gifFile->SavedImages + i;
+        palette = range_palette (&canvas, image);
+        visible = clip_image_rect (&image->ImageDesc, 
+                canvas.width, canvas.height, &x0, &y0, &x1, &y1);
+
+        if (!composite) {
+            //Only rectangle of previous image is cleared
+            background = palette->colors[gifFile->SBackGroundColor & 0xff];
+            if (i == begin || background != canvas.background) {
+                canvas.background = background;
+                range_fill (&canvas, 0, 0, canvas.width, canvas.height);
+            } else {
+                range_fill (&canvas, px0, py0, px1, py1);
+            }
+            if (visible) {
+                range_draw (&canvas, image, palette->colors, -1, 
+                        x0, y0, x1, y1);
+            }
+            px0 = x0;
+            py0 = y0;
+            px1 = visible ? x1 : x0;
+            py1 = y1;
+        } else {
+            if (DGifSavedExtensionToGCB (gifFile, i, &gcb) == GIF_ERROR) {
+                gcb.DisposalMode = DISPOSAL_UNSPECIFIED;
+                gcb.TransparentColor = NO_TRANSPARENT_COLOR;
+            }
+            if (i == 0) {
+                range_fill (&canvas, 0, 0, canvas.width, canvas.height);
+            }
+            if (visible && gcb.DisposalMode == DISPOSE_PREVIOUS && 
+                    i + 1 < end) {
+                if (canvas.saved == NULL) {
+                    canvas.saved = malloc ((size_t) canvas.width * 
+                            canvas.height * BITSPERPIXEL);
+                    if (canvas.saved == NULL) {
+                        put_error (1, "Can not allocate mamory "
+                                "for images range.");
+                    }
+                }
+                range_save (&canvas, x0, y0, x1, y1, FALSE);
+            }
+            if (visible) {
+                range_draw (&canvas, image, palette->colors, 
+                        gcb.TransparentColor, x0, y0, x1, y1);
+            }
+        }
+
+        if (i >= begin) {
+            ++count;
+            if (callback != NULL && !callback (i, canvas.pixels, 
+                        canvas.width, canvas.height, canvas.stride, 
+                        user_data)) {
+                break;
+            }
+        }
+
+        //Last image stays in buffer as it is shown
+        if (composite && visible && i + 1 < end) {
+            if (gcb.DisposalMode == DISPOSE_BACKGROUND) {
+                range_fill (&canvas, x0, y0, x1, y1);
+            } else if (gcb.DisposalMode == DISPOSE_PREVIOUS) {
+                range_save (&canvas, x0, y0, x1, y1, TRUE);
+            }
+        }
+    }
+
+    if (buffer == NULL) {
+        free (canvas.pixels);
+    }
+    free (canvas.saved);
+    palette_unref (canvas.local);
+    palette_unref (canvas.global);
+    TRACE_END (stamp, "get_snapshoot_range");
+    return count;
+}
+
+int
+get_snapshoot_range (const PContext c, int gif, int begin, int end,
+        int flags, unsigned char *buffer, int stride,
+        GifRangeFunc callback, gpointer user_data)
+{
+    GifFileType *gifFile;
+    int result;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        put_warning ("Wrong gif pointer %d", gif);
+        return -1;
+    }
+    //Gif stays while range is passed, even if file is reloaded
+    result = gif_get_range (c, gifFile, begin, end, flags, buffer, stride,
+            callback, user_data);
+    context_put_gif (gifFile);
+    return result;
+}
+
+typedef struct ScheduledTask {
+    GTask *task;
+    GTaskThreadFunc func;
+} ScheduledTask;
+
+static void
+scheduled_task_run (gpointer data, GCancellable *cancellable)
+{
+    ScheduledTask *scheduled = (ScheduledTask *) data;
+    GTask *task = scheduled->task;
+
+    scheduled->func (task, g_task_get_source_object (task),
+            g_task_get_task_data (task), cancellable);
+    g_object_unref (task);
+    g_free (scheduled);
+}
+
+/**
+ *  Runs thread function of task on shared workers instead of thread
+ *  pool of GIO, so task competes with others by priority.
+ */
+static void
+context_run_task (PContext c, GTask *task, SchedulerPriority priority,
+        GTaskThreadFunc func)
+{
+    ScheduledTask *scheduled = g_new (ScheduledTask, 1);
+
+    scheduled->task = g_object_ref (task);
+    scheduled->func = func;
+    scheduler_push (c->scheduler, priority, scheduled_task_run, scheduled,
+            g_task_get_cancellable (task));
+}
+
+/**
+ *  Asynchronous snapshoot request. Runs in worker thread.
+ */
+typedef struct SnapshootRequest {
+    PContext c;
+    int gif;
+    int gif_pos;            //Resolved position after run
+    float gif_fpos;
+    gboolean fractional;    //Take position from gif_fpos
+} SnapshootRequest;
+
+static GifSnapshoot *
+snapshoot_request_run (SnapshootRequest *request, 
+        GCancellable *cancellable, GError **error)
+{
+    GifSnapshoot *snap;
+    int count, pos;
+
+    //Decoding itself can not be interrupted, so check before and after
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+        return NULL;
+    }
+    count = get_gif_image_count (request->c, request->gif);
+    if (count <= 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "Can not decode gif %d", request->gif);
+        return NULL;
+    }
+    if (request->fractional) {
+        pos = (int) (count * request->gif_fpos);
+    } else if (request->gif_pos < 0) {
+        pos = count + request->gif_pos;
+    } else {
+        pos = request->gif_pos;
+    }
+    pos = CLAMP (pos, 0, count - 1);
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+        return NULL;
+    }
+    snap = get_snapshoot_pos (request->c, request->gif, pos);
+    if (snap == NULL) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "Can not get image %d:%d", request->gif, pos);
+        return NULL;
+    }
+    request->gif_pos = pos;
+    return snap;
+}
+
+static void
+snapshoot_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable)
+{
+    SnapshootRequest *request = (SnapshootRequest *) task_data;
+    PContext c = request->c;
+    GifSnapshoot *snap;
+    GError *error = NULL;
+
+    snap = snapshoot_request_run (request, cancellable, &error);
+    if (snap != NULL) {
+        g_task_return_pointer (task, snap, 
+                (GDestroyNotify) free_snapshoot);
+    } else {
+        g_task_return_error (task, error);
+    }
+    context_task_end (c);
+}
+
+/**
+ *  Stream of progressive gif is read by its own thread, so request
+ *  waiting for it can not run in main loop.
+ */
+static gboolean
+context_gif_progressive (PContext c, int gif)
+{
+    GifFileType *gifFile;
+    gboolean result;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return FALSE;
+    }
+    result = get_gif_extra (gifFile)->progressive;
+    context_put_gif (gifFile);
+    return result;
+}
+
+/**
+ *  Decodes gif of request in main loop slice by slice, then makes
+ *  snapshoot in the last slice, as conversion takes much less.
+ */
+static gboolean
+on_snapshoot_idle (gpointer data)
+{
+    GTask *task = G_TASK (data);
+    SnapshootRequest *request = (SnapshootRequest *) g_task_get_task_data (task);
+    PContext c = request->c;
+
+    if (!g_task_return_error_if_cancelled (task)) {
+        if (decode_gif_slice (c, request->gif, GIF_IDLE_SLICE_TIME) == 0) {
+            return TRUE;
+        }
+        g_hash_table_remove (c->idle_tasks, task);
+        snapshoot_thread (task, NULL, request, 
+                g_task_get_cancellable (task));
+        return FALSE;
+    }
+    g_hash_table_remove (c->idle_tasks, task);
+    context_task_end (c);
+    return FALSE;
+}
+
+static void
+snapshoot_request_start (SnapshootRequest *request,
+        GCancellable *cancellable,
+        GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    GTask *task;
+    guint source;
+
+    context_task_begin (request->c);
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_task_data (task, request, g_free);
+    if (request->c->idle_decode && 
+            !context_gif_progressive (request->c, request->gif)) {
+        source = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, 
+                on_snapshoot_idle, g_object_ref (task), g_object_unref);
+        g_hash_table_insert (request->c->idle_tasks, task, 
+                GUINT_TO_POINTER (source));
+    } else {
+        context_run_task (request->c, task, SCHEDULER_VISIBLE, 
+                snapshoot_thread);
+    }
+    g_object_unref (task);
+}
+
+void
+get_snapshoot_async (PContext c, int gif, float gif_pos,
+        GCancellable *cancellable,
+        GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    SnapshootRequest *request = g_new0 (SnapshootRequest, 1);
+
+    request->c = c;
+    request->gif = gif;
+    request->gif_fpos = CLAMP (gif_pos, 0, 1);
+    request->fractional = TRUE;
+    snapshoot_request_start (request, cancellable, callback, user_data);
+}
+
+void
+get_snapshoot_pos_async (PContext c, int gif, int gif_pos,
+        GCancellable *cancellable,
+        GAsyncReadyCallback callback,
+        gpointer user_data)
+{
+    SnapshootRequest *request = g_new0 (SnapshootRequest, 1);
+
+    request->c = c;
+    request->gif = gif;
+    request->gif_pos = gif_pos;
+    snapshoot_request_start (request, cancellable, callback, user_data);
+}
 
-    colormap = (image->ImageDesc.ColorMap != NULL) ?
-            image->ImageDesc.ColorMap :
-            gifFile->SColorMap;
+static void
+prefetch_thread (gpointer data, GCancellable *cancellable)
+{
+    SnapshootRequest *request = (SnapshootRequest *) data;
+    PContext c = request->c;
+    GifSnapshoot *snap;
 
-    if (colormap_to_GRB24 (snap, 
-        colormap->Colors, colormap->ColorCount,
-        gifFile->SBackGroundColor,
-        gifFile->SWidth, gifFile->SHeight,
-        image->ImageDesc.Left,
-        image->ImageDesc.Top) != GIF_OK)
-    {
-        free (snap);
-        return NULL;
+    //Snapshoot stays in cache
+    snap = snapshoot_request_run (request, cancellable, NULL);
+    if (snap != NULL) {
+        free_snapshoot (snap);
     }
-    return snap;
+    g_free (request);
+    context_task_end (c);
+}
+
+void
+prefetch_snapshoot (PContext c, int gif, int gif_pos,
+        GCancellable *cancellable)
+{
+    SnapshootRequest *request;
+
+    //Main loop is kept for requests of user
+    if (c->idle_decode) {
+        return;
+    }
+    request = g_new0 (SnapshootRequest, 1);
+    request->c = c;
+    request->gif = gif;
+    request->gif_pos = gif_pos;
+    context_task_begin (c);
+    scheduler_push (c->scheduler, SCHEDULER_NEIGHBOR, prefetch_thread,
+            request, cancellable);
+}
+
+GifSnapshoot *
+get_snapshoot_finish (PContext c, GAsyncResult *result,
+        int *gif, int *gif_pos, GError **error)
+{
+    SnapshootRequest *request;
+
+    request = (SnapshootRequest *) g_task_get_task_data (G_TASK (result));
+    if (gif != NULL) {
+        *gif = request->gif;
+    }
+    if (gif_pos != NULL) {
+        *gif_pos = request->gif_pos;
+    }
+    return (GifSnapshoot *) g_task_propagate_pointer (G_TASK (result), error);
 }
 
 size_t
 get_gif_count (const PContext c) 
 {
-    return (size_t) c->gifs->len;
+    size_t count;
+
+    g_mutex_lock (&c->lock);
+    count = (size_t) c->gifs->len;
+    g_mutex_unlock (&c->lock);
+    return count;
 }
 
 int
 get_gif_image_count (const PContext c, int gif) 
 {
     GifFileType *gifFile;
+    GifExtra *extra;
+    int result;
 
-    if (!gifptr_correct(gif,c)) {
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
         return -1;
     }
-
-    gifFile = ((GifFileType *) c->gifs->pdata[gif]);
+    extra = get_gif_extra (gifFile);
     
-    if (gif_slurp_check(gifFile) < 0) {
+    g_mutex_lock (&extra->lock);
+    //Progressive gif has images, which arrived so far
+    if (gif_image_check (c, gifFile, 0) < 0) {
+        result = -1;
+    } else {
+        result = gifFile->ImageCount;
+    }
+    g_mutex_unlock (&extra->lock);
+    context_put_gif (gifFile);
+
+    return result;
+}
+
+int
+decode_gif_slice (const PContext c, int gif, gint64 duration)
+{
+    GifFileType *gifFile;
+    GifExtra *extra;
+    int result;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return -1;
+    }
+    extra = get_gif_extra (gifFile);
+
+    g_mutex_lock (&extra->lock);
+    result = gif_step_check (c, gifFile, g_get_monotonic_time () + duration);
+    g_mutex_unlock (&extra->lock);
+    context_put_gif (gifFile);
+    return result;
+}
+
+void
+set_context_idle_decode (PContext c, gboolean idle_decode)
+{
+    c->idle_decode = idle_decode;
+}
+
+int
+peek_gif_image_count (const PContext c, int gif) 
+{
+    GifFileType *gifFile;
+    int result = -1;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
         return -1;
     }
+    if (g_atomic_int_get (&get_gif_extra (gifFile)->decoded)) {
+        result = gifFile->ImageCount;
+    } else if (get_gif_extra (gifFile)->progressive) {
+        //Images of progressive gif are counted as they arrive
+        result = g_atomic_int_get (&gifFile->ImageCount);
+        result = result > 0 ? result : -1;
+    }
+    context_put_gif (gifFile);
+    return result;
+}
+
+int
+count_gif_images (const PContext c, int gif) 
+{
+    GifFileType *gifFile;
+    int result;
+
+    result = peek_gif_image_count (c, gif);
+    if (result >= 0) {
+        return result;
+    }
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return -1;
+    }
+    result = gif_scan_images (get_gif_extra (gifFile));
+    context_put_gif (gifFile);
+    return result > 0 ? result : get_gif_image_count (c, gif);
+}
+
+static void
+count_images_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable)
+{
+    PContext c = (PContext) task_data;
+    GArray *counts;
+    int gifs = get_gif_count (c), i, count;
+
+    counts = g_array_sized_new (FALSE, FALSE, sizeof (int), gifs);
+    for (i = 0; i < gifs; ++i) {
+        if (g_task_return_error_if_cancelled (task)) {
+            g_array_unref (counts);
+            context_task_end (c);
+            return;
+        }
+        count = count_gif_images (c, i);
+        g_array_append_val (counts, count);
+    }
+    g_task_return_pointer (task, counts, (GDestroyNotify) g_array_unref);
+    context_task_end (c);
+}
+
+void
+count_all_gif_images_async (PContext c, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer user_data)
+{
+    GTask *task;
+
+    context_task_begin (c);
+    task = g_task_new (NULL, cancellable, callback, user_data);
+    g_task_set_task_data (task, c, NULL);
+    //Gifs, which can not be scanned, are decoded
+    context_run_task (c, task, SCHEDULER_INDEX, count_images_thread);
+    g_object_unref (task);
+}
+
+GArray *
+count_all_gif_images_finish (PContext c, GAsyncResult *result, 
+        GError **error)
+{
+    return (GArray *) g_task_propagate_pointer (G_TASK (result), error);
+}
+
+int
+get_gif_damage (const PContext c, int gif, int *begin, int *end)
+{
+    GifFileType *gifFile;
+    GifExtra *extra;
+    int result;
 
-    return gifFile->ImageCount;
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return D_GIF_ERR_READ_FAILED;
+    }
+    extra = get_gif_extra (gifFile);
+    //Gif is not locked, as it may be decoded meanwhile
+    result = g_atomic_int_get (&extra->damage_error);
+    if (result != 0 && begin != NULL) {
+        *begin = extra->damage_begin;
+    }
+    if (result != 0 && end != NULL) {
+        *end = extra->damage_end;
+    }
+    context_put_gif (gifFile);
+    return result;
 }
 
 void *
@@ -337,28 +2059,523 @@ set_context_interface_data (PContext c, void *data)
     c->interface_data = data;
 }
 
+void
+get_context_stats (const PContext c, GifContextStats *stats)
+{
+    SnapshootCacheStats cache_stats;
+    FramePoolStats pool_stats;
+
+    g_mutex_lock (&c->lock);
+    *stats = c->stats;
+    g_mutex_unlock (&c->lock);
+
+    cache_get_stats (c->cache, &cache_stats);
+    stats->cache_hits = cache_stats.hot_hits;
+    stats->cold_hits = cache_stats.cold_hits;
+    stats->evictions = cache_stats.evictions;
+    stats->cache_bytes = cache_stats.hot_bytes;
+    stats->shared_bytes = cache_stats.shared_bytes;
+    stats->packed_cache_bytes = cache_stats.cold_bytes;
+    stats->spill_hits = cache_stats.spill_hits;
+    frame_pool_get_stats (c->pool, &pool_stats);
+    stats->shared = pool_stats.shared;
+}
+
+static size_t
+colormap_memory (const ColorMapObject *colormap)
+{
+    if (colormap == NULL) {
+        return 0;
+    }
+    return sizeof (ColorMapObject) + 
+            colormap->ColorCount * sizeof (GifColorType);
+}
+
+static size_t
+extensions_memory (const ExtensionBlock *blocks, int count)
+{
+    size_t bytes = count * sizeof (ExtensionBlock);
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        bytes += blocks[i].ByteCount;
+    }
+    return bytes;
+}
+
+static void
+gif_memory_usage (GifFileType *gifFile, GifMemoryUsage *usage)
+{
+    GifExtra *extra = get_gif_extra (gifFile);
+    const SavedImage *image;
+    int i;
+
+    usage->structures = sizeof (GifFileType) + sizeof (GifExtra) +
+            colormap_memory (gifFile->SColorMap);
+    if (extra->filename != NULL) {
+        usage->structures += strlen (extra->filename) + 1;
+    }
+    if (extra->name != NULL) {
+        usage->structures += strlen (extra->name) + 1;
+    }
+    if (g_atomic_pointer_get (&extra->palette) != NULL) {
+        usage->palette = sizeof (GifPalette);
+    }
+    //Images are changed only while gif is being decoded
+    if (!g_atomic_int_get (&extra->decoded)) {
+        return;
+    }
+    usage->structures += gifFile->ImageCount * sizeof (SavedImage) +
+            extensions_memory (gifFile->ExtensionBlocks,
+                    gifFile->ExtensionBlockCount);
+    for (i = 0; i < gifFile->ImageCount; ++i) {
+        image = gifFile->SavedImages + i;
+        usage->rasters += (size_t) image->ImageDesc.Width * 
+                image->ImageDesc.Height;
+        usage->structures += colormap_memory (image->ImageDesc.ColorMap) +
+                extensions_memory (image->ExtensionBlocks,
+                        image->ExtensionBlockCount);
+    }
+}
+
+void
+get_context_memory_stats (const PContext c, GifMemoryStats *stats)
+{
+    GifMemoryUsage *usage;
+    GifFileType *gifFile;
+    size_t *hot, *cold;
+    int i;
+    TRACE_BEGIN (stamp);
+
+    memset (stats, 0, sizeof (GifMemoryStats));
+    stats->gif_count = get_gif_count (c);
+    stats->gifs = g_new0 (GifMemoryUsage, MAX (stats->gif_count, 1));
+    hot = g_new0 (size_t, MAX (stats->gif_count, 1));
+    cold = g_new0 (size_t, MAX (stats->gif_count, 1));
+
+    stats->context = sizeof (Context) + 
+            cache_get_gif_usage (c->cache, stats->gif_count, hot, cold);
+    g_mutex_lock (&c->lock);
+    stats->context += c->gifs->len * sizeof (gpointer);
+    g_mutex_unlock (&c->lock);
+
+    for (i = 0; i < stats->gif_count; ++i) {
+        usage = stats->gifs + i;
+        gifFile = context_get_gif (c, i);
+        if (gifFile != NULL) {
+            gif_memory_usage (gifFile, usage);
+            context_put_gif (gifFile);
+        }
+        usage->cache = hot[i];
+        usage->packed_cache = cold[i];
+
+        stats->total.rasters += usage->rasters;
+        stats->total.structures += usage->structures;
+        stats->total.palette += usage->palette;
+        stats->total.cache += usage->cache;
+        stats->total.packed_cache += usage->packed_cache;
+    }
+    stats->bytes = stats->context + stats->total.rasters + 
+            stats->total.structures + stats->total.palette + 
+            stats->total.cache + stats->total.packed_cache;
+
+    g_free (hot);
+    g_free (cold);
+    TRACE_END (stamp, "get_context_memory_stats");
+}
+
+void
+clear_context_memory_stats (GifMemoryStats *stats)
+{
+    g_free (stats->gifs);
+    stats->gifs = NULL;
+    stats->gif_count = 0;
+}
+
+static void
+print_memory_usage (FILE *file, const char *name, const GifMemoryUsage *usage)
+{
+#define KIB(bytes) ((bytes) / 1024.0)
+    fprintf (file, "%s: rasters %.1f KiB, structures %.1f KiB, "
+            "palette %.1f KiB, cache %.1f KiB, packed cache %.1f KiB\n",
+            name, KIB (usage->rasters), KIB (usage->structures),
+            KIB (usage->palette), KIB (usage->cache), 
+            KIB (usage->packed_cache));
+#undef KIB
+}
+
+void
+print_context_memory_stats (const PContext c, FILE *file)
+{
+    GifMemoryStats stats;
+    const char *filename;
+    int i, error, begin, end;
+
+    get_context_memory_stats (c, &stats);
+    for (i = 0; i < stats.gif_count; ++i) {
+        filename = get_gif_name (c, i);
+        print_memory_usage (file, filename != NULL ? filename : "(handle)",
+                stats.gifs + i);
+        error = get_gif_damage (c, i, &begin, &end);
+        if (error != 0) {
+            fprintf (file, "  damaged: images %d-%d are lost. %s\n",
+                    begin, end - 1, GifErrorString (error));
+        }
+    }
+    print_memory_usage (file, "all gifs", &stats.total);
+    fprintf (file, "context: %.1f KiB\ntotal: %.1f KiB\n", 
+            stats.context / 1024.0, stats.bytes / 1024.0);
+    clear_context_memory_stats (&stats);
+}
+
+void
+set_context_snapshoot_format (PContext c, GifSnapshootFormat format)
+{
+    int gif;
+
+    if (c->format != format) {
+        c->format = format;
+        cache_clear (c->cache);
+        for (gif = 0; gif < get_gif_count (c); ++gif) {
+            context_update_spill_id (c, gif);
+        }
+    }
+}
+
+int
+set_context_spill (PContext c, const char *filename, size_t size)
+{
+    int gif;
+
+    if (c->spill != NULL) {
+        put_warning ("Spill store is already set");
+        return -1;
+    }
+    c->spill = spill_open (filename, size);
+    if (c->spill == NULL) {
+        return -1;
+    }
+    cache_set_spill (c->cache, c->spill);
+    for (gif = 0; gif < get_gif_count (c); ++gif) {
+        context_update_spill_id (c, gif);
+    }
+    return 0;
+}
+
+void
+set_context_cache_size (PContext c, size_t hot_size, size_t packed_size)
+{
+    cache_set_size (c->cache, hot_size, packed_size);
+}
+
+GifSnapshoot *
+snapshoot_ref (GifSnapshoot *sh)
+{
+    g_atomic_int_inc (&sh->ref_count);
+    return sh;
+}
+
 void
 free_snapshoot (GifSnapshoot *sh) 
 {
+    if (sh->pooled != NULL) {
+        //Pool must not give out snapshoot, which is being freed
+        if (!frame_pool_release (sh)) {
+            return;
+        }
+    } else if (!g_atomic_int_dec_and_test (&sh->ref_count)) {
+        return;
+    }
     free (sh->pixmap);
+    free (sh->indices);
+    palette_unref (sh->palette);
     free (sh);
 }
 
 const char *
 get_gif_filename (const PContext c, int gif)
 {
-    const GifFileType *gifFile;
-    const GifExtra *extra_data;
+    GifFileType *gifFile;
+    const char *filename;
 
-    if (!gifptr_correct(gif,c)) {
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
         return NULL;
     }
+    //Filename is passed to reloaded gif, so it stays
+    filename = get_gif_extra (gifFile)->filename;
+    context_put_gif (gifFile);
+    return filename;
+}
 
-    gifFile = ((GifFileType *) c->gifs->pdata[gif]);
+const char *
+get_gif_name (const PContext c, int gif)
+{
+    GifFileType *gifFile;
+    GifExtra *extra;
+    const char *name;
 
-    extra_data = (GifExtra *)gifFile->UserData;
-    if (extra_data == NULL) {
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
         return NULL;
     }
-    return extra_data->filename;
+    extra = get_gif_extra (gifFile);
+    name = extra->filename != NULL ? extra->filename : extra->name;
+    context_put_gif (gifFile);
+    return name;
+}
+
+int
+get_gif_screen_size (const PContext c, int gif, int *width, int *height)
+{
+    GifFileType *gifFile;
+
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return -1;
+    }
+    //Screen descriptor is read on open, no decoding is needed
+    *width = gifFile->SWidth;
+    *height = gifFile->SHeight;
+    context_put_gif (gifFile);
+    return 0;
+}
+
+int
+get_gif_image_delay (const PContext c, int gif, int gif_pos)
+{
+    GifFileType *gifFile;
+    GraphicsControlBlock gcb;
+    int result = 0;
+
+    if (get_gif_image_count (c, gif) <= gif_pos || gif_pos < 0) {
+        return -1;
+    }
+    gifFile = context_get_gif (c, gif);
+    if (gifFile == NULL) {
+        return -1;
+    }
+    //Reloaded gif may be not decoded yet, then GCB is not found.
+    //Images of progressive gif are moved, while they arrive.
+    g_mutex_lock (&get_gif_extra (gifFile)->lock);
+    if (DGifSavedExtensionToGCB (gifFile, gif_pos, &gcb) != GIF_ERROR) {
+        result = gcb.DelayTime;
+    }
+    g_mutex_unlock (&get_gif_extra (gifFile)->lock);
+    context_put_gif (gifFile);
+    return result;
+}
+
+/**
+ *  Puts reloaded gif in place of old one. Old gif is freed, when its
+ *  users release it. Cached snapshoots of old gif are dropped.
+ */
+static void
+context_replace_gif (PContext c, int gif, GifFileType *gifFile)
+{
+    GifFileType *old;
+    GifExtra *extra;
+
+    g_mutex_lock (&c->lock);
+    old = (GifFileType *) c->gifs->pdata[gif];
+    extra = get_gif_extra (old);
+    get_gif_extra (gifFile)->filename = extra->filename;
+    c->gifs->pdata[gif] = gifFile;
+    ++c->stats.reloads;
+    g_mutex_unlock (&c->lock);
+
+    //Conversions of old gif in progress will not fill the cache
+    g_mutex_lock (&extra->lock);
+    g_atomic_int_set (&extra->replaced, TRUE);
+    if (g_atomic_int_get (&extra->decoded)) {
+        g_mutex_lock (&c->lock);
+        c->stats.decoded_bytes -= gif_raster_bytes (old);
+        g_mutex_unlock (&c->lock);
+    }
+    cache_remove_gif (c->cache, gif);
+    frame_pool_forget (c->pool, old);
+    g_mutex_unlock (&extra->lock);
+
+    context_update_spill_id (c, gif);
+    context_put_gif (old);
+}
+
+static void
+reload_request_free (ReloadRequest *request)
+{
+    g_free (request->filename);
+    g_free (request);
+}
+
+/**
+ *  Reads and decodes changed file. Runs in worker thread.
+ */
+static void
+reload_thread (GTask *task, gpointer source_object,
+        gpointer task_data, GCancellable *cancellable)
+{
+    ReloadRequest *request = (ReloadRequest *) task_data;
+    PContext c = request->c;
+    GifFileType *gifFile;
+    GifExtra *extra;
+    int error, result;
+
+    //Callback ends task in main loop
+    if (g_task_return_error_if_cancelled (task)) {
+        return;
+    }
+    gifFile = DGifOpenFileName (request->filename, &error);
+    if (gifFile == NULL) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                "%s", GifErrorString (error));
+    } else {
+        gifFile->UserData = extra = gif_extra_new (NULL);
+        extra->file_id = gif_file_id (request->filename);
+        g_mutex_lock (&extra->lock);
+        result = gif_slurp_check (c, gifFile, NULL);
+        g_mutex_unlock (&extra->lock);
+        if (result < 0) {
+            context_put_gif (gifFile);
+            g_task_return_new_error (task, G_IO_ERROR, 
+                    G_IO_ERROR_INVALID_DATA, "Can not decode gif");
+        } else {
+            g_task_return_pointer (task, gifFile, 
+                    (GDestroyNotify) context_put_gif);
+        }
+    }
+}
+
+static void
+on_gif_reloaded (GObject *source_object, GAsyncResult *result,
+        gpointer user_data)
+{
+    PContext c = (PContext) user_data;
+    ReloadRequest *request = (ReloadRequest *) 
+            g_task_get_task_data (G_TASK (result));
+    GifFileType *gifFile;
+    GError *error = NULL;
+
+    gifFile = (GifFileType *) g_task_propagate_pointer (G_TASK (result), 
+            &error);
+    if (gifFile != NULL) {
+        context_replace_gif (c, request->gif, gifFile);
+        if (c->reload_func != NULL) {
+            c->reload_func (c, request->gif, c->reload_data);
+        }
+    } else if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        //Next change of file will try again
+        put_warning ("Can not reload '%s'. %s", 
+                request->filename, error->message);
+    }
+    g_clear_error (&error);
+    --c->reloads;
+    context_task_end (c);
+}
+
+static gboolean
+on_reload_timeout (gpointer data)
+{
+    GifWatch *watch = (GifWatch *) data;
+    PContext c = watch->c;
+    ReloadRequest *request;
+    GTask *task;
+
+    watch->timer = 0;
+    request = g_new0 (ReloadRequest, 1);
+    request->c = c;
+    request->gif = watch->gif;
+    request->filename = g_strdup (get_gif_filename (c, watch->gif));
+
+    context_task_begin (c);
+    ++c->reloads;
+    task = g_task_new (NULL, c->reload_cancellable, on_gif_reloaded, c);
+    g_task_set_task_data (task, request, 
+            (GDestroyNotify) reload_request_free);
+    //Reloading must not delay images user looks at
+    context_run_task (c, task, SCHEDULER_INDEX, reload_thread);
+    g_object_unref (task);
+    return FALSE;
+}
+
+static void
+on_gif_file_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
+        GFileMonitorEvent event_type, gpointer data)
+{
+    GifWatch *watch = (GifWatch *) data;
+
+    if (event_type != G_FILE_MONITOR_EVENT_CHANGED &&
+            event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+            event_type != G_FILE_MONITOR_EVENT_CREATED) {
+        return;
+    }
+    //File may be still written, reload is put off until it is quiet
+    if (watch->timer != 0) {
+        g_source_remove (watch->timer);
+    }
+    watch->timer = g_timeout_add (GIF_RELOAD_DELAY, on_reload_timeout, watch);
+}
+
+static void
+gif_watch_free (GifWatch *watch)
+{
+    if (watch->timer != 0) {
+        g_source_remove (watch->timer);
+    }
+    g_signal_handlers_disconnect_by_func (watch->monitor, 
+            on_gif_file_changed, watch);
+    g_file_monitor_cancel (watch->monitor);
+    g_object_unref (watch->monitor);
+    g_free (watch);
+}
+
+static void
+context_watch_gif (PContext c, int gif)
+{
+    const char *filename = get_gif_filename (c, gif);
+    GifWatch *watch;
+    GFile *file;
+    GError *error = NULL;
+
+    //Gif read from handle has no file to watch
+    if (filename == NULL) {
+        return;
+    }
+    watch = g_new0 (GifWatch, 1);
+    watch->c = c;
+    watch->gif = gif;
+    file = g_file_new_for_path (filename);
+    watch->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE,
+            NULL, &error);
+    g_object_unref (file);
+    if (watch->monitor == NULL) {
+        put_warning ("Can not watch '%s'. %s", filename, error->message);
+        g_error_free (error);
+        g_free (watch);
+        return;
+    }
+    g_signal_connect (watch->monitor, "changed",
+            G_CALLBACK (on_gif_file_changed), watch);
+    g_ptr_array_add (c->watches, watch);
+}
+
+void
+watch_context_files (PContext c)
+{
+    int gif;
+
+    if (c->watches != NULL) {
+        return;
+    }
+    c->watches = g_ptr_array_new_with_free_func (
+            (GDestroyNotify) gif_watch_free);
+    for (gif = 0; gif < get_gif_count (c); ++gif) {
+        context_watch_gif (c, gif);
+    }
+}
+
+void
+set_context_reload_func (PContext c, GifReloadFunc func, gpointer data)
+{
+    c->reload_func = func;
+    c->reload_data = data;
 }
@@ -23,6 +23,7 @@
 #include <gif_lib.h>
 #include <stdio.h>
 #include <glib.h>
+#include <gio/gio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -42,18 +43,150 @@
  *  Call read_gif to read gif. Pass the filename and context.
  *  Call get_snapshoot to get snapshoot of gif with gif pointer
  *  on 0 <= gif_pos < 1 position.
+ *  Call get_snapshoot_async or get_snapshoot_pos_async to decode
+ *  and convert in worker thread. Callback is called in main loop,
+ *  there call get_snapshoot_finish to get the result and resolved
+ *  position. Negative position of get_snapshoot_pos_async counts
+ *  from the end of gif, -1 is the last image.
+ *  Call prefetch_snapshoot to put snapshoot, which will likely be
+ *  asked next, to cache. It runs after visible requests.
+ *  Call peek_gif_image_count to get images count without decoding,
+ *  it returns -1 while gif is not decoded. Call count_gif_images to
+ *  count images by scanning file blocks without decoding.
+ *  count_all_gif_images_async counts images of every gif in background,
+ *  its result is array of int counts.
+ *  Call decode_gif_slice to decode gif in main loop without threads.
+ *  It decodes for about duration microseconds and returns 0, if gif
+ *  is not decoded yet, next call goes on from there. It returns 1,
+ *  when gif is decoded, or -1 on error. After
+ *  set_context_idle_decode async requests decode gifs this way in
+ *  idle callbacks of main loop instead of worker threads. Then
+ *  free_context must be called in main loop thread, it cancels them.
+ *  Snapshoots are cached. Cache keeps ready snapshoots and snapshoots
+ *  compressed in memory, set limits with set_context_cache_size.
+ *  Call set_context_spill to keep snapshoots dropped from memory in
+ *  file of given size, it is reused by next sessions.
+ *  Call get_snapshoot_range to get many consecutive images in one pass.
+ *  Call get_cached_snapshoot to get cached snapshoot of image nearest
+ *  to gif_pos without decoding, it returns NULL if there is none.
+ *  Call get_gif_image_delay to get delay of image in hundredths of
+ *  second, gif is decoded for it.
+ *  Call get_context_memory_stats to see memory held by each gif.
+ *  Broken or truncated gif keeps images decoded before the broken one
+ *  and is not decoded again, until its file changes and is reloaded.
+ *  get_gif_damage returns giflib error, which stopped decoding, or 0.
+ *  Images from begin to end - 1 are lost then, end is the number of
+ *  images found in file, if it can be scanned.
+ *  Call watch_context_files to reload gifs, when their files change.
+ *  Changed file is read and decoded in worker thread, then it takes
+ *  place of old gif, and only snapshoots of that gif are dropped.
+ *  Function set by set_context_reload_func is called in main loop
+ *  after that. Watching needs running main loop, free_context must be
+ *  called in its thread then.
+ *  Context functions may be called from several threads.
  */
 
 typedef struct Context Context, *PContext;
 typedef unsigned char byte;
 /**
- *  Pointer to gif's snapshoot.
+ *  Storage of snapshoot pixels. Set it for context with
+ *  set_context_snapshoot_format, BGRX is default.
+ *  Indexed snapshoot takes 4 times less memory. Call snapshoot_expand
+ *  to convert its visible part to BGRX at paint time.
+ */
+typedef enum GifSnapshootFormat {
+    GIF_SNAPSHOOT_BGRX,     //pixmap, 4 bytes per pixel like CAIRO_FORMAT_RGB24
+    GIF_SNAPSHOOT_INDEXED   //indices, 1 byte per pixel and palette
+} GifSnapshootFormat;
+
+#define GIF_PALETTE_SIZE 256
+
+/**
+ *  Colormap look-up table. Shared by snapshoots.
+ */
+typedef struct GifPalette {
+    volatile gint ref_count;
+    guint32 colors[GIF_PALETTE_SIZE];   //Native endian 0xffRRGGBB
+} GifPalette;
+
+/**
+ *  Pointer to gif's snapshoot. Size is the size of gif screen.
+ *  Snapshoots are shared with the context cache and must not be
+ *  changed. Call snapshoot_ref to take one more reference and
+ *  free_snapshoot to release it. Images with equal content share
+ *  one snapshoot.
  */
 typedef struct GifSnapshoot {
+    volatile gint ref_count;
     int width, height;
     unsigned char *pixmap;
+    gint64 decode_time;     //Microseconds spent on decoding its gif
+    gint64 convert_time;    //Microseconds spent on colormap conversion
+    GifSnapshootFormat format;
+    byte *indices;
+    GifPalette *palette;
+    struct FramePoolEntry *pooled;  //Entry of shared snapshoot or NULL
+    int cache_holders;      //Hot entries of context cache, under its lock
 } GifSnapshoot;
 
+/**
+ *  Consecutive images of gif. get_snapshoot_range puts images from
+ *  begin to end - 1 one by one into BGRX buffer of screen size with
+ *  stride bytes per row and calls callback after each of them. Return
+ *  FALSE from callback to stop. If buffer is NULL, context allocates
+ *  one for the pass. Buffer is changed incrementally and must not be
+ *  changed by callback.
+ *  Images are the same as get_snapshoot_pos gives, with flag
+ *  GIF_RANGE_COMPOSITE they are composed like frames of animation:
+ *  transparent pixels keep previous frame and disposal is applied.
+ *  Returns number of passed images or -1 on error.
+ */
+#define GIF_RANGE_COMPOSITE 0x01
+
+typedef gboolean (*GifRangeFunc) (int gif_pos, const unsigned char *pixels,
+        int width, int height, int stride, gpointer user_data);
+
+/**
+ *  Performance counters of context.
+ *  Call get_context_stats to fill it.
+ */
+typedef struct GifContextStats {
+    unsigned long snapshoots;   //Snapshoots made
+    unsigned long cache_hits;   //Taken from cache
+    unsigned long cold_hits;    //Unpacked from compressed cache
+    unsigned long cache_misses; //Converted from decoded gif
+    unsigned long decodes;      //Gif decodings
+    unsigned long evictions;    //Dropped from compressed cache
+    unsigned long spill_hits;   //Read from spill store on disk
+    unsigned long shared;       //Equal to converted image, not converted
+    unsigned long reloads;      //Gifs read again after change of file
+    size_t decoded_bytes;       //Resident decoded raster bytes
+    size_t cache_bytes;         //Snapshoots in cache
+    size_t shared_bytes;        //Cache bytes saved by equal snapshoots
+    size_t packed_cache_bytes;  //Snapshoots in compressed cache
+} GifContextStats;
+
+/**
+ *  Memory held by context. Call get_context_memory_stats to fill it
+ *  and clear_context_memory_stats to free per gif array.
+ *  Gifs being decoded are counted after decoding is over.
+ */
+typedef struct GifMemoryUsage {
+    size_t rasters;         //Decoded rasters of images
+    size_t structures;      //Gif descriptors, colormaps and extensions
+    size_t palette;         //Look-up table of global colormap
+    size_t cache;           //Snapshoots in cache
+    size_t packed_cache;    //Snapshoots in compressed cache
+} GifMemoryUsage;
+
+typedef struct GifMemoryStats {
+    GifMemoryUsage total;   //Sum of all gifs
+    size_t context;         //Context, gif list and cache structures
+    size_t bytes;           //Sum of all categories
+    int gif_count;
+    GifMemoryUsage *gifs;   //Usage of each gif
+} GifMemoryStats;
+
 #define gifptr_correct(p,c) \
     ((p) >= 0 && (p) < get_gif_count(c) )
 
@@ -61,21 +194,72 @@ typedef struct GifSnapshoot {
 
 
 typedef void (*interface_init_f) (void *init_data, PContext c);
+typedef void (*GifReloadFunc) (PContext c, int gif, gpointer user_data);
 
 PContext create_context (interface_init_f init, void *init_data);
 void free_context (PContext c);
+GifSnapshoot *snapshoot_ref (GifSnapshoot *sh);
 void free_snapshoot (GifSnapshoot *sh);
+GifPalette *palette_ref (GifPalette *palette);
+void palette_unref (GifPalette *palette);
+void set_context_snapshoot_format (PContext c, GifSnapshootFormat format);
+void set_context_cache_size (PContext c, size_t hot_size, size_t packed_size);
+int set_context_spill (PContext c, const char *filename, size_t size);
+void watch_context_files (PContext c);
+void set_context_reload_func (PContext c, GifReloadFunc func, gpointer data);
+void snapshoot_expand (const GifSnapshoot *sh, 
+        int x, int y, int width, int height,
+        unsigned char *dst, int dst_stride);
+size_t get_snapshoot_size (const GifSnapshoot *sh);
 
+/**
+ *  read_gif reads "-" from stdin and pipes progressively, like
+ *  read_gif_handle does: images are decoded in background as they
+ *  arrive. Then get_gif_image_count gives images, which arrived so
+ *  far, get_snapshoot_pos waits for its image and get_snapshoot_range
+ *  waits for end of stream. Such gif has name, but no filename.
+ */
 int read_gif (PContext c, const char *file, int *error);
 int read_gif_handle (PContext c, int handle, int *error);
 GifSnapshoot* get_snapshoot (const PContext c, int gif, float gif_pos);
 GifSnapshoot* get_snapshoot_pos (const PContext c, int gif, int gif_pos);
+void get_snapshoot_async (PContext c, int gif, float gif_pos,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data);
+void get_snapshoot_pos_async (PContext c, int gif, int gif_pos,
+        GCancellable *cancellable, GAsyncReadyCallback callback,
+        gpointer user_data);
+GifSnapshoot *get_snapshoot_finish (PContext c, GAsyncResult *result,
+        int *gif, int *gif_pos, GError **error);
+void prefetch_snapshoot (PContext c, int gif, int gif_pos,
+        GCancellable *cancellable);
+GifSnapshoot *get_cached_snapshoot (const PContext c, int gif, int gif_pos,
+        int *found_pos);
+int get_snapshoot_range (const PContext c, int gif, int begin, int end,
+        int flags, unsigned char *buffer, int stride,
+        GifRangeFunc callback, gpointer user_data);
 
 size_t get_gif_count (const PContext c);
 int get_gif_image_count (const PContext c, int gif);
+int peek_gif_image_count (const PContext c, int gif);
+int decode_gif_slice (const PContext c, int gif, gint64 duration);
+void set_context_idle_decode (PContext c, gboolean idle_decode);
+int count_gif_images (const PContext c, int gif);
+void count_all_gif_images_async (PContext c, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer user_data);
+GArray *count_all_gif_images_finish (PContext c, GAsyncResult *result,
+        GError **error);
+int get_gif_damage (const PContext c, int gif, int *begin, int *end);
 void *get_context_interface_data (const PContext c);
 void set_context_interface_data (PContext c, void *data);
+void get_context_stats (const PContext c, GifContextStats *stats);
+void get_context_memory_stats (const PContext c, GifMemoryStats *stats);
+void clear_context_memory_stats (GifMemoryStats *stats);
+void print_context_memory_stats (const PContext c, FILE *file);
 
 const char *get_gif_filename (const PContext c, int gif);
+const char *get_gif_name (const PContext c, int gif);
+int get_gif_screen_size (const PContext c, int gif, int *width, int *height);
+int get_gif_image_delay (const PContext c, int gif, int gif_pos);
 
 #endif /*GIFSEEKER_H*/
@@ -18,6 +18,11 @@
  */
 
 #include "gtk_interface.h"
+#include "trace.h"
+#include "export.h"
+#include "shuffle.h"
+#include "parallel.h"
+#include "metrics.h"
 #include "../config.h"
 
 #include <stdlib.h>
@@ -33,6 +38,7 @@ typedef struct GtkGifWidgets {
     GtkWidget *window;              //Main window itself
     GtkWidget *main_box;            //Box, containig all elements
     GtkWidget *drawing_area;        //Simple to guess =)
+    GtkWidget *scrolled_window;     //Scrolls drawing area of big images
 
     GtkWidget *control_area;        //Area of text at the bottom of window
     int control_area_height;        //Heigth of this area
@@ -44,6 +50,7 @@ typedef struct GtkGifWidgets {
     int menu_bar_width;             //Max width between menu bar and toolbar
 
     GtkToolItem *slideshow_item;    //Item from toolbar to toggle its icon
+    GtkWidget *scrub;               //Slider over images of current gif
 
     GtkWidget *gif_id;              //Label with gif file name
     GtkWidget *image_no;            //Label with current image number
@@ -60,9 +67,10 @@ typedef enum GtkGifRunningMode {
 typedef struct GtkGifInterace {
     GtkGifWidgets gtk;
     
-    cairo_surface_t *drawing_surface;
-    cairo_surface_t *image;
-    GdkPixmap *pixmap;
+    //Image is shown by tiles, only visible ones are kept
+    cairo_surface_t **tiles;
+    int tile_cols, tile_rows;
+    int image_left;                 //Offset of image in drawing area
     GifSnapshoot *image_data;
     PContext gif_context;
     GdkColor bg_color;
@@ -71,11 +79,130 @@ typedef struct GtkGifInterace {
     GifGtkRunningMode mode;
 
     const char *help_string;
+
+    gboolean show_hud;              //Performance overlay is on
+    guint hud_timer;                //Refreshes hud_memory
+    size_t hud_memory;              //Context memory shown by overlay
+#define HUD_FPS_FRAMES 64
+    gint64 frame_times[HUD_FPS_FRAMES]; //Times of last displayed frames
+    int frame_times_pos;
+    gint64 timer_expected;          //When slideshow timer should fire
+    gint64 timer_lateness;          //How late it fired last time
+
+    GCancellable *request;          //Image request in progress
+    GCancellable *prefetch;         //Neighbor images being cached
+    GifShuffle *shuffle;            //No-repeat random mode is on
+    GCancellable *shuffle_build;    //Shuffle being built to replace it
+    gboolean display_request;       //Display image, when it is ready
+
+    gboolean scrub_updating;        //Slider is moved by program
+    guint scrub_timer;              //Waits for slider to settle
+    int scrub_pos;                  //Image chosen by slider
+
+    guint navigate_idle;            //Requests image after queued keys
+    gboolean navigate_pending;      //Cursor moved since image request
+    gboolean navigate_display;      //Display image, when it is requested
 } GtkGifInterace;
 
 
-#define MAX_WIDTH 2048
-#define MAX_HEIGHT 2048
+#define TILE_SIZE 256
+//Part of screen, which window may take
+#define MAX_SCREEN_PART 0.9
+
+static void
+clear_tiles (GtkGifInterace *interface)
+{
+    int i;
+
+    for (i = 0; i < interface->tile_cols * interface->tile_rows; ++i) {
+        if (interface->tiles[i] != NULL) {
+            cairo_surface_destroy (interface->tiles[i]);
+        }
+    }
+    free (interface->tiles);
+    interface->tiles = NULL;
+    interface->tile_cols = interface->tile_rows = 0;
+}
+
+typedef struct TileJob {
+    GtkGifInterace *interface;
+    int *tiles;                     //Indices of tiles to fill
+} TileJob;
+
+static void
+fill_tile (int i, gpointer data)
+{
+    TileJob *job = (TileJob *) data;
+    GtkGifInterace *interface = job->interface;
+    cairo_surface_t *tile = interface->tiles[job->tiles[i]];
+    int col = job->tiles[i] % interface->tile_cols;
+    int row = job->tiles[i] / interface->tile_cols;
+
+    snapshoot_expand (interface->image_data, col * TILE_SIZE, row * TILE_SIZE,
+            cairo_image_surface_get_width (tile), 
+            cairo_image_surface_get_height (tile),
+            cairo_image_surface_get_data (tile),
+            cairo_image_surface_get_stride (tile));
+}
+
+/**
+ *  Creates missing tiles in rectangle of image coordinates.
+ *  They are filled from snapshoot in parallel.
+ */
+static void
+materialize_tiles (GtkGifInterace *interface, 
+        int col0, int row0, int col1, int row1)
+{
+    GifSnapshoot *image_data = interface->image_data;
+    TileJob job;
+    int col, row, i, count = 0;
+
+    job.interface = interface;
+    job.tiles = calloc ((col1 - col0) * (row1 - row0), sizeof (int));
+    if (job.tiles == NULL) {
+        put_error (1, "Can not allocate memory for tiles");
+    }
+    for (row = row0; row < row1; ++row) {
+        for (col = col0; col < col1; ++col) {
+            i = row * interface->tile_cols + col;
+            if (interface->tiles[i] != NULL) {
+                continue;
+            }
+            interface->tiles[i] = cairo_image_surface_create (
+                    CAIRO_FORMAT_RGB24, 
+                    MIN (TILE_SIZE, image_data->width - col * TILE_SIZE),
+                    MIN (TILE_SIZE, image_data->height - row * TILE_SIZE));
+            cairo_surface_flush (interface->tiles[i]);
+            job.tiles[count++] = i;
+        }
+    }
+    parallel_for (count, 0, fill_tile, &job);
+    for (i = 0; i < count; ++i) {
+        cairo_surface_mark_dirty (interface->tiles[job.tiles[i]]);
+    }
+    free (job.tiles);
+}
+
+/**
+ *  Drops tiles outside of rectangle of image coordinates.
+ */
+static void
+forget_tiles (GtkGifInterace *interface, 
+        int col0, int row0, int col1, int row1)
+{
+    int col, row, i;
+
+    for (row = 0; row < interface->tile_rows; ++row) {
+        for (col = 0; col < interface->tile_cols; ++col) {
+            i = row * interface->tile_cols + col;
+            if (interface->tiles[i] != NULL && (col < col0 || col >= col1 ||
+                        row < row0 || row >= row1)) {
+                cairo_surface_destroy (interface->tiles[i]);
+                interface->tiles[i] = NULL;
+            }
+        }
+    }
+}
 
 static gboolean 
 on_delete_event( GtkWidget *widget,
@@ -85,14 +212,46 @@ on_delete_event( GtkWidget *widget,
     return FALSE;
 }
 
+static void
+cancel_shuffle_build (GtkGifInterace *interface)
+{
+    if (interface->shuffle_build != NULL) {
+        g_cancellable_cancel (interface->shuffle_build);
+        g_clear_object (&interface->shuffle_build);
+    }
+}
+
 static gboolean
 on_destroy( GtkWidget *widget,
         GtkGifInterace *interface)
 {
-    if (interface->image != NULL) {
-        cairo_surface_destroy (interface->image);
-        interface->image = NULL;
+    if (interface->request != NULL) {
+        g_cancellable_cancel (interface->request);
+        g_object_unref (interface->request);
+        interface->request = NULL;
+    }
+    if (interface->prefetch != NULL) {
+        g_cancellable_cancel (interface->prefetch);
+        g_clear_object (&interface->prefetch);
+    }
+    cancel_shuffle_build (interface);
+    if (interface->shuffle != NULL) {
+        gif_shuffle_free (interface->shuffle);
+        interface->shuffle = NULL;
+    }
+    if (interface->scrub_timer != 0) {
+        g_source_remove (interface->scrub_timer);
+        interface->scrub_timer = 0;
     }
+    if (interface->hud_timer != 0) {
+        g_source_remove (interface->hud_timer);
+        interface->hud_timer = 0;
+    }
+    if (interface->navigate_idle != 0) {
+        g_source_remove (interface->navigate_idle);
+        interface->navigate_idle = 0;
+    }
+    clear_tiles (interface);
     if (interface->image_data != NULL) {
         free_snapshoot (interface->image_data);
         interface->image_data = NULL;
@@ -123,49 +282,210 @@ on_map (GtkWidget *widget, GdkEvent *event,
 static void 
 update_drawing_data (GtkGifInterace *interface)
 {
-    if (interface->image != NULL) {
-        cairo_surface_destroy (interface->image);
-        interface->image = NULL;
-    }
+    clear_tiles (interface);
     if (interface-> image_data != NULL) {
         free_snapshoot (interface->image_data);
         interface->image_data = NULL;
     }
 }
 
+#define DEFAULT_DRAWING_AREA_SIZE 100
+
+static double
+get_fps (GtkGifInterace *interface)
+{
+    gint64 now = g_get_monotonic_time ();
+    gint64 oldest = now;
+    int i, frames = 0;
+
+    //Count frames displayed during last second
+    for (i = 0; i < HUD_FPS_FRAMES; ++i) {
+        if (interface->frame_times[i] != 0 &&
+                now - interface->frame_times[i] <= G_USEC_PER_SEC) {
+            ++frames;
+            oldest = MIN (oldest, interface->frame_times[i]);
+        }
+    }
+    if (frames < 2 || now == oldest) {
+        return frames;
+    }
+    return (frames - 1) * (double) G_USEC_PER_SEC / (now - oldest);
+}
+
+static size_t
+get_tiles_memory (GtkGifInterace *interface)
+{
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < interface->tile_cols * interface->tile_rows; ++i) {
+        if (interface->tiles[i] != NULL) {
+            bytes += (size_t) cairo_image_surface_get_stride (
+                    interface->tiles[i]) *
+                cairo_image_surface_get_height (interface->tiles[i]);
+        }
+    }
+    return bytes;
+}
+
+static void
+draw_hud (GtkGifInterace *interface, cairo_t *cr, int left, int top)
+{
+#define HUD_LINES 6
+#define HUD_LINE_LEN 64
+#define HUD_FONT_SIZE 12
+    GifSnapshoot *image_data = interface->image_data;
+    GifContextStats stats;
+    char lines [HUD_LINES][HUD_LINE_LEN];
+    int i;
+
+    get_context_stats (interface->gif_context, &stats);
+
+    snprintf (lines[0], HUD_LINE_LEN, "fps: %.1f", get_fps (interface));
+    snprintf (lines[1], HUD_LINE_LEN, "decode: %.2f ms convert: %.2f ms",
+            image_data != NULL ? image_data->decode_time / 1000.0 : 0,
+            image_data != NULL ? image_data->convert_time / 1000.0 : 0);
+    snprintf (lines[2], HUD_LINE_LEN, 
+            "cache hits: %.1f%% (%.1f%% packed, %.1f%% disk)",
+            stats.snapshoots > 0 ? 100.0 * (stats.cache_hits + 
+                stats.cold_hits + stats.spill_hits) / stats.snapshoots : 0,
+            stats.snapshoots > 0 ? 100.0 * 
+                stats.cold_hits / stats.snapshoots : 0,
+            stats.snapshoots > 0 ? 100.0 * 
+                stats.spill_hits / stats.snapshoots : 0);
+    snprintf (lines[3], HUD_LINE_LEN, "decoded: %.1f MiB cache: %.1f+%.1f MiB",
+            stats.decoded_bytes / (1024.0 * 1024.0),
+            stats.cache_bytes / (1024.0 * 1024.0),
+            stats.packed_cache_bytes / (1024.0 * 1024.0));
+    snprintf (lines[4], HUD_LINE_LEN, "lateness: %.1f ms shared: %.1f MiB",
+            interface->timer_lateness / 1000.0, 
+            stats.shared_bytes / (1024.0 * 1024.0));
+    snprintf (lines[5], HUD_LINE_LEN, "memory: %.1f MiB tiles: %.1f MiB",
+            interface->hud_memory / (1024.0 * 1024.0),
+            get_tiles_memory (interface) / (1024.0 * 1024.0));
+
+    cairo_save (cr);
+    cairo_set_source_rgba (cr, 0, 0, 0, 0.6);
+    cairo_rectangle (cr, left, top, 
+            HUD_LINE_LEN * HUD_FONT_SIZE / 2, 
+            (HUD_LINES + 1) * HUD_FONT_SIZE);
+    cairo_fill (cr);
+
+    cairo_select_font_face (cr, "monospace", 
+            CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_set_font_size (cr, HUD_FONT_SIZE);
+    cairo_set_source_rgb (cr, 1, 1, 1);
+    for (i = 0; i < HUD_LINES; ++i) {
+        cairo_move_to (cr, left + HUD_FONT_SIZE / 2, 
+                top + (i + 1) * HUD_FONT_SIZE);
+        cairo_show_text (cr, lines[i]);
+    }
+    cairo_restore (cr);
+#undef HUD_LINES
+#undef HUD_LINE_LEN
+#undef HUD_FONT_SIZE
+}
+
+/**
+ *  Range of tiles, which intersect rectangle of drawing area.
+ */
+static void
+get_tile_range (GtkGifInterace *interface, const GdkRectangle *area,
+        int *col0, int *row0, int *col1, int *row1)
+{
+    int x = area->x - interface->image_left;
+
+    *col0 = MAX (x, 0) / TILE_SIZE;
+    *row0 = MAX (area->y, 0) / TILE_SIZE;
+    *col1 = MIN ((MAX (x + area->width, 0) + TILE_SIZE - 1) / TILE_SIZE,
+            interface->tile_cols);
+    *row1 = MIN ((MAX (area->y + area->height, 0) + TILE_SIZE - 1) / TILE_SIZE,
+            interface->tile_rows);
+}
+
+static void
+get_visible_rect (GtkGifInterace *interface, GdkRectangle *visible)
+{
+    GtkScrolledWindow *scrolled_window = 
+            GTK_SCROLLED_WINDOW (interface->gtk.scrolled_window);
+    GtkAdjustment *hadjustment, *vadjustment;
+
+    hadjustment = gtk_scrolled_window_get_hadjustment (scrolled_window);
+    vadjustment = gtk_scrolled_window_get_vadjustment (scrolled_window);
+    visible->x = gtk_adjustment_get_value (hadjustment);
+    visible->y = gtk_adjustment_get_value (vadjustment);
+    visible->width = gtk_adjustment_get_page_size (hadjustment);
+    visible->height = gtk_adjustment_get_page_size (vadjustment);
+}
+
 static gboolean 
 on_expose_event(GtkWidget *widget,
         GdkEventExpose *event,
         gpointer data)
 {
     GtkGifInterace *interface = (GtkGifInterace *) data;
-    interface->bg_color = gtk_widget_get_style(widget)->
-            mid[GTK_STATE_NORMAL];
-    gdk_draw_drawable(widget->window,
-        widget->style->fg_gc[GTK_WIDGET_STATE(widget)], interface->pixmap,
-        // Only copy the area that was exposed.
-        event->area.x, event->area.y,
-        event->area.x, event->area.y,
-        event->area.width, event->area.height);
+    GdkRectangle visible;
+    cairo_t *cr;
+    int col, row, col0, row0, col1, row1;
+    TRACE_BEGIN (stamp);
+
+    get_visible_rect (interface, &visible);
+
+    cr = gdk_cairo_create (widget->window);
+    gdk_cairo_rectangle (cr, &event->area);
+    cairo_clip (cr);
+    gdk_cairo_set_source_color (cr, &interface->bg_color);
+    cairo_paint (cr);
+
+    if (interface->tiles != NULL) {
+        //Only exposed tiles are made, the ones out of sight are dropped
+        get_tile_range (interface, &event->area, 
+                &col0, &row0, &col1, &row1);
+        if (col0 < col1 && row0 < row1) {
+            materialize_tiles (interface, col0, row0, col1, row1);
+        }
+        for (row = row0; row < row1; ++row) {
+            for (col = col0; col < col1; ++col) {
+                cairo_set_source_surface (cr, 
+                        interface->tiles[row * interface->tile_cols + col],
+                        interface->image_left + col * TILE_SIZE, 
+                        row * TILE_SIZE);
+                cairo_paint (cr);
+            }
+        }
+        get_tile_range (interface, &visible, &col0, &row0, &col1, &row1);
+        forget_tiles (interface, col0, row0, col1, row1);
+    }
+
+    if (interface->show_hud) {
+        draw_hud (interface, cr, MAX (visible.x, interface->image_left), 
+                visible.y);
+    }
+    cairo_destroy (cr);
 
+    TRACE_END (stamp, "expose");
     return FALSE;
 }
 
-#define DEFAULT_DRAWING_AREA_SIZE 100
+static void
+on_scroll (GtkAdjustment *adjustment, GtkGifInterace *interface)
+{
+    //Scrolled content is moved, but overlay must stay in place
+    if (interface->show_hud) {
+        gtk_widget_queue_draw (interface->gtk.drawing_area);
+    }
+}
 
 static gboolean
 display_image (gpointer data)
 {
     GtkGifInterace *interface = (GtkGifInterace *) data;
     GtkWidget *window = interface->gtk.window;
-    cairo_surface_t *image;
-    cairo_t *cr, *cr_pixmap, *cr_background;
-
-    int width, height;
-    int top, left;
     GifSnapshoot *image_data = interface->image_data;
+    GdkScreen *screen;
     GdkGeometry gdkGeometry;
-    cairo_status_t status;
+    int width, height, area_width, view_width, view_height;
+    TRACE_BEGIN (stamp);
 
     interface->bg_color = gtk_widget_get_style(window)->black;
             //dark[GTK_STATE_NORMAL];
@@ -177,12 +497,25 @@ display_image (gpointer data)
         width = height = DEFAULT_DRAWING_AREA_SIZE;
     }
 
-    //Set size to image geometry.
+    //Set size to image geometry, big images are scrolled.
 
-    gdkGeometry.min_width = fmax (width, 
+    area_width = fmax (width, 
             fmax (interface->gtk.control_area_width,
             interface->gtk.menu_bar_width));
-    gdkGeometry.min_height = height
+    screen = gtk_window_get_screen (GTK_WINDOW (window));
+    view_width = MIN (area_width, 
+            gdk_screen_get_width (screen) * MAX_SCREEN_PART);
+    view_height = MIN (height, 
+            gdk_screen_get_height (screen) * MAX_SCREEN_PART
+            - interface->gtk.control_area_height
+            - interface->gtk.menu_bar_height);
+    gtk_widget_set_size_request (interface->gtk.drawing_area, 
+            area_width, height);
+    gtk_widget_set_size_request (interface->gtk.scrolled_window, 
+            view_width, view_height);
+
+    gdkGeometry.min_width = view_width;
+    gdkGeometry.min_height = view_height
             + interface->gtk.control_area_height
             + interface->gtk.menu_bar_height;
 
@@ -191,92 +524,116 @@ display_image (gpointer data)
     gtk_window_set_geometry_hints (GTK_WINDOW(window), window,
             &gdkGeometry,GDK_HINT_MIN_SIZE);
 
-    left = (gdkGeometry.min_width - width)/2;
-    top = 0;//(gdkGeometry.min_height - height)/2;
+    interface->image_left = (area_width - width)/2;
 
-    //Prepare image to uploading
-
-    if (interface->image != NULL) {
-        cairo_surface_destroy (interface->image);
-        interface->image = NULL;
+    //Tiles are made on expose
+    clear_tiles (interface);
+    if (image_data != NULL) {
+        interface->tile_cols = (width + TILE_SIZE - 1) / TILE_SIZE;
+        interface->tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+        interface->tiles = calloc (interface->tile_cols * interface->tile_rows,
+                sizeof (cairo_surface_t *));
+        if (interface->tiles == NULL) {
+            put_error (1, "Can not allocate memory for tiles");
+        }
     }
 
-    //Drawing background
-
-    //TODO: resolve this!
-    interface->bg_color = gtk_widget_get_style(window)->
-            black;//base[GTK_STATE_NORMAL];
-    cr_background = cairo_create (interface->drawing_surface);
-    cairo_set_source_rgb (cr_background, 
-            interface->bg_color.red, 
-            interface->bg_color.green, 
-            interface->bg_color.blue); 
-    cairo_paint (cr_background);
-    cairo_destroy (cr_background);
-
+    interface->frame_times[interface->frame_times_pos] = 
+            g_get_monotonic_time ();
+    interface->frame_times_pos = 
+            (interface->frame_times_pos + 1) % HUD_FPS_FRAMES;
     if (image_data != NULL) {
-        //Uploading image from interface's data to cairo_surface
-        interface->image = cairo_image_surface_create_for_data (
-               image_data->pixmap, CAIRO_FORMAT_RGB24, width, height, 
-               cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, width));
+        metrics_count (METRICS_FRAMES_SHOWN);
+    }
 
-        status = cairo_surface_status(interface->image);
+    gtk_widget_queue_draw (interface->gtk.drawing_area);
+    TRACE_END (stamp, "display_image");
+    return FALSE;
+}
 
-        if ( status != CAIRO_STATUS_SUCCESS) {
-            put_error ( status, "Can not load image, because \'%s\'", 
-                cairo_status_to_string(status) );
-        }
+/**
+ *  Sets range of slider to images of current gif. Count of images is
+ *  taken by file scan, while gif is not decoded.
+ */
+static void
+update_scrub (GtkGifInterace *interface)
+{
+    PContext c = interface->gif_context;
+    GtkRange *range = GTK_RANGE (interface->gtk.scrub);
+    int count = -1;
 
-        //Drawing image
-        image = interface->image;
-        cr = cairo_create (interface->drawing_surface);
-        cairo_set_source_surface (cr, image, left, top);
-        cairo_paint (cr);
-        cairo_destroy (cr);
+    if (get_gif_count (c) > 0) {
+        count = peek_gif_image_count (c, interface->gif_no);
+        if (count < 0 && get_gif_filename (c, interface->gif_no) != NULL) {
+            count = count_gif_images (c, interface->gif_no);
+        }
     }
-
-    cr_pixmap = gdk_cairo_create(interface->pixmap);
-    cairo_set_source_surface(cr_pixmap, interface->drawing_surface, 0,0);
-    cairo_paint(cr_pixmap);
-
-    gtk_widget_queue_draw(window);
+    gtk_widget_set_sensitive (interface->gtk.scrub, count > 1);
+    //Slider is not moved under pointer while it is dragged
+    if (count <= 1 || interface->scrub_timer != 0) {
+        return;
+    }
+    interface->scrub_updating = TRUE;
+    gtk_range_set_range (range, 0, count - 1);
+    gtk_range_set_value (range, interface->image_no);
+    interface->scrub_updating = FALSE;
 }
 
 static void
-update_image (GtkGifInterace *interface, gboolean display)
+update_labels (GtkGifInterace *interface)
 {
 #define IMAGE_INFO_LINE_LEN 6+10+4+10 //more then in MAX_INT + 1
     PContext c = interface->gif_context;
     const char *filename = NULL;
+    char *basename = NULL;
     char image_no[IMAGE_INFO_LINE_LEN]; 
-    int number_len;
+    char *label_text, *damage_info = NULL;
+    int number_len, count, shown_no, damage_begin, damage_end;
     GtkRequisition natural_size;
     int gif_id_width = 0, image_no_width = 0;
 
-    update_drawing_data (interface);
-
     if (get_gif_count(c) > 0 ) {
-        interface->image_data = get_snapshoot_pos (c, interface->gif_no,
-                interface->image_no);
-        if (interface->image_data == NULL) {
-            put_warning ("Can not get image.");
-            return;
-        }
-
-        filename = g_path_get_basename(get_gif_filename (c,interface->gif_no));
-        if (filename == NULL) {
+        filename = get_gif_name (c,interface->gif_no);
+        if (filename != NULL) {
+            filename = basename = g_path_get_basename(filename);
+        } else {
             filename = "Unknown data source";
         }     
         gtk_label_set_text (GTK_LABEL(interface->gtk.gif_id), 
                 filename);
+        g_free (basename);
 
-        number_len = sprintf(image_no, "image %d/%d", 
-            interface->image_no+1, get_gif_image_count(c,interface->gif_no) );
+        //Cursor may count from the end, until worker resolves it
+        count = peek_gif_image_count(c,interface->gif_no);
+        shown_no = interface->image_no >= 0 ? interface->image_no + 1 :
+                MAX (count + interface->image_no + 1, 0);
+        number_len = sprintf(image_no, "image %d/%d", shown_no, count);
         if (number_len >= IMAGE_INFO_LINE_LEN) {
             put_error (1,"Pehaps, overflow");
         }
+        //Images after broken one are lost
+        if (get_gif_damage (c, interface->gif_no, 
+                    &damage_begin, &damage_end) != 0) {
+            damage_info = g_strdup_printf (", %d-%d damaged", 
+                    damage_begin + 1, damage_end);
+        }
+        if (interface->shuffle != NULL) {
+            label_text = g_strdup_printf ("%s%s, shuffle %" G_GUINT64_FORMAT
+                    "/%" G_GUINT64_FORMAT, image_no,
+                    damage_info != NULL ? damage_info : "",
+                    gif_shuffle_position (interface->shuffle),
+                    gif_shuffle_size (interface->shuffle));
+        } else if (interface->shuffle_build != NULL) {
+            label_text = g_strconcat (image_no, 
+                    damage_info != NULL ? damage_info : "",
+                    ", counting images to shuffle", NULL);
+        } else {
+            label_text = g_strconcat (image_no, damage_info, NULL);
+        }
         gtk_label_set_text (GTK_LABEL(interface->gtk.image_no), 
-                image_no);
+                label_text);
+        g_free (label_text);
+        g_free (damage_info);
     } else {
         interface->mode = GIF_GTK_COMMON_MODE;
         gtk_label_set_text (GTK_LABEL(interface->gtk.image_no), 
@@ -291,6 +648,10 @@ update_image (GtkGifInterace *interface, gboolean display)
     interface->gtk.control_area_width = gif_id_width + image_no_width + 10;
     interface->gtk.control_area_height = natural_size.height;
 
+    update_scrub (interface);
+    gtk_widget_size_request (interface->gtk.scrub, &natural_size);
+    interface->gtk.control_area_height += natural_size.height;
+
     gtk_widget_size_request (interface->gtk.menu_bar, &natural_size);
     interface->gtk.menu_bar_height = natural_size.height;
     interface->gtk.menu_bar_width = natural_size.width;
@@ -309,34 +670,188 @@ update_image (GtkGifInterace *interface, gboolean display)
         }
     }
 
+}
+
+static void
+update_image (GtkGifInterace *interface, gboolean display);
+
+/**
+ *  Caches images next to displayed one, while user looks at it.
+ *  Prefetch of images left behind is cancelled.
+ */
+static void
+prefetch_neighbors (GtkGifInterace *interface)
+{
+    PContext c = interface->gif_context;
+    int img_count;
+
+    if (interface->prefetch != NULL) {
+        g_cancellable_cancel (interface->prefetch);
+        g_object_unref (interface->prefetch);
+    }
+    interface->prefetch = g_cancellable_new ();
+
+    img_count = peek_gif_image_count (c, interface->gif_no);
+    if (img_count < 0 || interface->image_no + 1 < img_count) {
+        prefetch_snapshoot (c, interface->gif_no, interface->image_no + 1,
+                interface->prefetch);
+    }
+    if (interface->image_no > 0) {
+        prefetch_snapshoot (c, interface->gif_no, interface->image_no - 1,
+                interface->prefetch);
+    }
+}
+
+static void
+on_snapshoot_ready (GObject *source, GAsyncResult *result, gpointer data)
+{
+    GtkGifInterace *interface = (GtkGifInterace *) data;
+    GifSnapshoot *image_data;
+    GError *error = NULL;
+    int gif, image_no;
+
+    image_data = get_snapshoot_finish (interface->gif_context, result,
+            &gif, &image_no, &error);
+    if (image_data == NULL) {
+        //Superseded requests are cancelled, newer one is in progress
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            put_warning ("Can not get image. %s", error->message);
+            g_clear_object (&interface->request);
+            if (interface->navigate_pending) {
+                update_image (interface, interface->navigate_display);
+            }
+        }
+        g_error_free (error);
+        return;
+    }
+    g_clear_object (&interface->request);
+
+    //Cursor moved on meanwhile, so image is stale
+    if (interface->navigate_pending) {
+        free_snapshoot (image_data);
+        update_image (interface, interface->navigate_display);
+        return;
+    }
+
+    update_drawing_data (interface);
+    interface->image_data = image_data;
+    interface->gif_no = gif;
+    interface->image_no = image_no;
+    update_labels (interface);
+
+    if (interface->display_request) {
+        display_image (interface);
+    }
+    prefetch_neighbors (interface);
+}
+
+static GCancellable *
+new_request (GtkGifInterace *interface, gboolean display)
+{
+    if (interface->request != NULL) {
+        g_cancellable_cancel (interface->request);
+        g_object_unref (interface->request);
+    }
+    interface->request = g_cancellable_new ();
+    interface->display_request = display;
+    return interface->request;
+}
+
+static void
+update_image (GtkGifInterace *interface, gboolean display)
+{
+    PContext c = interface->gif_context;
+
+    //Explicit choice overrides pending slider position
+    if (interface->scrub_timer != 0) {
+        g_source_remove (interface->scrub_timer);
+        interface->scrub_timer = 0;
+    }
+    if (interface->navigate_idle != 0) {
+        g_source_remove (interface->navigate_idle);
+        interface->navigate_idle = 0;
+    }
+    interface->navigate_pending = FALSE;
+    interface->navigate_display = FALSE;
+
+    if (get_gif_count(c) > 0 ) {
+        //Image is decoded in worker, see on_snapshoot_ready
+        get_snapshoot_pos_async (c, interface->gif_no, interface->image_no,
+                new_request (interface, display), 
+                on_snapshoot_ready, interface);
+        return;
+    }
+
+    update_drawing_data (interface);
+    update_labels (interface);
     if (display) {
         display_image (interface);
     }
 }
 
+static gboolean
+on_navigate_idle (GtkGifInterace *interface)
+{
+    interface->navigate_idle = 0;
+    update_image (interface, interface->navigate_display);
+    return FALSE;
+}
+
+/**
+ *  Requests image under cursor. Held keys move cursor faster than
+ *  images are decoded, so request is made, when queued events are
+ *  handled and previous request is over. Only the latest position is
+ *  decoded and painted then, positions passed meanwhile are skipped.
+ */
+static void
+request_image (GtkGifInterace *interface, gboolean display)
+{
+    interface->navigate_pending = TRUE;
+    interface->navigate_display |= display;
+    update_labels (interface);
+    if (interface->navigate_idle == 0 && interface->request == NULL) {
+        interface->navigate_idle = g_idle_add (
+                (GSourceFunc) on_navigate_idle, interface);
+    }
+}
+
+/**
+ *  File of gif was changed and read again.
+ */
+static void
+on_gif_reloaded (PContext c, int gif, gpointer data)
+{
+    GtkGifInterace *interface = (GtkGifInterace *) data;
+
+    if (gif == interface->gif_no) {
+        update_image (interface, TRUE);
+    }
+}
+
 static void
 get_random_image (GtkGifInterace *interface, gboolean display)
 {
     PContext c = interface->gif_context;
-    int gif, gif_count, img, img_count;
+    int gif, img, gif_count;
 
     gif_count = get_gif_count (c);
     if (gif_count == 0) { 
         update_image (interface, display);
         return;
     }
-    gif = rand () % gif_count;
-    img_count = get_gif_image_count(c,gif);
-    if (img_count <= 0) {
-        put_warning ("Can not get count of images in gif");
+    if (interface->shuffle != NULL &&
+            gif_shuffle_next (interface->shuffle, &gif, &img) == 0) {
+        get_snapshoot_pos_async (c, gif, img,
+                new_request (interface, display),
+                on_snapshoot_ready, interface);
         return;
     }
-    img = rand () % img_count;
-
-    interface->gif_no = gif;
-    interface->image_no = img;
+    gif = rand () % gif_count;
 
-    update_image (interface, display);
+    //Images count is not known until gif is decoded in worker
+    get_snapshoot_async (c, gif, rand () / (RAND_MAX + 1.0),
+            new_request (interface, display),
+            on_snapshoot_ready, interface);
 }
 
 static void
@@ -354,12 +869,11 @@ get_next_image (GtkGifInterace *interface, gboolean display)
         return;
     }
 
-    img_count = get_gif_image_count(c,gif);
-    if (img_count <= 0) {
-        put_warning ("Can not get count of images in gif");
-        return;
-    }
-    if ( img >= img_count ) { 
+    //Unknown while gif is decoding, then worker clamps position.
+    //Position counted from the end passes the last image at zero.
+    img_count = peek_gif_image_count(c,gif);
+    if ( (img_count > 0 && img >= img_count) || 
+            (interface->image_no < 0 && img == 0) ) { 
         ++gif;
         img = 0;
         gif_count = get_gif_count (c);
@@ -373,7 +887,7 @@ get_next_image (GtkGifInterace *interface, gboolean display)
     }
     interface->image_no = img;
     interface->gif_no = gif;
-    update_image (interface, display);
+    request_image (interface, display);
 
     return;
 }
@@ -393,7 +907,10 @@ get_previous_image (GtkGifInterace *interface, gboolean display)
         return;
     }
 
-    if ( img < 0 ) { 
+    //Position counted from the end stays in gif, until its start
+    img_count = peek_gif_image_count (c, gif);
+    if ( img < 0 && (interface->image_no >= 0 || 
+                (img_count > 0 && img < -img_count)) ) { 
         --gif;
         if ( gif < 0 ) {
             gif_count = get_gif_count (c);
@@ -404,16 +921,12 @@ get_previous_image (GtkGifInterace *interface, gboolean display)
             gif = gif_count - 1;
         }
 
-        img_count = get_gif_image_count(c,gif);
-        if (img_count <= 0) {
-            put_warning ("Can not get count of images in gif");
-            return;
-        }
-        img = img_count - 1;
+        //The last one, worker will resolve it
+        img = -1;
     }
     interface->image_no = img;
     interface->gif_no = gif;
-    update_image (interface, display);
+    request_image (interface, display);
 
     return;
 }
@@ -443,7 +956,7 @@ get_next_gif (GtkGifInterace *interface, gboolean display)
 
     interface->image_no = img;
     interface->gif_no = gif;
-    update_image (interface, display);
+    request_image (interface, display);
 
     return;
 }
@@ -472,7 +985,7 @@ get_preavious_gif (GtkGifInterace *interface, gboolean display)
     }
     interface->image_no = img;
     interface->gif_no = gif;
-    update_image (interface, display);
+    request_image (interface, display);
 
     return;
 }
@@ -516,11 +1029,15 @@ show_help_dialog (GtkGifInterace *interface)
 static gboolean
 on_timer_handler (GtkGifInterace *interface);
 
+#define SLIDESHOW_INTERVAL 20
+
 static void
 update_timer (GtkGifInterace *interface)
 {
     if (interface->mode == GIF_GTK_SLIDESHOW_MODE) {
-        g_timeout_add(20, (GSourceFunc)on_timer_handler, 
+        interface->timer_expected = g_get_monotonic_time () 
+                + SLIDESHOW_INTERVAL * 1000;
+        g_timeout_add(SLIDESHOW_INTERVAL, (GSourceFunc)on_timer_handler, 
                 (gpointer) interface);
     }
 }
@@ -528,11 +1045,150 @@ update_timer (GtkGifInterace *interface)
 static gboolean
 on_timer_handler (GtkGifInterace *interface) 
 {
-    get_next_image (interface, TRUE);
+    interface->timer_lateness = MAX (0, g_get_monotonic_time () 
+            - interface->timer_expected);
+    metrics_observe (METRICS_SLIDESHOW_LATENESS, interface->timer_lateness);
+    //Skip the step, while previous image is not ready
+    if (interface->request == NULL && interface->navigate_idle == 0) {
+        get_next_image (interface, TRUE);
+    }
     update_timer (interface);
     return FALSE;
 }
 
+//Milliseconds without slider motion, after which exact image is shown
+#define SCRUB_SETTLE_TIME 120
+
+static gboolean
+on_scrub_settled (GtkGifInterace *interface)
+{
+    interface->scrub_timer = 0;
+    interface->image_no = interface->scrub_pos;
+    update_image (interface, TRUE);
+    return FALSE;
+}
+
+/**
+ *  While slider is dragged, nearest cached image is shown at once.
+ *  Exact image is requested, when slider stops.
+ */
+static void
+on_scrub_changed (GtkRange *range, GtkGifInterace *interface)
+{
+    GifSnapshoot *snap;
+    int found_pos = -1;
+
+    if (interface->scrub_updating) {
+        return;
+    }
+    interface->mode = GIF_GTK_COMMON_MODE;
+    interface->scrub_pos = (int) (gtk_range_get_value (range) + 0.5);
+    if (interface->request != NULL) {
+        g_cancellable_cancel (interface->request);
+        g_clear_object (&interface->request);
+    }
+    if (interface->scrub_timer != 0) {
+        g_source_remove (interface->scrub_timer);
+        interface->scrub_timer = 0;
+    }
+
+    snap = get_cached_snapshoot (interface->gif_context, interface->gif_no,
+            interface->scrub_pos, &found_pos);
+    if (snap == NULL || found_pos != interface->scrub_pos) {
+        interface->scrub_timer = g_timeout_add (SCRUB_SETTLE_TIME, 
+                (GSourceFunc) on_scrub_settled, interface);
+    }
+    if (snap == NULL) {
+        return;
+    }
+    update_drawing_data (interface);
+    interface->image_data = snap;
+    interface->image_no = found_pos;
+    update_labels (interface);
+    display_image (interface);
+}
+
+/**
+ *  Memory of context is summed over all gifs and cache entries,
+ *  so overlay shows figure refreshed once a second.
+ */
+static gboolean
+on_hud_timer (GtkGifInterace *interface)
+{
+    GifMemoryStats memory;
+
+    get_context_memory_stats (interface->gif_context, &memory);
+    interface->hud_memory = memory.bytes;
+    clear_context_memory_stats (&memory);
+    gtk_widget_queue_draw (interface->gtk.drawing_area);
+    return TRUE;
+}
+
+static void
+switch_hud (GtkGifInterace *interface)
+{
+    interface->show_hud = !interface->show_hud;
+    if (interface->show_hud) {
+        on_hud_timer (interface);
+        interface->hud_timer = g_timeout_add_seconds (1, 
+                (GSourceFunc) on_hud_timer, interface);
+    } else {
+        g_source_remove (interface->hud_timer);
+        interface->hud_timer = 0;
+        gtk_widget_queue_draw (interface->gtk.drawing_area);
+    }
+}
+
+static void
+on_shuffle_built (GObject *source_object, GAsyncResult *result,
+        gpointer user_data)
+{
+    GtkGifInterace *interface = (GtkGifInterace *) user_data;
+    GifShuffle *shuffle;
+
+    shuffle = gif_shuffle_new_finish (interface->gif_context, result, NULL);
+    //Cancelled build was already forgotten
+    if (shuffle == NULL) {
+        return;
+    }
+    g_clear_object (&interface->shuffle_build);
+    if (interface->shuffle != NULL) {
+        gif_shuffle_free (interface->shuffle);
+    }
+    interface->shuffle = shuffle;
+    update_labels (interface);
+}
+
+/**
+ *  Current shuffle, if any, is used until new one is built.
+ */
+static void
+start_shuffle_build (GtkGifInterace *interface)
+{
+    cancel_shuffle_build (interface);
+    interface->shuffle_build = g_cancellable_new ();
+    gif_shuffle_new_async (interface->gif_context, 
+            interface->shuffle_build, on_shuffle_built, interface);
+}
+
+/**
+ *  Shuffle is rebuilt, when gifs are added.
+ */
+static void
+switch_shuffle (GtkGifInterace *interface)
+{
+    if (interface->shuffle != NULL || interface->shuffle_build != NULL) {
+        cancel_shuffle_build (interface);
+        if (interface->shuffle != NULL) {
+            gif_shuffle_free (interface->shuffle);
+            interface->shuffle = NULL;
+        }
+    } else {
+        start_shuffle_build (interface);
+    }
+    update_labels (interface);
+}
+
 static void
 switch_running_mode (GtkGifInterace *interface)
 {
@@ -613,6 +1269,18 @@ on_key_press_event (GtkWidget *widget,
         show_about_dialog (interface);
         break;
 
+    case GDK_KEY_I :
+    case GDK_KEY_i :
+        switch_hud (interface);
+        switch_to_common_mode = FALSE;
+        break;
+
+    case GDK_KEY_S :
+    case GDK_KEY_s :
+        switch_shuffle (interface);
+        switch_to_common_mode = FALSE;
+        break;
+
     case GDK_KEY_R :
     case GDK_KEY_r :
         switch_running_mode (interface);
@@ -673,12 +1341,68 @@ on_menu_open (GtkWidget *widget,
     gtk_widget_destroy (dialog);
 
     if (gif_count < get_gif_count(interface->gif_context)) {
+        if (interface->shuffle != NULL || interface->shuffle_build != NULL) {
+            start_shuffle_build (interface);
+        }
         interface->gif_no = gif_count;
         interface->image_no = 0;
         update_image(interface, TRUE);
     }
 }
 
+static void
+on_menu_export (GtkWidget *widget,
+        GtkGifInterace *interface)
+{
+    GtkWidget *dialog, *frames_box, *frames_entry;
+    char *filename, *frames;
+    int image_no, count;
+
+    if (!gifptr_correct (interface->gif_no, interface->gif_context)) {
+        return;
+    }
+
+    dialog = gtk_file_chooser_dialog_new( "Export images",
+            GTK_WINDOW(interface->gtk.window), GTK_FILE_CHOOSER_ACTION_SAVE,
+            GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+            GTK_STOCK_SAVE, GTK_RESPONSE_ACCEPT,
+            NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation (
+            GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name (GTK_FILE_CHOOSER(dialog),
+            "export.gif");
+
+    //Current image is exported by default, cursor may count from
+    //the end. Entry is left empty, if gif is not counted yet
+    image_no = interface->image_no;
+    if (image_no < 0) {
+        count = peek_gif_image_count (interface->gif_context, 
+                interface->gif_no);
+        image_no = count > 0 ? count + image_no : -1;
+    }
+    frames_box = gtk_hbox_new (FALSE, 6);
+    frames_entry = gtk_entry_new ();
+    frames = image_no >= 0 ? g_strdup_printf ("%d", image_no) : g_strdup ("");
+    gtk_entry_set_text (GTK_ENTRY(frames_entry), frames);
+    g_free (frames);
+    gtk_box_pack_start (GTK_BOX(frames_box), 
+            gtk_label_new ("Images (like 0,3-5,10-):"), FALSE, FALSE, 0);
+    gtk_box_pack_start (GTK_BOX(frames_box), frames_entry, TRUE, TRUE, 0);
+    gtk_widget_show_all (frames_box);
+    gtk_file_chooser_set_extra_widget (GTK_FILE_CHOOSER(dialog), frames_box);
+
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER(dialog));
+        if (export_gif_frames (interface->gif_context, interface->gif_no,
+                    gtk_entry_get_text (GTK_ENTRY(frames_entry)),
+                    filename) < 0) {
+            put_warning ("Can not export images to '%s'", filename);
+        }
+        g_free (filename);
+    }
+    gtk_widget_destroy (dialog);
+}
+
 static void
 on_menu_quit (GtkWidget *widget,
         GtkGifInterace *interface)
@@ -733,6 +1457,20 @@ on_menu_toggle_slideshow(GtkWidget *widget,
     switch_running_mode (interface);
 }
 
+static void
+on_menu_toggle_hud(GtkWidget *widget,
+        GtkGifInterace *interface)
+{
+    switch_hud (interface);
+}
+
+static void
+on_menu_toggle_shuffle(GtkWidget *widget,
+        GtkGifInterace *interface)
+{
+    switch_shuffle (interface);
+}
+
 static void
 on_menu_about (GtkWidget *widget,
         GtkGifInterace *interface)
@@ -800,6 +1538,7 @@ build_main_menu (GtkWidget *window,
     //File submenu
     PUT_HEAD_MENU_MNEMONIC ("_File");
     PUT_MENU_FROM_STOCK_CALLBACK (GTK_STOCK_OPEN, on_menu_open);
+    PUT_MENU_MNEMONIC_CALLBACK ("_Export images...", on_menu_export);
     PUT_MENU_SEPARATOR;
     PUT_MENU_FROM_STOCK_CALLBACK (GTK_STOCK_QUIT, on_menu_quit);
     
@@ -814,6 +1553,8 @@ build_main_menu (GtkWidget *window,
     PUT_MENU_MNEMONIC_CALLBACK ("P_revious file",on_menu_previous_file);
     PUT_MENU_SEPARATOR;
     PUT_MENU_MNEMONIC_CALLBACK ("_Toggle slideshow",on_menu_toggle_slideshow);
+    PUT_MENU_MNEMONIC_CALLBACK ("_Shuffle without repeats",on_menu_toggle_shuffle);
+    PUT_MENU_MNEMONIC_CALLBACK ("Performance _info",on_menu_toggle_hud);
 
     //Help menu
     PUT_HEAD_MENU_MNEMONIC ("_Help");
@@ -874,7 +1615,7 @@ gtkgif_init (void *data, PContext c)
 {
     GtkGifInterace *interface = NULL;
     GtkWidget *window, *drawing_area, *control_area, 
-            *main_box, *menu_bar, *toolbar;
+            *main_box, *menu_bar, *toolbar, *scrolled_window;
     gtkgif_init_data *gg_id = (gtkgif_init_data *) data;
     cairo_t *cr_pixmap;
     int error;
@@ -939,7 +1680,25 @@ gtkgif_init (void *data, PContext c)
 
     gtk_box_pack_start (GTK_BOX(main_box), menu_bar, FALSE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX(main_box), toolbar, FALSE, FALSE, 0);
-    gtk_box_pack_start (GTK_BOX(main_box), drawing_area, TRUE, TRUE, 0);
+    interface->gtk.scrolled_window = scrolled_window =
+            gtk_scrolled_window_new (NULL, NULL);
+    gtk_scrolled_window_set_policy (GTK_SCROLLED_WINDOW (scrolled_window),
+            GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_add_with_viewport (
+            GTK_SCROLLED_WINDOW (scrolled_window), drawing_area);
+    gtk_viewport_set_shadow_type (
+            GTK_VIEWPORT (gtk_bin_get_child (GTK_BIN (scrolled_window))),
+            GTK_SHADOW_NONE);
+    gtk_box_pack_start (GTK_BOX(main_box), scrolled_window, TRUE, TRUE, 0);
+
+    interface->gtk.scrub = gtk_hscale_new_with_range (0, 1, 1);
+    gtk_scale_set_draw_value (GTK_SCALE (interface->gtk.scrub), FALSE);
+    gtk_widget_set_can_focus (interface->gtk.scrub, FALSE);
+    gtk_widget_set_sensitive (interface->gtk.scrub, FALSE);
+    g_signal_connect (interface->gtk.scrub, "value-changed",
+            G_CALLBACK (on_scrub_changed), interface);
+    gtk_box_pack_start (GTK_BOX(main_box), interface->gtk.scrub, 
+            FALSE, FALSE, 0);
     gtk_box_pack_start (GTK_BOX(main_box), control_area, FALSE, FALSE, 0);
 
     g_signal_connect (window, "delete-event",
@@ -951,6 +1710,12 @@ gtkgif_init (void *data, PContext c)
     g_signal_connect (window, "key-press-event",
             G_CALLBACK (on_window_key_press_event), interface);
 
+    g_signal_connect (gtk_scrolled_window_get_hadjustment (
+                GTK_SCROLLED_WINDOW (scrolled_window)), "value-changed",
+            G_CALLBACK (on_scroll), interface);
+    g_signal_connect (gtk_scrolled_window_get_vadjustment (
+                GTK_SCROLLED_WINDOW (scrolled_window)), "value-changed",
+            G_CALLBACK (on_scroll), interface);
     g_signal_connect (drawing_area, "expose-event",
             G_CALLBACK (on_expose_event), interface);
     g_signal_connect (drawing_area, "key-press-event",
@@ -965,10 +1730,9 @@ gtkgif_init (void *data, PContext c)
              | GDK_KEY_PRESS_MASK); 
     gtk_widget_show_all(window);
 
-    interface->pixmap = gdk_pixmap_new(window->window, MAX_WIDTH, MAX_HEIGHT, -1);
-    interface->drawing_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-            MAX_WIDTH, MAX_HEIGHT);
     interface->mode = GIF_GTK_COMMON_MODE;
+    set_context_snapshoot_format (c, GIF_SNAPSHOOT_INDEXED);
+    set_context_reload_func (c, on_gif_reloaded, interface);
 
     update_image (interface, TRUE);
     //get_random_image (interface, TRUE);
@@ -0,0 +1,317 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lzwcheck.h"
+#include "giflzw.h"
+
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+//Decodings of each gif for benchmark are repeated at least so long
+#define LZWCHECK_MIN_TIME (G_USEC_PER_SEC / 4)
+
+typedef int (*SlurpFunc) (GifFileType *gifFile);
+
+static int
+check_slurp_parallel (GifFileType *gifFile)
+{
+    return lzw_slurp_threads (gifFile, 0);
+}
+
+static GifFileType *
+check_open (const char *filename, SlurpFunc slurp)
+{
+    GifFileType *gifFile;
+    int error;
+
+    gifFile = DGifOpenFileName (filename, &error);
+    if (gifFile == NULL) {
+        put_warning ("Can not open '%s'. %s", filename, 
+                GifErrorString (error));
+        return NULL;
+    }
+    if (slurp (gifFile) == GIF_ERROR) {
+        put_warning ("Can not decode '%s'. %s", filename, 
+                GifErrorString (gifFile->Error));
+        DGifCloseFile (gifFile);
+        return NULL;
+    }
+    return gifFile;
+}
+
+static size_t
+check_pixels (const GifFileType *gifFile)
+{
+    size_t pixels = 0;
+    int i;
+
+    for (i = 0; i < gifFile->ImageCount; ++i) {
+        pixels += (size_t) gifFile->SavedImages[i].ImageDesc.Width *
+            gifFile->SavedImages[i].ImageDesc.Height;
+    }
+    return pixels;
+}
+
+/**
+ *  Decodes file repeatedly, returns megapixels per second.
+ */
+static double
+check_throughput (const char *filename, SlurpFunc slurp, size_t pixels)
+{
+    GifFileType *gifFile;
+    gint64 begin, elapsed;
+    int runs = 0;
+
+    begin = g_get_monotonic_time ();
+    do {
+        gifFile = check_open (filename, slurp);
+        if (gifFile == NULL) {
+            return 0;
+        }
+        DGifCloseFile (gifFile);
+        ++runs;
+        elapsed = g_get_monotonic_time () - begin;
+    } while (elapsed < LZWCHECK_MIN_TIME);
+
+    return (double) pixels * runs / MAX (elapsed, 1);
+}
+
+static gboolean
+check_raster (const SavedImage *reference, const SavedImage *image)
+{
+    const GifImageDesc *desc = &reference->ImageDesc;
+    size_t size = (size_t) desc->Width * desc->Height;
+#if GIFLIB_MAJOR == 5 && GIFLIB_MINOR < 1
+    //Older DGifSlurp leaves interlaced rows in file order
+    static const int start[] = {0, 4, 2, 1}, step[] = {8, 8, 4, 2};
+    const byte *row = reference->RasterBits;
+    int pass, y;
+
+    if (desc->Interlace) {
+        for (pass = 0; pass < 4; ++pass) {
+            for (y = start[pass]; y < desc->Height; y += step[pass]) {
+                if (memcmp (image->RasterBits + (size_t) y * desc->Width,
+                            row, desc->Width) != 0) {
+                    return FALSE;
+                }
+                row += desc->Width;
+            }
+        }
+        return TRUE;
+    }
+#endif
+    return memcmp (reference->RasterBits, image->RasterBits, size) == 0;
+}
+
+/**
+ *  Checks one file, returns TRUE if decoders agree.
+ */
+static gboolean
+check_file (const char *filename, const char *name)
+{
+    GifFileType *reference, *gifFile;
+    double giflib_speed, builtin_speed, parallel_speed;
+    size_t pixels;
+    int i, mismatch = -1;
+
+    reference = check_open (filename, DGifSlurp);
+    gifFile = check_open (filename, check_slurp_parallel);
+    if (reference == NULL || gifFile == NULL) {
+        if (reference != NULL) {
+            DGifCloseFile (reference);
+        }
+        if (gifFile != NULL) {
+            DGifCloseFile (gifFile);
+        }
+        //Both must fail on broken file
+        printf ("%s: %s\n", name, reference == gifFile ? 
+                "not decoded by both" : "MISMATCH, decoded by one only");
+        return reference == gifFile;
+    }
+
+    if (reference->ImageCount != gifFile->ImageCount) {
+        mismatch = MIN (reference->ImageCount, gifFile->ImageCount);
+    }
+    for (i = 0; i < reference->ImageCount && mismatch < 0; ++i) {
+        if (!check_raster (reference->SavedImages + i, 
+                    gifFile->SavedImages + i)) {
+            mismatch = i;
+        }
+    }
+    pixels = check_pixels (reference);
+    DGifCloseFile (reference);
+    DGifCloseFile (gifFile);
+
+    if (mismatch >= 0) {
+        printf ("%s: MISMATCH at image %d\n", name, mismatch);
+        return FALSE;
+    }
+    giflib_speed = check_throughput (filename, DGifSlurp, pixels);
+    builtin_speed = check_throughput (filename, lzw_slurp, pixels);
+    parallel_speed = check_throughput (filename, check_slurp_parallel,
+            pixels);
+    printf ("%s: %d images, %.2f Mpx, giflib %.1f Mpx/s, "
+            "built-in %.1f Mpx/s x%.2f, parallel %.1f Mpx/s x%.2f\n", 
+            name, i, pixels / 1e6, giflib_speed, 
+            builtin_speed, builtin_speed / MAX (giflib_speed, 1e-9),
+            parallel_speed, parallel_speed / MAX (giflib_speed, 1e-9));
+    return TRUE;
+}
+
+/**
+ *  Synthetic gif with single image. Patterns give both short and
+ *  long strings, sizes and code sizes vary, every second is interlaced.
+ */
+static GByteArray *
+check_synthetic (int n, byte **raster, int *width, int *height)
+{
+    static const int sizes[][2] = {
+        {1, 1}, {7, 3}, {64, 64}, {333, 17}, {640, 480}, {1024, 768}};
+    static const int start[] = {0, 4, 2, 1}, step[] = {8, 8, 4, 2};
+    GByteArray *gif;
+    GRand *rand;
+    byte *rows, header[13] = "GIF89a", descriptor[10] = {0x2c}, rgb[3];
+    int bits = 1 + n % 8, w, h, x, y, pass, k, pattern = n % 4;
+    gboolean interlace = n % 2;
+    size_t i;
+
+    w = sizes[n % G_N_ELEMENTS (sizes)][0];
+    h = sizes[n % G_N_ELEMENTS (sizes)][1];
+    *width = w;
+    *height = h;
+    *raster = malloc ((size_t) w * h);
+    rows = malloc ((size_t) w * h);
+    if (*raster == NULL || rows == NULL) {
+        put_error (1, "Can not allocate memory for synthetic gif");
+    }
+
+    rand = g_rand_new_with_seed (n);
+    for (y = 0; y < h; ++y) {
+        for (x = 0; x < w; ++x) {
+            i = (size_t) y * w + x;
+            switch (pattern) {
+            case 0:     //Noise
+                (*raster)[i] = g_rand_int (rand);
+                break;
+            case 1:     //Gradient
+                (*raster)[i] = (x + y) / 8;
+                break;
+            case 2:     //Flat with rare spots
+                (*raster)[i] = g_rand_int_range (rand, 0, 64) == 0 ?
+                    g_rand_int (rand) : 0;
+                break;
+            default:    //Stripes
+                (*raster)[i] = (x / 3) ^ (y / 5);
+                break;
+            }
+            (*raster)[i] &= (1 << bits) - 1;
+        }
+    }
+    g_rand_free (rand);
+
+    //Rows go to file in interlace order
+    if (interlace) {
+        for (pass = 0, k = 0; pass < 4; ++pass) {
+            for (y = start[pass]; y < h; y += step[pass], ++k) {
+                memcpy (rows + (size_t) k * w, *raster + (size_t) y * w, w);
+            }
+        }
+    } else {
+        memcpy (rows, *raster, (size_t) w * h);
+    }
+
+    gif = g_byte_array_new ();
+    header[6] = w & 0xff;
+    header[7] = w >> 8;
+    header[8] = h & 0xff;
+    header[9] = h >> 8;
+    header[10] = 0x80 | (bits - 1);
+    g_byte_array_append (gif, header, sizeof (header));
+    for (k = 0; k < 1 << bits; ++k) {
+        rgb[0] = rgb[1] = rgb[2] = k * 255 / MAX ((1 << bits) - 1, 1);
+        g_byte_array_append (gif, rgb, sizeof (rgb));
+    }
+    descriptor[5] = w & 0xff;
+    descriptor[6] = w >> 8;
+    descriptor[7] = h & 0xff;
+    descriptor[8] = h >> 8;
+    descriptor[9] = interlace ? 0x40 : 0;
+    g_byte_array_append (gif, descriptor, sizeof (descriptor));
+    lzw_encode (rows, (size_t) w * h, MAX (bits, 2), gif);
+    g_byte_array_append (gif, (const guint8 *) ";", 1);
+
+    free (rows);
+    return gif;
+}
+
+int
+check_decoder (PContext c, int synthetic_count)
+{
+    GifFileType *gifFile;
+    GByteArray *gif;
+    const char *filename;
+    char *path, *name;
+    byte *raster;
+    int i, width, height, fd, mismatches = 0;
+
+    for (i = 0; i < get_gif_count (c); ++i) {
+        filename = get_gif_filename (c, i);
+        if (filename != NULL && !check_file (filename, filename)) {
+            ++mismatches;
+        }
+    }
+
+    for (i = 0; i < synthetic_count; ++i) {
+        gif = check_synthetic (i, &raster, &width, &height);
+        fd = g_file_open_tmp ("gifseeker-check-XXXXXX.gif", &path, NULL);
+        if (fd < 0 || write (fd, gif->data, gif->len) != (ssize_t) gif->len) {
+            put_warning ("Can not write synthetic gif");
+            ++mismatches;
+        } else {
+            name = g_strdup_printf ("synthetic %d (%dx%d)", i, width, height);
+            if (!check_file (path, name)) {
+                ++mismatches;
+            } else {
+                //Built-in decoder must also give the source raster
+                gifFile = check_open (path, lzw_slurp);
+                if (gifFile == NULL || memcmp (raster, 
+                            gifFile->SavedImages[0].RasterBits,
+                            (size_t) width * height) != 0) {
+                    printf ("%s: MISMATCH with source raster\n", name);
+                    ++mismatches;
+                }
+                if (gifFile != NULL) {
+                    DGifCloseFile (gifFile);
+                }
+            }
+            g_free (name);
+        }
+        if (fd >= 0) {
+            close (fd);
+            g_unlink (path);
+            g_free (path);
+        }
+        g_byte_array_free (gif, TRUE);
+        free (raster);
+    }
+
+    printf ("%d mismatches\n", mismatches);
+    return mismatches;
+}
@@ -0,0 +1,37 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LZWCHECK_H
+#define LZWCHECK_H
+
+#include "gifseeker.h"
+
+/**
+ *  Verification and benchmark of built-in LZW decoder.
+ *  Every gif of context and synthetic gifs are decoded by giflib and
+ *  by lzw_slurp, rasters must be equal byte to byte. Throughput of both
+ *  is printed. Returns number of mismatched gifs.
+ */
+
+#define LZWCHECK_SYNTHETIC_COUNT 24
+
+int check_decoder (PContext c, int synthetic_count);
+
+#endif /*LZWCHECK_H*/
@@ -19,6 +19,13 @@
 
 #include "gifseeker.h"
 #include "gtk_interface.h"
+#include "trace.h"
+#include "export.h"
+#include "server.h"
+#include "lzwcheck.h"
+#include "video.h"
+#include "scheduler.h"
+#include "metrics.h"
 #include "../config.h"
 
 #include <gtk/gtk.h>
@@ -32,52 +39,120 @@ description =
 "Use PageUp to switch on first image of next gif.\n"
 "Use PageDown to switch on first image of preveous gif.\n"
 "Use key R to switch slidshow mode on/off.\n"
+"Use key I to show/hide performance info.\n"
+"Use key S to switch shuffle without repeats on/off.\n"
+"Drag slider under image to scrub through images of gif.\n"
 "Use Esc to quit.\n"
 "\n"
+"Use --export to copy images of gif to new file without opening\n"
+"window. Compressed data of images is copied as is.\n"
+"Use --serve to serve images to local clients without window.\n"
+"Use --check-decoder to compare built-in LZW decoder with giflib\n"
+"on given files and synthetic gifs and to measure its speed.\n"
+"Use --stats to print memory taken by decoded gifs.\n"
+"Use --export-y4m or --export-raw to stream all gifs as video to file\n"
+"or to standard output (-) for encoders like ffmpeg.\n"
+"Use --spill-size to keep images dropped from memory in cache file,\n"
+"it is reused while gif files are not changed.\n"
+"Use --watch to reload gif files, when they are changed.\n"
+"Use - as file to view gif from standard input, images are shown\n"
+"while they arrive.\n"
+"Give tar or zip archive to view its gifs, or archive:member to view\n"
+"one of them.\n"
+"Use --threads to set number of decoding threads, images on screen\n"
+"are decoded before neighbor images and background work.\n"
+"Use --idle-decode to decode gifs in main loop in short slices instead\n"
+"of worker threads, window stays responsive meanwhile.\n"
+"Use --metrics to serve metrics in Prometheus text format over HTTP\n"
+"on UNIX socket or, if port number is given, on loopback port.\n"
+"\n"
 "Bug report: " PACKAGE_BUGREPORT "\n"
 "Thank you for your interest.\n";
 
-int interface_runner (PContext c,
-        int *argc, char ***argv, void *user_data)
+static char *trace_filename = NULL;
+static char *export_filename = NULL;
+static char *export_frames = NULL;
+static char *serve_path = NULL;
+static char *y4m_filename = NULL;
+static char *raw_filename = NULL;
+static char *metrics_address = NULL;
+static int fps = VIDEO_DEFAULT_FPS;
+static int spill_size = 0;
+static int threads = 0;
+static gboolean watch = FALSE;
+static gboolean idle_decode = FALSE;
+static gboolean version = FALSE;
+static gboolean check_lzw = FALSE;
+static gboolean stats = FALSE;
+static int exit_code = 0;
+
+static GOptionEntry option_entries[] = {
+    //{"file", 'f', 0, G_OPTION_ARG_FILENAME, &filename, "Gif file to open", "FILE"},
+    {"version", 'V', 0, G_OPTION_ARG_NONE, &version, "Show version", NULL},
+    {"trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_filename,
+        "Save trace of session in Chrome trace-event format", "FILE"},
+    {"export", 'e', 0, G_OPTION_ARG_FILENAME, &export_filename,
+        "Copy images of first gif to new gif without window", "FILE"},
+    {"frames", 'f', 0, G_OPTION_ARG_STRING, &export_frames,
+        "Images to export, like 0,3-5,10- (default is all)", "LIST"},
+    {"serve", 0, 0, G_OPTION_ARG_FILENAME, &serve_path,
+        "Serve images of gifs to local clients on UNIX socket", "SOCKET"},
+    {"check-decoder", 0, 0, G_OPTION_ARG_NONE, &check_lzw,
+        "Compare built-in LZW decoder with giflib and benchmark both", NULL},
+    {"stats", 0, 0, G_OPTION_ARG_NONE, &stats,
+        "Decode gifs without window and print memory they take", NULL},
+    {"export-y4m", 0, 0, G_OPTION_ARG_FILENAME, &y4m_filename,
+        "Stream gifs as YUV4MPEG2 video without window (- is stdout)", "FILE"},
+    {"export-raw", 0, 0, G_OPTION_ARG_FILENAME, &raw_filename,
+        "Stream gifs as raw bgr0 video without window (- is stdout)", "FILE"},
+    {"fps", 0, 0, G_OPTION_ARG_INT, &fps,
+        "Frame rate of exported video (default is 25)", "N"},
+    {"spill-size", 0, 0, G_OPTION_ARG_INT, &spill_size,
+        "Keep images dropped from memory in cache file of this size", "MIB"},
+    {"watch", 'w', 0, G_OPTION_ARG_NONE, &watch,
+        "Reload gif files, when they are changed", NULL},
+    {"threads", 'j', 0, G_OPTION_ARG_INT, &threads,
+        "Number of decoding threads (default is processors + 1)", "N"},
+    {"idle-decode", 0, 0, G_OPTION_ARG_NONE, &idle_decode,
+        "Decode gifs in main loop slices instead of threads", NULL},
+    {"metrics", 0, 0, G_OPTION_ARG_FILENAME, &metrics_address,
+        "Serve metrics on UNIX socket or loopback TCP port", "ADDRESS"},
+    { NULL }
+};
+
+static void
+load_files (PContext c, int argc, char **argv)
 {
-    gboolean version = FALSE;
-    GOptionContext *option_context;
-    GError *g_error = NULL;
-    GOptionEntry option_entries[] = {
-        //{"file", 'f', 0, G_OPTION_ARG_FILENAME, &filename, "Gif file to open", "FILE"},
-        {"version", 'V', 0, G_OPTION_ARG_NONE, &version, "Show version", NULL},
-        { NULL }
-    };
     int gif, error = 0, i;
+    char *spill_filename;
 
-    option_context = g_option_context_new("[FILE...] - " 
-            "take random image from gif files.");
-    g_option_context_set_description (option_context, description);
-    g_option_context_add_main_entries (option_context,
-            option_entries, "Application options");
-    g_option_context_add_group (option_context, gtk_get_option_group (TRUE));
-
-    if (!g_option_context_parse (option_context, 
-                argc, argv, &g_error))
-    {
-        put_error(1, "option parsing failed: %s\n\n%s", 
-                g_error->message,
-                g_option_context_get_help(option_context, TRUE, NULL)); 
+    set_context_idle_decode (c, idle_decode);
+    if (metrics_address != NULL) {
+        metrics_serve (c, metrics_address);
     }
-    
-    if (version) {
-        printf ("%s\n",PACKAGE_STRING);
+    if (spill_size > 0) {
+        spill_filename = g_build_filename (g_get_user_cache_dir (), 
+                PACKAGE, "frames.spill", NULL);
+        set_context_spill (c, spill_filename, (size_t) spill_size << 20);
+        g_free (spill_filename);
     }
 
-    for (i=1; i < *argc; ++i) {
-        gif = read_gif (c, (*argv)[i], &error);
+    for (i=1; i < argc; ++i) {
+        gif = read_gif (c, argv[i], &error);
         if (!gifptr_correct(gif,c)) {
             put_warning ("Invalid filename '%s'. %s", 
-                    (*argv)[i], GifErrorString(error));
+                    argv[i], GifErrorString(error));
         }
     }
-    g_option_context_free (option_context);
+    if (watch) {
+        watch_context_files (c);
+    }
+}
 
+int interface_runner (PContext c,
+        int *argc, char ***argv, void *user_data)
+{
+    load_files (c, *argc, *argv);
     return 0;
 }
 
@@ -86,20 +161,115 @@ const char * get_help_string (PContext c, void *user_data)
     return description;
 }
 
+/**
+ *  Runs commands without gui.
+ */
+static void
+headless_init (void *data, PContext c)
+{
+    gtkgif_init_data *init_data = (gtkgif_init_data *) data;
+    int gif;
+
+    load_files (c, *init_data->argc, *init_data->argv);
+
+    if (export_filename != NULL) {
+        if (get_gif_count (c) == 0) {
+            put_warning ("There is no gif to export");
+            exit_code = EXIT_FALIURE;
+        } else if (export_gif_frames (c, 0, export_frames,
+                    export_filename) < 0) {
+            exit_code = EXIT_FALIURE;
+        }
+    }
+    if (check_lzw && exit_code == 0) {
+        if (check_decoder (c, LZWCHECK_SYNTHETIC_COUNT) != 0) {
+            exit_code = EXIT_FALIURE;
+        }
+    }
+    if (stats && exit_code == 0) {
+        for (gif = 0; gif < get_gif_count (c); ++gif) {
+            get_gif_image_count (c, gif);
+        }
+        print_context_memory_stats (c, stdout);
+    }
+    if (y4m_filename != NULL && exit_code == 0) {
+        if (export_video (c, y4m_filename, VIDEO_Y4M, fps) < 0) {
+            exit_code = EXIT_FALIURE;
+        }
+    }
+    if (raw_filename != NULL && exit_code == 0) {
+        if (export_video (c, raw_filename, VIDEO_RAW, fps) < 0) {
+            exit_code = EXIT_FALIURE;
+        }
+    }
+    if (serve_path != NULL && exit_code == 0) {
+        //More images fit into cache
+        set_context_snapshoot_format (c, GIF_SNAPSHOOT_INDEXED);
+        if (serve (c, serve_path) < 0) {
+            exit_code = EXIT_FALIURE;
+        }
+    }
+}
+
 int
 main (int argc, char *argv[])
 {
     PContext c;
-    int error;
+    GOptionContext *option_context;
+    GError *g_error = NULL;
     gtkgif_init_data gtkgif_data;
 
+    option_context = g_option_context_new("[FILE...] - " 
+            "take random image from gif files.");
+    g_option_context_set_description (option_context, description);
+    g_option_context_add_main_entries (option_context,
+            option_entries, "Application options");
+    //Display is opened by gtkgif_init, headless mode does not need it
+    g_option_context_add_group (option_context, gtk_get_option_group (FALSE));
+
+    if (!g_option_context_parse (option_context, 
+                &argc, &argv, &g_error))
+    {
+        put_error(1, "option parsing failed: %s\n\n%s", 
+                g_error->message,
+                g_option_context_get_help(option_context, TRUE, NULL)); 
+    }
+    g_option_context_free (option_context);
+    
+    if (version) {
+        printf ("%s\n",PACKAGE_STRING);
+    }
+    if (threads < 0) {
+        put_warning ("Invalid number of threads %d", threads);
+        threads = 0;
+    }
+    scheduler_set_default_threads (threads);
+
     gtkgif_data.argc = &argc;
     gtkgif_data.argv = &argv;
     gtkgif_data.runner = interface_runner;
     gtkgif_data.get_help = get_help_string;
+    gtkgif_data.user_data = NULL;
 
-    c = create_context(gtkgif_init, &gtkgif_data);
+    if (export_filename != NULL || serve_path != NULL || check_lzw ||
+            stats || y4m_filename != NULL || raw_filename != NULL) {
+        c = create_context(headless_init, &gtkgif_data);
+    } else {
+        c = create_context(gtkgif_init, &gtkgif_data);
+    }
     
+    metrics_stop ();
     free_context (c);
-    return 0;
+
+    if (trace_filename != NULL) {
+        trace_dump (trace_filename);
+        g_free (trace_filename);
+    }
+    g_free (export_filename);
+    g_free (export_frames);
+    g_free (serve_path);
+    g_free (y4m_filename);
+    g_free (raw_filename);
+    g_free (metrics_address);
+    return exit_code;
 }
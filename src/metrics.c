@@ -0,0 +1,449 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "metrics.h"
+#include "scheduler.h"
+#include "server.h"
+#include "trace.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#define METRICS_BUCKETS 15
+#define METRICS_MAX_THREADS 2
+//Header lines of request, which are read at most
+#define METRICS_MAX_HEADERS 100
+
+typedef struct MetricsHistogramData {
+    volatile gsize buckets[METRICS_BUCKETS + 1];    //Last is above bounds
+    volatile gsize sum;     //Microseconds
+} MetricsHistogramData;
+
+typedef struct MetricsHistogramInfo {
+    const char *name;
+    const char *help;
+    const char *labels;     //NULL if there are no
+} MetricsHistogramInfo;
+
+typedef struct MetricsServer {
+    PContext c;
+    GSocketService *service;
+    GCancellable *cancellable;  //Cancelled on stop to wake requests up
+    char *socket_path;      //NULL for TCP port
+    struct stat socket_stat;    //Of socket this server created
+    GMutex lock;
+    GCond idle;             //Signaled when last request is answered
+    int requests;
+} MetricsServer;
+
+//Upper bounds of buckets in microseconds and in seconds for output
+static const gint64 metrics_bounds[METRICS_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000
+};
+static const char *metrics_bound_names[METRICS_BUCKETS] = {
+    "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01",
+    "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5"
+};
+
+//In order of MetricsHistogram, histograms of one name go together
+static const MetricsHistogramInfo metrics_histogram_info[METRICS_HISTOGRAMS] = {
+    {"gifseeker_decode_seconds", "Time of gif decoding.", NULL},
+    {"gifseeker_convert_seconds", 
+        "Time of image conversion to snapshoot.", NULL},
+    {"gifseeker_scheduler_wait_seconds", 
+        "Time tasks wait in scheduler queues.", "class=\"visible\""},
+    {"gifseeker_scheduler_wait_seconds", NULL, "class=\"neighbor\""},
+    {"gifseeker_scheduler_wait_seconds", NULL, "class=\"thumbnail\""},
+    {"gifseeker_scheduler_wait_seconds", NULL, "class=\"index\""},
+    {"gifseeker_slideshow_lateness_seconds", 
+        "Delay of slideshow timer.", NULL}
+};
+
+static volatile gsize metrics_counters[METRICS_COUNTERS];
+static MetricsHistogramData metrics_histograms[METRICS_HISTOGRAMS];
+static MetricsServer *metrics_server = NULL;
+
+void
+metrics_count (MetricsCounter counter)
+{
+    g_atomic_pointer_add (&metrics_counters[counter], 1);
+}
+
+void
+metrics_observe (MetricsHistogram histogram, gint64 usec)
+{
+    MetricsHistogramData *data = &metrics_histograms[histogram];
+    int i = 0;
+
+    usec = MAX (usec, 0);
+    while (i < METRICS_BUCKETS && usec > metrics_bounds[i]) {
+        ++i;
+    }
+    g_atomic_pointer_add (&data->buckets[i], 1);
+    g_atomic_pointer_add (&data->sum, (gssize) usec);
+}
+
+static void
+metrics_put_header (GString *out, const char *name, const char *help,
+        const char *type)
+{
+    g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n",
+            name, help, name, type);
+}
+
+static void
+metrics_put_value (GString *out, const char *name, const char *labels,
+        guint64 value)
+{
+    if (labels != NULL) {
+        g_string_append_printf (out, "%s{%s} %" G_GUINT64_FORMAT "\n",
+                name, labels, value);
+    } else {
+        g_string_append_printf (out, "%s %" G_GUINT64_FORMAT "\n",
+                name, value);
+    }
+}
+
+static void
+metrics_put_metric (GString *out, const char *name, const char *help,
+        const char *type, guint64 value)
+{
+    metrics_put_header (out, name, help, type);
+    metrics_put_value (out, name, NULL, value);
+}
+
+static void
+metrics_put_histogram (GString *out, MetricsHistogram histogram)
+{
+    const MetricsHistogramInfo *info = &metrics_histogram_info[histogram];
+    MetricsHistogramData *data = &metrics_histograms[histogram];
+    char sum[G_ASCII_DTOSTR_BUF_SIZE];
+    const char *separator = info->labels != NULL ? "," : "";
+    const char *labels = info->labels != NULL ? info->labels : "";
+    guint64 count = 0;
+    int i;
+
+    if (info->help != NULL) {
+        metrics_put_header (out, info->name, info->help, "histogram");
+    }
+    //Buckets are counted apart, they are summed up for output
+    for (i = 0; i <= METRICS_BUCKETS; ++i) {
+        count += (gsize) g_atomic_pointer_get (&data->buckets[i]);
+        g_string_append_printf (out, 
+                "%s_bucket{%s%sle=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                info->name, labels, separator, 
+                i < METRICS_BUCKETS ? metrics_bound_names[i] : "+Inf",
+                count);
+    }
+    //Locale of window may use comma in numbers
+    g_ascii_dtostr (sum, sizeof (sum), 
+            (gsize) g_atomic_pointer_get (&data->sum) / 1e6);
+    if (info->labels != NULL) {
+        g_string_append_printf (out, "%s_sum{%s} %s\n"
+                "%s_count{%s} %" G_GUINT64_FORMAT "\n", 
+                info->name, labels, sum, info->name, labels, count);
+    } else {
+        g_string_append_printf (out, "%s_sum %s\n"
+                "%s_count %" G_GUINT64_FORMAT "\n",
+                info->name, sum, info->name, count);
+    }
+}
+
+/**
+ *  Counts open file descriptors of process, -1 if it is not known.
+ */
+static int
+metrics_open_files (void)
+{
+    GDir *dir;
+    int count = 0;
+
+    dir = g_dir_open ("/proc/self/fd", 0, NULL);
+    if (dir == NULL) {
+        return -1;
+    }
+    while (g_dir_read_name (dir) != NULL) {
+        ++count;
+    }
+    g_dir_close (dir);
+    //Directory being read takes one
+    return count - 1;
+}
+
+char *
+metrics_format (PContext c)
+{
+    GString *out = g_string_new (NULL);
+    GifContextStats stats;
+    GifMemoryStats memory;
+    Scheduler *scheduler = scheduler_get_default ();
+    const char *name;
+    int i, open_files;
+    TRACE_BEGIN (stamp);
+
+    metrics_put_metric (out, "gifseeker_frames_served_total",
+            "Images sent to clients of frame server.", "counter",
+            (gsize) g_atomic_pointer_get (
+                &metrics_counters[METRICS_FRAMES_SERVED]));
+    metrics_put_metric (out, "gifseeker_frames_shown_total",
+            "Images painted in window.", "counter",
+            (gsize) g_atomic_pointer_get (
+                &metrics_counters[METRICS_FRAMES_SHOWN]));
+
+    get_context_stats (c, &stats);
+    metrics_put_metric (out, "gifseeker_snapshoots_total",
+            "Snapshoots made.", "counter", stats.snapshoots);
+    name = "gifseeker_cache_hits_total";
+    metrics_put_header (out, name, "Snapshoots found in cache by tier.",
+            "counter");
+    metrics_put_value (out, name, "tier=\"hot\"", stats.cache_hits);
+    metrics_put_value (out, name, "tier=\"cold\"", stats.cold_hits);
+    metrics_put_value (out, name, "tier=\"spill\"", stats.spill_hits);
+    metrics_put_metric (out, "gifseeker_cache_misses_total",
+            "Snapshoots converted from decoded gif.", "counter",
+            stats.cache_misses);
+    metrics_put_metric (out, "gifseeker_cache_evictions_total",
+            "Snapshoots dropped from compressed cache.", "counter",
+            stats.evictions);
+    metrics_put_metric (out, "gifseeker_shared_snapshoots_total",
+            "Images equal to converted ones, which were not converted.",
+            "counter", stats.shared);
+    metrics_put_metric (out, "gifseeker_shared_cache_bytes",
+            "Bytes of cached snapshoots, which are not held twice, as "
+            "equal images share them.", "gauge", stats.shared_bytes);
+    metrics_put_metric (out, "gifseeker_decodes_total",
+            "Gif decodings.", "counter", stats.decodes);
+    metrics_put_metric (out, "gifseeker_reloads_total",
+            "Gifs read again after change of file.", "counter", 
+            stats.reloads);
+
+    get_context_memory_stats (c, &memory);
+    metrics_put_metric (out, "gifseeker_gifs", "Gifs in context.", 
+            "gauge", memory.gif_count);
+    name = "gifseeker_memory_bytes";
+    metrics_put_header (out, name, "Memory held by context by category.",
+            "gauge");
+    metrics_put_value (out, name, "category=\"rasters\"", 
+            memory.total.rasters);
+    metrics_put_value (out, name, "category=\"structures\"",
+            memory.total.structures);
+    metrics_put_value (out, name, "category=\"palette\"", 
+            memory.total.palette);
+    metrics_put_value (out, name, "category=\"cache\"", 
+            memory.total.cache);
+    metrics_put_value (out, name, "category=\"packed_cache\"",
+            memory.total.packed_cache);
+    metrics_put_value (out, name, "category=\"context\"", memory.context);
+    clear_context_memory_stats (&memory);
+
+    open_files = metrics_open_files ();
+    if (open_files >= 0) {
+        metrics_put_metric (out, "gifseeker_open_files",
+                "Open file descriptors of process.", "gauge", open_files);
+    }
+    metrics_put_metric (out, "gifseeker_scheduler_threads",
+            "Worker threads of scheduler.", "gauge",
+            scheduler_get_threads (scheduler));
+    metrics_put_metric (out, "gifseeker_scheduler_queued_tasks",
+            "Tasks waiting in scheduler queues.", "gauge",
+            scheduler_get_queued (scheduler));
+
+    for (i = 0; i < METRICS_HISTOGRAMS; ++i) {
+        metrics_put_histogram (out, i);
+    }
+    TRACE_END (stamp, "metrics_format");
+    return g_string_free (out, FALSE);
+}
+
+/**
+ *  Request is counted in main loop thread before it is dispatched,
+ *  so metrics_stop does not free server under a thread yet to start.
+ */
+static gboolean
+on_metrics_incoming (GSocketService *service, 
+        GSocketConnection *connection, GObject *source_object,
+        MetricsServer *server)
+{
+    g_mutex_lock (&server->lock);
+    ++server->requests;
+    g_mutex_unlock (&server->lock);
+    return FALSE;
+}
+
+/**
+ *  Answers one HTTP request. Any GET of / or /metrics gets metrics,
+ *  headers of request are skipped.
+ */
+static gboolean
+on_metrics_run (GThreadedSocketService *service, 
+        GSocketConnection *connection, GObject *source_object,
+        MetricsServer *server)
+{
+    GDataInputStream *input;
+    GOutputStream *output;
+    char *line, *body, *reply;
+    gboolean found = FALSE;
+    int lines = 0;
+
+    input = g_data_input_stream_new (
+            g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+    output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+    line = g_data_input_stream_read_line (input, NULL, 
+            server->cancellable, NULL);
+    if (line != NULL) {
+        found = g_str_has_prefix (line, "GET / ") || 
+            g_str_has_prefix (line, "GET /metrics ");
+        g_free (line);
+    }
+    while (line != NULL && ++lines < METRICS_MAX_HEADERS) {
+        line = g_data_input_stream_read_line (input, NULL, 
+                server->cancellable, NULL);
+        //Empty line ends headers
+        if (line != NULL && (line[0] == '\0' || line[0] == '\r')) {
+            g_free (line);
+            break;
+        }
+        g_free (line);
+    }
+
+    if (found) {
+        body = metrics_format (server->c);
+        reply = g_strdup_printf ("HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: %lu\r\nConnection: close\r\n\r\n%s",
+                (unsigned long) strlen (body), body);
+        g_free (body);
+    } else {
+        reply = g_strdup ("HTTP/1.0 404 Not Found\r\n"
+                "Content-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+    g_output_stream_write_all (output, reply, strlen (reply), NULL,
+            server->cancellable, NULL);
+    g_free (reply);
+    g_object_unref (input);
+
+    g_mutex_lock (&server->lock);
+    if (--server->requests == 0) {
+        g_cond_signal (&server->idle);
+    }
+    g_mutex_unlock (&server->lock);
+    return TRUE;
+}
+
+int
+metrics_serve (PContext c, const char *address)
+{
+    MetricsServer *server;
+    GSocketService *service;
+    GSocketAddress *socket_address;
+    GInetAddress *loopback;
+    GError *error = NULL;
+    guint64 port;
+    gboolean tcp;
+    char *end;
+
+    if (metrics_server != NULL) {
+        put_warning ("Metrics are served already");
+        return -1;
+    }
+    port = g_ascii_strtoull (address, &end, 10);
+    tcp = *address != '\0' && *end == '\0';
+    if (tcp) {
+        if (port == 0 || port > 65535) {
+            put_warning ("Invalid metrics port '%s'", address);
+            return -1;
+        }
+        //Metrics are not exposed to network
+        loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+        socket_address = g_inet_socket_address_new (loopback, port);
+        g_object_unref (loopback);
+    } else {
+        //Socket left by previous run
+        if (unlink_stale_socket (address) < 0) {
+            return -1;
+        }
+        socket_address = g_unix_socket_address_new (address);
+    }
+
+    service = g_threaded_socket_service_new (METRICS_MAX_THREADS);
+    if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), 
+                socket_address, G_SOCKET_TYPE_STREAM, 
+                G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL, &error)) {
+        put_warning ("Can not serve metrics on '%s'. %s", address, 
+                error->message);
+        g_error_free (error);
+        g_object_unref (socket_address);
+        g_object_unref (service);
+        return -1;
+    }
+    g_object_unref (socket_address);
+
+    server = calloc (1, sizeof (MetricsServer));
+    if (server == NULL) {
+        put_error (1, "Can not allocate memory for metrics server");
+    }
+    server->c = c;
+    server->service = service;
+    server->cancellable = g_cancellable_new ();
+    server->socket_path = tcp ? NULL : g_strdup (address);
+    if (server->socket_path != NULL && 
+            lstat (server->socket_path, &server->socket_stat) < 0) {
+        memset (&server->socket_stat, 0, sizeof (struct stat));
+    }
+    g_mutex_init (&server->lock);
+    g_cond_init (&server->idle);
+    g_signal_connect (service, "incoming", 
+            G_CALLBACK (on_metrics_incoming), server);
+    g_signal_connect (service, "run", G_CALLBACK (on_metrics_run), server);
+    g_socket_service_start (service);
+    metrics_server = server;
+    return 0;
+}
+
+void
+metrics_stop (void)
+{
+    MetricsServer *server = metrics_server;
+
+    if (server == NULL) {
+        return;
+    }
+    g_socket_service_stop (server->service);
+    g_socket_listener_close (G_SOCKET_LISTENER (server->service));
+    //Requests use context, wait for them
+    g_cancellable_cancel (server->cancellable);
+    g_mutex_lock (&server->lock);
+    while (server->requests > 0) {
+        g_cond_wait (&server->idle, &server->lock);
+    }
+    g_mutex_unlock (&server->lock);
+
+    g_object_unref (server->service);
+    g_object_unref (server->cancellable);
+    g_cond_clear (&server->idle);
+    g_mutex_clear (&server->lock);
+    if (server->socket_path != NULL) {
+        unlink_own_socket (server->socket_path, &server->socket_stat);
+        g_free (server->socket_path);
+    }
+    free (server);
+    metrics_server = NULL;
+}
@@ -0,0 +1,65 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "gifseeker.h"
+
+/**
+ *  Metrics of long running instance in Prometheus text format.
+ *
+ *  Core counts events and observes latencies with metrics_count and
+ *  metrics_observe. They only add to atomic counters of process, so
+ *  they are cheap enough for hot paths and never block. Histograms
+ *  have fixed buckets from 100 us to 5 s.
+ *  metrics_format collects counters, histograms and state of context,
+ *  like cache statistics and memory by category, into text exposition.
+ *  Call metrics_serve to answer HTTP GET requests of scrapers on UNIX
+ *  socket or, if address is a port number, on loopback TCP port.
+ *  Requests are answered in their own thread, while main loop runs.
+ *  Call metrics_stop before context is freed.
+ */
+
+typedef enum MetricsCounter {
+    METRICS_FRAMES_SERVED,  //Images sent to clients of frame server
+    METRICS_FRAMES_SHOWN,   //Images painted in window
+    METRICS_COUNTERS
+} MetricsCounter;
+
+typedef enum MetricsHistogram {
+    METRICS_DECODE,         //Decoding of gif
+    METRICS_CONVERT,        //Conversion of image to snapshoot
+    METRICS_WAIT_VISIBLE,   //Wait of scheduler tasks in queue by class,
+    METRICS_WAIT_NEIGHBOR,  //in order of SchedulerPriority
+    METRICS_WAIT_THUMBNAIL,
+    METRICS_WAIT_INDEX,
+    METRICS_SLIDESHOW_LATENESS, //Delay of slideshow timer
+    METRICS_HISTOGRAMS
+} MetricsHistogram;
+
+void metrics_count (MetricsCounter counter);
+void metrics_observe (MetricsHistogram histogram, gint64 usec);
+
+char *metrics_format (PContext c);
+int metrics_serve (PContext c, const char *address);
+void metrics_stop (void);
+
+#endif /*METRICS_H*/
@@ -0,0 +1,121 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "parallel.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+
+typedef struct ParallelJob {
+    volatile gint ref_count;    //Caller and helper tasks
+    int count;
+    ParallelFunc func;
+    gpointer data;
+    volatile gint next;     //Next index to take
+    GMutex lock;
+    GCond finished;
+    int done;               //Indices processed, guarded by lock
+} ParallelJob;
+
+static void
+parallel_job_unref (ParallelJob *job)
+{
+    if (g_atomic_int_dec_and_test (&job->ref_count)) {
+        g_cond_clear (&job->finished);
+        g_mutex_clear (&job->lock);
+        free (job);
+    }
+}
+
+static void
+parallel_worker (ParallelJob *job)
+{
+    int i, done = 0;
+
+    while ((i = g_atomic_int_add (&job->next, 1)) < job->count) {
+        job->func (i, job->data);
+        ++done;
+    }
+    if (done > 0) {
+        g_mutex_lock (&job->lock);
+        job->done += done;
+        if (job->done == job->count) {
+            g_cond_signal (&job->finished);
+        }
+        g_mutex_unlock (&job->lock);
+    }
+}
+
+/**
+ *  Helper task may start after all indices are taken, then it only
+ *  drops its reference.
+ */
+static void
+parallel_helper (gpointer data, GCancellable *cancellable)
+{
+    ParallelJob *job = (ParallelJob *) data;
+
+    parallel_worker (job);
+    parallel_job_unref (job);
+}
+
+void
+parallel_for (int count, int threads, ParallelFunc func, gpointer data)
+{
+    Scheduler *scheduler = scheduler_get_default ();
+    ParallelJob *job;
+    int i;
+
+    if (threads <= 0) {
+        threads = scheduler_get_threads (scheduler);
+    }
+    threads = MIN (threads, count);
+    if (threads <= 1) {
+        for (i = 0; i < count; ++i) {
+            func (i, data);
+        }
+        return;
+    }
+
+    job = calloc (1, sizeof (ParallelJob));
+    if (job == NULL) {
+        put_error (1, "Can not allocate memory for parallel job");
+    }
+    job->ref_count = threads;
+    job->count = count;
+    job->func = func;
+    job->data = data;
+    g_mutex_init (&job->lock);
+    g_cond_init (&job->finished);
+    //Helpers run on shared pool with priority of calling task
+    for (i = 1; i < threads; ++i) {
+        scheduler_push (scheduler, scheduler_get_priority (), 
+                parallel_helper, job, NULL);
+    }
+    parallel_worker (job);
+
+    //Indices taken by helpers are being processed, so wait is short
+    g_mutex_lock (&job->lock);
+    while (job->done < job->count) {
+        g_cond_wait (&job->finished, &job->lock);
+    }
+    g_mutex_unlock (&job->lock);
+    parallel_job_unref (job);
+}
@@ -0,0 +1,38 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "gifseeker.h"
+
+/**
+ *  Runs func for every index from 0 to count - 1 on several threads.
+ *  Threads take indices one by one, calling thread works too.
+ *  Other threads are workers of default scheduler, they help with
+ *  priority of calling task. If threads is 0, all workers may help.
+ *  Returns after all calls are over.
+ */
+
+typedef void (*ParallelFunc) (int index, gpointer data);
+
+void parallel_for (int count, int threads, ParallelFunc func, gpointer data);
+
+#endif /*PARALLEL_H*/
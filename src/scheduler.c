@@ -0,0 +1,343 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "scheduler.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <stdlib.h>
+
+#define scheduler_is_bulk(priority) ((priority) >= SCHEDULER_THUMBNAIL)
+
+typedef struct SchedulerTask {
+    SchedulerFunc func;
+    gpointer data;
+    GCancellable *cancellable;
+    gint64 pushed;          //When task was queued
+} SchedulerTask;
+
+typedef struct SchedulerWorker {
+    Scheduler *scheduler;
+    GThread *thread;
+    int index;
+    GMutex lock;            //Guards queues of worker
+    GQueue queues[SCHEDULER_PRIORITIES];    //Owner takes tail, thieves head
+} SchedulerWorker;
+
+struct Scheduler {
+    GMutex lock;            //Guards shared queues, epoch and stopping
+    GCond wake;
+    GQueue queues[SCHEDULER_PRIORITIES];    //Tasks pushed by other threads
+    SchedulerWorker *workers;
+    int threads;
+    int bulk_limit;         //Workers, which may run bulk tasks at once
+    volatile gint bulk_running;
+    volatile gint bulk_blocked; //Some worker did not get bulk slot
+    volatile gint queued;   //Tasks in all queues
+    guint epoch;            //Changed when some task may be taken
+    gboolean stopping;
+};
+
+static __thread SchedulerWorker *current_worker = NULL;
+static __thread SchedulerPriority current_priority = SCHEDULER_VISIBLE;
+
+static Scheduler *default_scheduler = NULL;
+static int default_threads = 0;
+
+/**
+ *  Wakes workers, which wait for change of epoch.
+ */
+static void
+scheduler_wake (Scheduler *scheduler, gboolean all)
+{
+    g_mutex_lock (&scheduler->lock);
+    ++scheduler->epoch;
+    if (all) {
+        g_cond_broadcast (&scheduler->wake);
+    } else {
+        g_cond_signal (&scheduler->wake);
+    }
+    g_mutex_unlock (&scheduler->lock);
+}
+
+static gboolean
+scheduler_bulk_reserve (Scheduler *scheduler)
+{
+    gint running;
+
+    while (TRUE) {
+        running = g_atomic_int_get (&scheduler->bulk_running);
+        if (running >= scheduler->bulk_limit) {
+            //Flag is set before check, so release does not miss it
+            g_atomic_int_set (&scheduler->bulk_blocked, TRUE);
+            if (g_atomic_int_get (&scheduler->bulk_running) >= 
+                    scheduler->bulk_limit) {
+                return FALSE;
+            }
+            continue;
+        }
+        if (g_atomic_int_compare_and_exchange (&scheduler->bulk_running,
+                    running, running + 1)) {
+            return TRUE;
+        }
+    }
+}
+
+static void
+scheduler_bulk_release (Scheduler *scheduler)
+{
+    g_atomic_int_add (&scheduler->bulk_running, -1);
+    if (g_atomic_int_get (&scheduler->bulk_blocked)) {
+        g_atomic_int_set (&scheduler->bulk_blocked, FALSE);
+        scheduler_wake (scheduler, TRUE);
+    }
+}
+
+static SchedulerTask *
+queue_take (GMutex *lock, GQueue *queue, gboolean newest)
+{
+    SchedulerTask *task;
+
+    g_mutex_lock (lock);
+    task = newest ? g_queue_pop_tail (queue) : g_queue_pop_head (queue);
+    g_mutex_unlock (lock);
+    return task;
+}
+
+/**
+ *  Takes the most urgent task: own one, pushed from outside or stolen
+ *  from other worker. Slot of bulk task is reserved for it.
+ */
+static SchedulerTask *
+scheduler_take (SchedulerWorker *worker, SchedulerPriority *priority)
+{
+    Scheduler *scheduler = worker->scheduler;
+    SchedulerWorker *victim;
+    SchedulerTask *task;
+    int p, i;
+
+    for (p = 0; p < SCHEDULER_PRIORITIES; ++p) {
+        if (scheduler_is_bulk (p) && !scheduler_bulk_reserve (scheduler)) {
+            return NULL;
+        }
+        task = queue_take (&worker->lock, &worker->queues[p], TRUE);
+        if (task == NULL) {
+            task = queue_take (&scheduler->lock, &scheduler->queues[p], 
+                    FALSE);
+        }
+        for (i = 1; task == NULL && i < scheduler->threads; ++i) {
+            victim = &scheduler->workers[(worker->index + i) % 
+                    scheduler->threads];
+            task = queue_take (&victim->lock, &victim->queues[p], FALSE);
+        }
+        if (task != NULL) {
+            g_atomic_int_add (&scheduler->queued, -1);
+            *priority = p;
+            return task;
+        }
+        if (scheduler_is_bulk (p)) {
+            scheduler_bulk_release (scheduler);
+        }
+    }
+    return NULL;
+}
+
+static gpointer
+scheduler_worker (gpointer data)
+{
+    SchedulerWorker *worker = (SchedulerWorker *) data;
+    Scheduler *scheduler = worker->scheduler;
+    SchedulerTask *task;
+    SchedulerPriority priority;
+    guint epoch;
+
+    current_worker = worker;
+    while (TRUE) {
+        g_mutex_lock (&scheduler->lock);
+        epoch = scheduler->epoch;
+        g_mutex_unlock (&scheduler->lock);
+
+        task = scheduler_take (worker, &priority);
+        if (task == NULL) {
+            g_mutex_lock (&scheduler->lock);
+            //Pool is freed, when all tasks are over
+            if (scheduler->stopping && 
+                    g_atomic_int_get (&scheduler->queued) == 0) {
+                g_mutex_unlock (&scheduler->lock);
+                break;
+            }
+            while (scheduler->epoch == epoch) {
+                g_cond_wait (&scheduler->wake, &scheduler->lock);
+            }
+            g_mutex_unlock (&scheduler->lock);
+            continue;
+        }
+
+        metrics_observe (METRICS_WAIT_VISIBLE + priority, 
+                g_get_monotonic_time () - task->pushed);
+        TRACE_BEGIN (stamp);
+        current_priority = priority;
+        task->func (task->data, task->cancellable);
+        current_priority = SCHEDULER_VISIBLE;
+        TRACE_END (stamp, "scheduler_task");
+        if (task->cancellable != NULL) {
+            g_object_unref (task->cancellable);
+        }
+        free (task);
+        if (scheduler_is_bulk (priority)) {
+            scheduler_bulk_release (scheduler);
+        }
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+Scheduler *
+scheduler_new (int threads)
+{
+    Scheduler *scheduler;
+    SchedulerWorker *worker;
+    int i, p;
+
+    //Extra worker is kept for image on screen
+    if (threads <= 0) {
+        threads = g_get_num_processors () + 1;
+    }
+    scheduler = calloc (1, sizeof (Scheduler));
+    if (scheduler == NULL) {
+        put_error (1, "Can not allocate memory for scheduler");
+    }
+    scheduler->workers = calloc (threads, sizeof (SchedulerWorker));
+    if (scheduler->workers == NULL) {
+        put_error (1, "Can not allocate memory for workers");
+    }
+    scheduler->threads = threads;
+    scheduler->bulk_limit = MAX (threads - 1, 1);
+    g_mutex_init (&scheduler->lock);
+    g_cond_init (&scheduler->wake);
+    for (p = 0; p < SCHEDULER_PRIORITIES; ++p) {
+        g_queue_init (&scheduler->queues[p]);
+    }
+    for (i = 0; i < threads; ++i) {
+        worker = &scheduler->workers[i];
+        worker->scheduler = scheduler;
+        worker->index = i;
+        g_mutex_init (&worker->lock);
+        for (p = 0; p < SCHEDULER_PRIORITIES; ++p) {
+            g_queue_init (&worker->queues[p]);
+        }
+    }
+    //Workers steal from each other, so all are made before start
+    for (i = 0; i < threads; ++i) {
+        scheduler->workers[i].thread = g_thread_new ("scheduler", 
+                scheduler_worker, &scheduler->workers[i]);
+    }
+    return scheduler;
+}
+
+void
+scheduler_free (Scheduler *scheduler)
+{
+    int i;
+
+    if (scheduler == NULL) {
+        return;
+    }
+    g_mutex_lock (&scheduler->lock);
+    scheduler->stopping = TRUE;
+    ++scheduler->epoch;
+    g_cond_broadcast (&scheduler->wake);
+    g_mutex_unlock (&scheduler->lock);
+
+    for (i = 0; i < scheduler->threads; ++i) {
+        g_thread_join (scheduler->workers[i].thread);
+        g_mutex_clear (&scheduler->workers[i].lock);
+    }
+    free (scheduler->workers);
+    g_cond_clear (&scheduler->wake);
+    g_mutex_clear (&scheduler->lock);
+    free (scheduler);
+}
+
+int
+scheduler_get_threads (const Scheduler *scheduler)
+{
+    return scheduler->threads;
+}
+
+int
+scheduler_get_queued (Scheduler *scheduler)
+{
+    return g_atomic_int_get (&scheduler->queued);
+}
+
+void
+scheduler_push (Scheduler *scheduler, SchedulerPriority priority,
+        SchedulerFunc func, gpointer data, GCancellable *cancellable)
+{
+    SchedulerWorker *worker = current_worker;
+    SchedulerTask *task;
+
+    task = calloc (1, sizeof (SchedulerTask));
+    if (task == NULL) {
+        put_error (1, "Can not allocate memory for task");
+    }
+    task->func = func;
+    task->data = data;
+    task->cancellable = cancellable != NULL ? 
+            g_object_ref (cancellable) : NULL;
+    task->pushed = g_get_monotonic_time ();
+
+    if (worker != NULL && worker->scheduler == scheduler) {
+        g_mutex_lock (&worker->lock);
+        g_queue_push_tail (&worker->queues[priority], task);
+        g_mutex_unlock (&worker->lock);
+    } else {
+        g_mutex_lock (&scheduler->lock);
+        g_queue_push_tail (&scheduler->queues[priority], task);
+        g_mutex_unlock (&scheduler->lock);
+    }
+    g_atomic_int_inc (&scheduler->queued);
+    scheduler_wake (scheduler, FALSE);
+}
+
+Scheduler *
+scheduler_get_default (void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        default_scheduler = scheduler_new (default_threads);
+        g_once_init_leave (&initialized, 1);
+    }
+    return default_scheduler;
+}
+
+void
+scheduler_set_default_threads (int threads)
+{
+    default_threads = threads;
+}
+
+SchedulerPriority
+scheduler_get_priority (void)
+{
+    return current_priority;
+}
@@ -0,0 +1,70 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "gifseeker.h"
+#include <gio/gio.h>
+
+/**
+ *  Pool of worker threads shared by all background work of core.
+ *
+ *  Tasks are run in order of priority class. Task pushed by worker
+ *  goes to its own queue, worker takes its newest task first, while
+ *  idle workers steal the oldest ones. Tasks pushed by other threads
+ *  are taken in order they were pushed. Bulk
+ *  classes (thumbnails and indexing) run on all workers but one, so
+ *  image on screen never waits behind them. By default pool has one
+ *  worker per processor and one more for that.
+ *  Function of task is called even if its cancellable was cancelled
+ *  meanwhile, so it can report that. Cancellable is held until then.
+ *  scheduler_get_default gives pool of process, its size is set by
+ *  scheduler_set_default_threads before the first use.
+ *  scheduler_get_priority gives class of task, which current thread
+ *  runs, other threads get SCHEDULER_VISIBLE. scheduler_get_queued
+ *  gives number of tasks waiting in queues, time they wait is observed
+ *  by metrics. All functions are thread safe. scheduler_free waits for
+ *  all pushed tasks.
+ */
+
+typedef enum SchedulerPriority {
+    SCHEDULER_VISIBLE,      //Image on screen
+    SCHEDULER_NEIGHBOR,     //Images user may go to next
+    SCHEDULER_THUMBNAIL,    //Previews
+    SCHEDULER_INDEX,        //Loading and indexing of files
+    SCHEDULER_PRIORITIES
+} SchedulerPriority;
+
+typedef struct Scheduler Scheduler;
+typedef void (*SchedulerFunc) (gpointer data, GCancellable *cancellable);
+
+Scheduler *scheduler_new (int threads);
+void scheduler_free (Scheduler *scheduler);
+int scheduler_get_threads (const Scheduler *scheduler);
+int scheduler_get_queued (Scheduler *scheduler);
+void scheduler_push (Scheduler *scheduler, SchedulerPriority priority,
+        SchedulerFunc func, gpointer data, GCancellable *cancellable);
+
+Scheduler *scheduler_get_default (void);
+void scheduler_set_default_threads (int threads);
+SchedulerPriority scheduler_get_priority (void);
+
+#endif /*SCHEDULER_H*/
@@ -0,0 +1,583 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//For memfd_create
+#define _GNU_SOURCE
+
+#include "server.h"
+#include "metrics.h"
+#include "trace.h"
+#include "../config.h"
+
+#include <gio/gunixconnection.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SERVER_MAX_THREADS 16
+//Replies are written to socket when so much is collected
+#define SERVER_FLUSH_SIZE (4 << 20)
+
+typedef struct Server {
+    PContext c;
+    GMainLoop *loop;
+    GCancellable *cancellable;  //Cancelled on shutdown to wake clients up
+    GMutex lock;
+    GCond idle;             //Signaled when last client is gone
+    int clients;
+} Server;
+
+typedef struct ServerClient {
+    Server *server;
+    GSocketConnection *connection;
+    GOutputStream *output;
+    GByteArray *out;        //Replies not yet written
+} ServerClient;
+
+static gboolean
+client_flush (ServerClient *client)
+{
+    gboolean result = TRUE;
+
+    if (client->out->len > 0) {
+        result = g_output_stream_write_all (client->output, 
+                client->out->data, client->out->len, NULL, 
+                client->server->cancellable, NULL);
+        g_byte_array_set_size (client->out, 0);
+    }
+    return result;
+}
+
+static void
+client_reply (ServerClient *client, const ServerRequest *request,
+        ServerReply *reply, const void *payload)
+{
+    reply->tag = request->tag;
+    g_byte_array_append (client->out, (const guint8 *) reply, 
+            sizeof (ServerReply));
+    if (payload != NULL && reply->size > 0) {
+        g_byte_array_append (client->out, payload, reply->size);
+    }
+}
+
+static void
+client_reply_status (ServerClient *client, const ServerRequest *request,
+        ServerStatus status)
+{
+    ServerReply reply;
+
+    memset (&reply, 0, sizeof (ServerReply));
+    reply.status = status;
+    reply.gif = request->gif;
+    reply.pos = request->pos;
+    client_reply (client, request, &reply, NULL);
+}
+
+/**
+ *  Fills size of BGRX image. Returns FALSE, if it does not fit
+ *  into reply.
+ */
+static gboolean
+reply_set_size (ServerReply *reply, int width, int height)
+{
+    size_t size = (size_t) width * 4 * height;
+
+    if (size > G_MAXUINT32) {
+        return FALSE;
+    }
+    reply->width = width;
+    reply->height = height;
+    reply->stride = width * 4;
+    reply->size = size;
+    return TRUE;
+}
+
+static int
+server_shm_new (size_t size)
+{
+    int fd;
+#ifdef HAVE_MEMFD_CREATE
+    fd = memfd_create ("gifseeker-frame", MFD_CLOEXEC);
+#else
+    char *path;
+
+    fd = g_file_open_tmp ("gifseeker-frame-XXXXXX", &path, NULL);
+    if (fd >= 0) {
+        g_unlink (path);
+        g_free (path);
+    }
+#endif
+    if (fd >= 0 && ftruncate (fd, size) < 0) {
+        close (fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void
+copy_rows (byte *dst, int dst_stride, const byte *src, int src_stride,
+        size_t row_size, int rows)
+{
+    int y;
+
+    for (y = 0; y < rows; ++y) {
+        memcpy (dst + (size_t) y * dst_stride, 
+                src + (size_t) y * src_stride, row_size);
+    }
+}
+
+/**
+ *  Passes pixels of snapshoot or, if it is NULL, pixels with stride
+ *  in shared memory.
+ */
+static gboolean
+client_reply_shm (ServerClient *client, const ServerRequest *request,
+        ServerReply *reply, const GifSnapshoot *snap,
+        const byte *pixels_src, int stride)
+{
+    void *pixels;
+    gboolean result;
+    int fd;
+
+    fd = server_shm_new (reply->size);
+    if (fd < 0) {
+        client_reply_status (client, request, SERVER_FAILED);
+        return TRUE;
+    }
+    pixels = mmap (NULL, reply->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    if (pixels == MAP_FAILED) {
+        close (fd);
+        client_reply_status (client, request, SERVER_FAILED);
+        return TRUE;
+    }
+    if (snap != NULL) {
+        snapshoot_expand (snap, 0, 0, snap->width, snap->height,
+                pixels, reply->stride);
+    } else {
+        copy_rows (pixels, reply->stride, pixels_src, stride, 
+                reply->stride, reply->height);
+    }
+    munmap (pixels, reply->size);
+
+    //Descriptor must follow its reply in stream
+    client_reply (client, request, reply, NULL);
+    result = client_flush (client) && 
+        g_unix_connection_send_fd (G_UNIX_CONNECTION (client->connection), 
+                fd, client->server->cancellable, NULL);
+    close (fd);
+    return result;
+}
+
+static gboolean
+client_reply_frame (ServerClient *client, const ServerRequest *request,
+        int gif, int pos)
+{
+    ServerReply reply;
+    GifSnapshoot *snap;
+    guint offset;
+    int count;
+
+    memset (&reply, 0, sizeof (ServerReply));
+    reply.gif = gif;
+    reply.pos = pos;
+
+    count = get_gif_image_count (client->server->c, gif);
+    if (pos < 0 && count > 0) {
+        pos += count;
+    }
+    snap = count > 0 && pos >= 0 && pos < count ? 
+        get_snapshoot_pos (client->server->c, gif, pos) : NULL;
+    if (snap == NULL) {
+        client_reply_status (client, request, SERVER_NOT_FOUND);
+        return TRUE;
+    }
+
+    if (!reply_set_size (&reply, snap->width, snap->height)) {
+        free_snapshoot (snap);
+        client_reply_status (client, request, SERVER_FAILED);
+        return TRUE;
+    }
+    reply.status = SERVER_OK;
+    reply.pos = pos;
+    metrics_count (METRICS_FRAMES_SERVED);
+
+    if (request->flags & SERVER_FLAG_SHM) {
+        gboolean result = client_reply_shm (client, request, &reply, snap,
+                NULL, 0);
+        free_snapshoot (snap);
+        return result;
+    }
+
+    client_reply (client, request, &reply, NULL);
+    offset = client->out->len;
+    g_byte_array_set_size (client->out, offset + reply.size);
+    snapshoot_expand (snap, 0, 0, snap->width, snap->height,
+            client->out->data + offset, reply.stride);
+    free_snapshoot (snap);
+
+    if (client->out->len >= SERVER_FLUSH_SIZE) {
+        return client_flush (client);
+    }
+    return TRUE;
+}
+
+typedef struct RangeReply {
+    ServerClient *client;
+    const ServerRequest *request;
+    gboolean result;        //Client is still connected
+} RangeReply;
+
+static gboolean
+on_range_image (int pos, const unsigned char *pixels, 
+        int width, int height, int stride, gpointer data)
+{
+    RangeReply *range = (RangeReply *) data;
+    ServerClient *client = range->client;
+    ServerReply reply;
+    guint offset;
+
+    memset (&reply, 0, sizeof (ServerReply));
+    reply.gif = range->request->gif;
+    reply.pos = pos;
+    if (!reply_set_size (&reply, width, height)) {
+        reply.status = SERVER_FAILED;
+        client_reply (client, range->request, &reply, NULL);
+        return range->result;
+    }
+    reply.status = SERVER_OK;
+    metrics_count (METRICS_FRAMES_SERVED);
+
+    if (range->request->flags & SERVER_FLAG_SHM) {
+        range->result = client_reply_shm (client, range->request, &reply,
+                NULL, pixels, stride);
+        return range->result;
+    }
+    client_reply (client, range->request, &reply, NULL);
+    offset = client->out->len;
+    g_byte_array_set_size (client->out, offset + reply.size);
+    copy_rows (client->out->data + offset, reply.stride, pixels, stride,
+            reply.stride, height);
+    if (client->out->len >= SERVER_FLUSH_SIZE) {
+        range->result = client_flush (client);
+    }
+    return range->result;
+}
+
+/**
+ *  Consecutive images are made in one pass without cache.
+ */
+static gboolean
+client_reply_range (ServerClient *client, const ServerRequest *request,
+        int count)
+{
+    PContext c = client->server->c;
+    RangeReply range;
+    int images, begin, done = 0;
+
+    range.client = client;
+    range.request = request;
+    range.result = TRUE;
+
+    images = get_gif_image_count (c, request->gif);
+    begin = request->pos;
+    if (begin < 0 && images > 0) {
+        begin += images;
+    }
+    //Position is given by client, begin + count must not overflow
+    if (images > 0 && begin >= 0 && begin < images) {
+        done = MAX (get_snapshoot_range (c, request->gif, begin, 
+                    begin + MIN (count, images - begin), 0, NULL, 0,
+                    on_range_image, &range), 0);
+    }
+    //Images out of gif
+    for (; done < count && range.result; ++done) {
+        client_reply_status (client, request, SERVER_NOT_FOUND);
+    }
+    return range.result;
+}
+
+static gboolean
+client_reply_random (ServerClient *client, const ServerRequest *request)
+{
+    PContext c = client->server->c;
+    int gif = request->gif, count;
+
+    if (gif < 0) {
+        count = get_gif_count (c);
+        if (count == 0) {
+            client_reply_status (client, request, SERVER_NOT_FOUND);
+            return TRUE;
+        }
+        gif = g_random_int_range (0, count);
+    }
+    count = get_gif_image_count (c, gif);
+    if (count <= 0) {
+        client_reply_status (client, request, SERVER_NOT_FOUND);
+        return TRUE;
+    }
+    return client_reply_frame (client, request, gif,
+            g_random_int_range (0, count));
+}
+
+static void
+client_reply_info (ServerClient *client, const ServerRequest *request)
+{
+    ServerReply reply;
+    char *info;
+
+    info = g_strdup_printf ("version=%s\nmax_batch=%d\n", 
+            PACKAGE_VERSION, SERVER_MAX_BATCH);
+    memset (&reply, 0, sizeof (ServerReply));
+    reply.status = SERVER_OK;
+    reply.gif = get_gif_count (client->server->c);
+    reply.size = strlen (info);
+    client_reply (client, request, &reply, info);
+    g_free (info);
+}
+
+static void
+client_reply_gif_info (ServerClient *client, const ServerRequest *request)
+{
+    PContext c = client->server->c;
+    ServerReply reply;
+    const char *filename;
+    int width, height;
+
+    if (get_gif_screen_size (c, request->gif, &width, &height) < 0) {
+        client_reply_status (client, request, SERVER_NOT_FOUND);
+        return;
+    }
+    filename = get_gif_filename (c, request->gif);
+    memset (&reply, 0, sizeof (ServerReply));
+    reply.status = SERVER_OK;
+    reply.gif = request->gif;
+    //Scanned without decoding, unless file can not be scanned
+    reply.pos = count_gif_images (c, request->gif);
+    reply.width = width;
+    reply.height = height;
+    reply.size = filename != NULL ? strlen (filename) : 0;
+    client_reply (client, request, &reply, filename);
+}
+
+static gboolean
+client_handle (ServerClient *client, const ServerRequest *request)
+{
+    guint32 count = MAX (request->count, 1), i;
+    gboolean result = TRUE;
+    TRACE_BEGIN (stamp);
+
+    switch (request->command) {
+    case SERVER_INFO:
+        client_reply_info (client, request);
+        break;
+    case SERVER_GIF_INFO:
+        client_reply_gif_info (client, request);
+        break;
+    case SERVER_FRAME:
+    case SERVER_RANDOM:
+        if (count > SERVER_MAX_BATCH) {
+            client_reply_status (client, request, SERVER_BAD_REQUEST);
+            break;
+        }
+        if (request->command == SERVER_FRAME && count > 1) {
+            result = client_reply_range (client, request, count);
+            break;
+        }
+        for (i = 0; i < count && result; ++i) {
+            if (request->command == SERVER_FRAME) {
+                result = client_reply_frame (client, request, 
+                        request->gif, request->pos + i);
+            } else {
+                result = client_reply_random (client, request);
+            }
+        }
+        break;
+    default:
+        client_reply_status (client, request, SERVER_BAD_REQUEST);
+        break;
+    }
+    TRACE_END (stamp, "server_request");
+    return result && client_flush (client);
+}
+
+/**
+ *  Client is counted in main loop thread before it is dispatched,
+ *  so serve does not return while its thread is yet to start.
+ */
+static gboolean
+on_client_incoming (GSocketService *service, 
+        GSocketConnection *connection, GObject *source_object,
+        Server *server)
+{
+    g_mutex_lock (&server->lock);
+    ++server->clients;
+    g_mutex_unlock (&server->lock);
+    //Let threaded service run client
+    return FALSE;
+}
+
+static gboolean
+on_client_run (GThreadedSocketService *service, 
+        GSocketConnection *connection, GObject *source_object,
+        Server *server)
+{
+    ServerClient client;
+    GInputStream *input;
+    ServerRequest request;
+    gsize read;
+
+    client.server = server;
+    client.connection = connection;
+    client.output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+    client.out = g_byte_array_new ();
+    input = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+
+    while (g_input_stream_read_all (input, &request, sizeof (ServerRequest),
+                &read, server->cancellable, NULL) && 
+            read == sizeof (ServerRequest)) {
+        if (!client_handle (&client, &request)) {
+            break;
+        }
+    }
+    g_byte_array_free (client.out, TRUE);
+
+    g_mutex_lock (&server->lock);
+    if (--server->clients == 0) {
+        g_cond_signal (&server->idle);
+    }
+    g_mutex_unlock (&server->lock);
+    return TRUE;
+}
+
+int
+unlink_stale_socket (const char *path)
+{
+    struct stat st;
+
+    if (lstat (path, &st) < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        put_warning ("Can not stat '%s'. %s", path, g_strerror (errno));
+        return -1;
+    }
+    if (!S_ISSOCK (st.st_mode)) {
+        put_warning ("'%s' exists and is not a socket", path);
+        return -1;
+    }
+    if (g_unlink (path) < 0) {
+        put_warning ("Can not remove '%s'. %s", path, g_strerror (errno));
+        return -1;
+    }
+    return 0;
+}
+
+void
+unlink_own_socket (const char *path, const struct stat *own)
+{
+    struct stat st;
+
+    if (lstat (path, &st) == 0 && S_ISSOCK (st.st_mode) &&
+            st.st_dev == own->st_dev && st.st_ino == own->st_ino) {
+        g_unlink (path);
+    }
+}
+
+static gboolean
+on_server_signal (Server *server)
+{
+    g_main_loop_quit (server->loop);
+    return G_SOURCE_REMOVE;
+}
+
+int
+serve (PContext c, const char *socket_path)
+{
+    Server server;
+    GSocketService *service;
+    GSocketAddress *address;
+    GError *error = NULL;
+    struct stat own;
+
+    //Replies to gone clients must not kill server
+    signal (SIGPIPE, SIG_IGN);
+    //Socket left by previous run
+    if (unlink_stale_socket (socket_path) < 0) {
+        return -1;
+    }
+
+    service = g_threaded_socket_service_new (SERVER_MAX_THREADS);
+    address = g_unix_socket_address_new (socket_path);
+    if (!g_socket_listener_add_address (G_SOCKET_LISTENER (service), 
+                address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                NULL, NULL, &error)) {
+        put_warning ("Can not listen on '%s'. %s", socket_path, 
+                error->message);
+        g_error_free (error);
+        g_object_unref (address);
+        g_object_unref (service);
+        return -1;
+    }
+    g_object_unref (address);
+    //Path may be replaced while serving, only this socket is removed
+    if (lstat (socket_path, &own) < 0) {
+        memset (&own, 0, sizeof (own));
+    }
+
+    server.c = c;
+    server.loop = g_main_loop_new (NULL, FALSE);
+    server.cancellable = g_cancellable_new ();
+    g_mutex_init (&server.lock);
+    g_cond_init (&server.idle);
+    server.clients = 0;
+    g_signal_connect (service, "incoming", 
+            G_CALLBACK (on_client_incoming), &server);
+    g_signal_connect (service, "run", G_CALLBACK (on_client_run), &server);
+    g_unix_signal_add (SIGINT, (GSourceFunc) on_server_signal, &server);
+    g_unix_signal_add (SIGTERM, (GSourceFunc) on_server_signal, &server);
+
+    g_socket_service_start (service);
+    printf ("Serving %lu gifs on '%s'\n", 
+            (unsigned long) get_gif_count (c), socket_path);
+    g_main_loop_run (server.loop);
+
+    g_socket_service_stop (service);
+    g_socket_listener_close (G_SOCKET_LISTENER (service));
+    //Clients use context, wait for them
+    g_cancellable_cancel (server.cancellable);
+    g_mutex_lock (&server.lock);
+    while (server.clients > 0) {
+        g_cond_wait (&server.idle, &server.lock);
+    }
+    g_mutex_unlock (&server.lock);
+
+    g_object_unref (service);
+    g_object_unref (server.cancellable);
+    g_cond_clear (&server.idle);
+    g_mutex_clear (&server.lock);
+    g_main_loop_unref (server.loop);
+    unlink_own_socket (socket_path, &own);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "gifseeker.h"
+
+#include <sys/stat.h>
+
+/**
+ *  Frame server. Keeps context warm and answers requests of local
+ *  clients on UNIX socket. Clients are served concurrently, each in
+ *  its own thread. Call serve to run it until SIGINT or SIGTERM.
+ *
+ *  Protocol. Client sends ServerRequest's. Server answers with
+ *  ServerReply, followed by size bytes of payload, per every requested
+ *  frame or one per other command. Numbers are in host byte order,
+ *  replies go in order of requests and carry tag of their request.
+ *
+ *  SERVER_INFO         gif is set to number of gifs,
+ *                      payload is "key=value" lines of server info.
+ *  SERVER_GIF_INFO     width and height are screen size of gif, pos is
+ *                      number of its images, payload is its filename.
+ *  SERVER_FRAME        count images of gif starting with pos. Negative
+ *                      pos counts from the end, -1 is the last image.
+ *                      Images of batch are made in one pass, images
+ *                      after the end of gif are not found.
+ *  SERVER_RANDOM       count random images of gif or of random gifs,
+ *                      if gif is negative.
+ *
+ *  Image payload is BGRX pixels (CAIRO_FORMAT_RGB24 on little endian)
+ *  with stride bytes per row. With SERVER_FLAG_SHM pixels are not
+ *  written to socket. Instead shared memory file descriptor of size
+ *  bytes is passed right after reply as SCM_RIGHTS message,
+ *  client maps it and closes.
+ */
+
+typedef enum ServerCommand {
+    SERVER_INFO = 1,
+    SERVER_GIF_INFO,
+    SERVER_FRAME,
+    SERVER_RANDOM
+} ServerCommand;
+
+typedef enum ServerStatus {
+    SERVER_OK = 0,
+    SERVER_BAD_REQUEST,     //Unknown command or too big batch
+    SERVER_NOT_FOUND,       //No such gif or image
+    SERVER_FAILED           //Error on server side
+} ServerStatus;
+
+#define SERVER_FLAG_SHM 0x01
+#define SERVER_MAX_BATCH 4096
+
+typedef struct ServerRequest {
+    guint32 command;
+    guint32 tag;            //Returned in replies
+    gint32 gif;
+    gint32 pos;
+    guint32 count;          //Images in batch, 0 is the same as 1
+    guint32 flags;
+} ServerRequest;
+
+typedef struct ServerReply {
+    guint32 status;
+    guint32 tag;
+    gint32 gif;
+    gint32 pos;
+    guint32 width, height;
+    guint32 stride;
+    guint32 size;           //Payload bytes
+} ServerReply;
+
+int serve (PContext c, const char *socket_path);
+
+/**
+ *  Removes socket left on path by previous run. Fails with warning
+ *  if path is anything else.
+ */
+int unlink_stale_socket (const char *path);
+/**
+ *  Removes path only if it is still the socket own was stat'ed from.
+ */
+void unlink_own_socket (const char *path, const struct stat *own);
+
+#endif /*SERVER_H*/
@@ -0,0 +1,309 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "shuffle.h"
+#include "trace.h"
+
+#include <glib/gstdio.h>
+
+#define SHUFFLE_ROUNDS 4
+//Position is saved after so many images
+#define SHUFFLE_SAVE_INTERVAL 16
+//Sets of gifs remembered in history
+#define SHUFFLE_HISTORY_SIZE 64
+
+struct GifShuffle {
+    PContext c;
+    int gifs;
+    guint64 *offsets;       //Number of first image of every gif
+    guint64 size;           //Images in all gifs
+    int half_bits;          //Feistel works on 2 * half_bits numbers
+    guint64 half_mask;
+    guint64 library;        //Hash of gifs set
+    guint64 seed;           //Key of current cycle
+    guint64 position;       //Images visited in current cycle
+    guint64 last;           //Last visited number
+    int unsaved;
+};
+
+static guint64
+shuffle_mix (guint64 x)
+{
+    x ^= x >> 30;
+    x *= G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= G_GUINT64_CONSTANT (0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+static guint64
+shuffle_permute (const GifShuffle *shuffle, guint64 x)
+{
+    guint64 left = x >> shuffle->half_bits;
+    guint64 right = x & shuffle->half_mask;
+    guint64 round_key, t;
+    int i;
+
+    for (i = 0; i < SHUFFLE_ROUNDS; ++i) {
+        round_key = shuffle_mix (shuffle->seed + i);
+        t = right;
+        right = left ^ (shuffle_mix (right ^ round_key) & shuffle->half_mask);
+        left = t;
+    }
+    return (left << shuffle->half_bits) | right;
+}
+
+/**
+ *  Permutation of [0, size). Numbers out of range are walked
+ *  through, cycle of permutation leads back into range.
+ */
+static guint64
+shuffle_walk (const GifShuffle *shuffle, guint64 x)
+{
+    do {
+        x = shuffle_permute (shuffle, x);
+    } while (x >= shuffle->size);
+    return x;
+}
+
+static guint64
+shuffle_library_hash (const GifShuffle *shuffle)
+{
+    guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+    const char *filename;
+    guint64 count;
+    int i, k;
+
+#define HASH_BYTE(b) \
+    hash = (hash ^ (guint8) (b)) * G_GUINT64_CONSTANT (0x100000001b3);
+
+    for (i = 0; i < shuffle->gifs; ++i) {
+        filename = get_gif_filename (shuffle->c, i);
+        for (; filename != NULL && *filename != '\0'; ++filename) {
+            HASH_BYTE (*filename);
+        }
+        HASH_BYTE (0);
+        count = shuffle->offsets[i + 1] - shuffle->offsets[i];
+        for (k = 0; k < 8; ++k) {
+            HASH_BYTE (count >> (k * 8));
+        }
+    }
+#undef HASH_BYTE
+    return hash;
+}
+
+static char *
+shuffle_history_filename (void)
+{
+    return g_build_filename (g_get_user_cache_dir (), 
+            "gifseeker", "shuffle-history", NULL);
+}
+
+/**
+ *  History is text file with line per set of gifs:
+ *      library seed position size
+ *  Most recent set goes first.
+ */
+static void
+shuffle_load (GifShuffle *shuffle)
+{
+    char *filename, *contents, **lines;
+    guint64 library, seed, position, size;
+    int i;
+
+    filename = shuffle_history_filename ();
+    if (!g_file_get_contents (filename, &contents, NULL, NULL)) {
+        g_free (filename);
+        return;
+    }
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i] != NULL; ++i) {
+        if (sscanf (lines[i], "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+                    " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+                    &library, &seed, &position, &size) == 4 &&
+                library == shuffle->library && size == shuffle->size &&
+                position <= size) {
+            shuffle->seed = seed;
+            shuffle->position = position;
+            break;
+        }
+    }
+    g_strfreev (lines);
+    g_free (contents);
+    g_free (filename);
+}
+
+static void
+shuffle_save (GifShuffle *shuffle)
+{
+    char *filename, *dirname, *contents = NULL, **lines = NULL;
+    guint64 library;
+    GString *history;
+    int i, count = 1;
+    TRACE_BEGIN (stamp);
+
+    shuffle->unsaved = 0;
+    filename = shuffle_history_filename ();
+    history = g_string_new (NULL);
+    g_string_append_printf (history, "%" G_GUINT64_FORMAT " %" 
+            G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT "\n",
+            shuffle->library, shuffle->seed, shuffle->position, shuffle->size);
+
+    if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 0; lines[i] != NULL && count < SHUFFLE_HISTORY_SIZE; ++i) {
+            if (sscanf (lines[i], "%" G_GUINT64_FORMAT, &library) == 1 &&
+                    library != shuffle->library) {
+                g_string_append_printf (history, "%s\n", lines[i]);
+                ++count;
+            }
+        }
+        g_strfreev (lines);
+        g_free (contents);
+    }
+
+    dirname = g_path_get_dirname (filename);
+    if (g_mkdir_with_parents (dirname, 0700) < 0 ||
+            !g_file_set_contents (filename, history->str, history->len, 
+                NULL)) {
+        put_warning ("Can not save shuffle history to '%s'", filename);
+    }
+    g_free (dirname);
+    g_string_free (history, TRUE);
+    g_free (filename);
+    TRACE_END (stamp, "shuffle_save");
+}
+
+void
+gif_shuffle_new_async (PContext c, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer user_data)
+{
+    //Counting is what takes time, it may decode gifs
+    count_all_gif_images_async (c, cancellable, callback, user_data);
+}
+
+GifShuffle *
+gif_shuffle_new_finish (PContext c, GAsyncResult *result, GError **error)
+{
+    GifShuffle *shuffle;
+    GArray *counts;
+    int i;
+
+    counts = count_all_gif_images_finish (c, result, error);
+    if (counts == NULL) {
+        return NULL;
+    }
+    shuffle = calloc (1, sizeof (GifShuffle));
+    if (shuffle == NULL) {
+        put_error (1, "Can not allocate memory for shuffle");
+    }
+    shuffle->c = c;
+    //Gifs added meanwhile are left for next shuffle
+    shuffle->gifs = counts->len;
+    shuffle->offsets = calloc (shuffle->gifs + 1, sizeof (guint64));
+    if (shuffle->offsets == NULL) {
+        put_error (1, "Can not allocate memory for shuffle");
+    }
+    for (i = 0; i < shuffle->gifs; ++i) {
+        shuffle->offsets[i + 1] = shuffle->offsets[i] + 
+            MAX (g_array_index (counts, int, i), 0);
+    }
+    g_array_unref (counts);
+    shuffle->size = shuffle->offsets[shuffle->gifs];
+
+    shuffle->half_bits = 1;
+    while (shuffle->half_bits < 32 &&
+            (G_GUINT64_CONSTANT (1) << (2 * shuffle->half_bits)) < 
+                shuffle->size) {
+        ++shuffle->half_bits;
+    }
+    shuffle->half_mask = (G_GUINT64_CONSTANT (1) << shuffle->half_bits) - 1;
+
+    shuffle->library = shuffle_library_hash (shuffle);
+    shuffle->seed = (guint64) g_random_int () << 32 | g_random_int ();
+    shuffle->position = 0;
+    shuffle->last = G_MAXUINT64;
+    shuffle_load (shuffle);
+    return shuffle;
+}
+
+void
+gif_shuffle_free (GifShuffle *shuffle)
+{
+    if (shuffle->unsaved > 0) {
+        shuffle_save (shuffle);
+    }
+    free (shuffle->offsets);
+    free (shuffle);
+}
+
+int
+gif_shuffle_next (GifShuffle *shuffle, int *gif, int *gif_pos)
+{
+    guint64 number;
+    int low, high, middle;
+
+    if (shuffle->size == 0) {
+        return -1;
+    }
+    if (shuffle->position >= shuffle->size) {
+        //New cycle must not start with the image just shown
+        do {
+            shuffle->seed = shuffle_mix (shuffle->seed + 1);
+        } while (shuffle->size > 1 && 
+                shuffle_walk (shuffle, 0) == shuffle->last);
+        shuffle->position = 0;
+    }
+    number = shuffle_walk (shuffle, shuffle->position++);
+    shuffle->last = number;
+
+    //Last gif, which starts not after number
+    low = 0;
+    high = shuffle->gifs - 1;
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (shuffle->offsets[middle] <= number) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    *gif = low;
+    *gif_pos = number - shuffle->offsets[low];
+
+    if (++shuffle->unsaved >= SHUFFLE_SAVE_INTERVAL ||
+            shuffle->position == shuffle->size) {
+        shuffle_save (shuffle);
+    }
+    return 0;
+}
+
+guint64
+gif_shuffle_size (const GifShuffle *shuffle)
+{
+    return shuffle->size;
+}
+
+guint64
+gif_shuffle_position (const GifShuffle *shuffle)
+{
+    return shuffle->position;
+}
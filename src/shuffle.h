@@ -0,0 +1,54 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SHUFFLE_H
+#define SHUFFLE_H
+
+#include "gifseeker.h"
+
+/**
+ *  No-repeat shuffle of all images of context.
+ *
+ *  Images of all gifs are numbered one after another. Shuffle walks
+ *  keyed pseudo-random permutation of these numbers: balanced Feistel
+ *  network on the nearest even power of two, cycle walking skips
+ *  numbers out of range. Every image is visited exactly once per cycle,
+ *  next cycle uses new key. Only key and position are stored.
+ *
+ *  Key and position are saved in history file in user cache directory
+ *  for every set of gifs, so shuffle is resumed in later session.
+ *  Images are counted with count_gif_images, so gifs are not decoded.
+ *  It takes reading all files, so gif_shuffle_new_async counts them
+ *  in background and calls back in main loop, there call
+ *  gif_shuffle_new_finish to get the shuffle.
+ */
+
+typedef struct GifShuffle GifShuffle;
+
+void gif_shuffle_new_async (PContext c, GCancellable *cancellable,
+        GAsyncReadyCallback callback, gpointer user_data);
+GifShuffle *gif_shuffle_new_finish (PContext c, GAsyncResult *result,
+        GError **error);
+void gif_shuffle_free (GifShuffle *shuffle);
+int gif_shuffle_next (GifShuffle *shuffle, int *gif, int *gif_pos);
+guint64 gif_shuffle_size (const GifShuffle *shuffle);
+guint64 gif_shuffle_position (const GifShuffle *shuffle);
+
+#endif /*SHUFFLE_H*/
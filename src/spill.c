@@ -0,0 +1,297 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "spill.h"
+#include "trace.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SPILL_MAGIC "GIFSPILL"
+#define SPILL_VERSION 1
+//Slots start at page boundary
+#define SPILL_HEADER_SIZE 4096
+
+typedef struct SpillHeader {
+    char magic[8];
+    guint32 version;
+    guint32 clean;          //Store was closed, slots are whole
+    guint64 slot_size;
+    guint64 slot_count;
+    guint64 next;           //Slot to be overwritten next
+} SpillHeader;
+
+typedef struct SpillSlot {
+    guint64 gif_id;         //0 if slot is free
+    gint32 gif_pos;
+    guint32 size;           //Bytes of record after slot header
+} SpillSlot;
+
+struct SpillStore {
+    GMutex lock;
+    int fd;
+    byte *map;
+    size_t map_size;
+    SpillHeader *header;
+    GHashTable *slots;      //Slot header to slot number
+};
+
+#define get_slot(store, i) ((SpillSlot *) ((store)->map + \
+        SPILL_HEADER_SIZE + (size_t) (i) * (store)->header->slot_size))
+
+static guint
+slot_hash (gconstpointer key)
+{
+    const SpillSlot *slot = (const SpillSlot *) key;
+    return (guint) (slot->gif_id ^ (slot->gif_id >> 32)) ^ 
+            ((guint) slot->gif_pos * 2654435761u);
+}
+
+static gboolean
+slot_equal (gconstpointer a, gconstpointer b)
+{
+    const SpillSlot *slot_a = (const SpillSlot *) a;
+    const SpillSlot *slot_b = (const SpillSlot *) b;
+    return slot_a->gif_id == slot_b->gif_id && 
+            slot_a->gif_pos == slot_b->gif_pos;
+}
+
+/**
+ *  Checks, that store of previous session may be used.
+ */
+static gboolean
+spill_reusable (int fd, size_t slot_count)
+{
+    SpillHeader header;
+    struct stat st;
+
+    if (fstat (fd, &st) != 0 || (size_t) st.st_size != SPILL_HEADER_SIZE +
+            slot_count * SPILL_SLOT_SIZE) {
+        return FALSE;
+    }
+    if (pread (fd, &header, sizeof (SpillHeader), 0) != 
+            sizeof (SpillHeader)) {
+        return FALSE;
+    }
+    return memcmp (header.magic, SPILL_MAGIC, sizeof (header.magic)) == 0 &&
+            header.version == SPILL_VERSION && header.clean &&
+            header.slot_size == SPILL_SLOT_SIZE &&
+            header.slot_count == slot_count && header.next < slot_count;
+}
+
+SpillStore *
+spill_open (const char *filename, size_t size)
+{
+    SpillStore *store;
+    size_t slot_count, i;
+    gboolean reuse;
+    char *dirname;
+    int fd;
+    TRACE_BEGIN (stamp);
+
+    slot_count = size > SPILL_HEADER_SIZE ? 
+            (size - SPILL_HEADER_SIZE) / SPILL_SLOT_SIZE : 0;
+    if (slot_count == 0) {
+        put_warning ("Spill store must be bigger than %d MiB",
+                SPILL_SLOT_SIZE >> 20);
+        return NULL;
+    }
+
+    dirname = g_path_get_dirname (filename);
+    g_mkdir_with_parents (dirname, 0700);
+    g_free (dirname);
+
+    fd = open (filename, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        put_warning ("Can not open spill store '%s'", filename);
+        return NULL;
+    }
+    if (flock (fd, LOCK_EX | LOCK_NB) != 0) {
+        put_warning ("Spill store '%s' is used by other process", filename);
+        close (fd);
+        return NULL;
+    }
+
+    reuse = spill_reusable (fd, slot_count);
+    if (!reuse && ftruncate (fd, 0) != 0) {
+        put_warning ("Can not allocate spill store '%s'", filename);
+        close (fd);
+        return NULL;
+    }
+    //Disk space is reserved, so writes to mapping do not fault
+    //with SIGBUS on full disk
+    if (posix_fallocate (fd, 0, 
+                SPILL_HEADER_SIZE + slot_count * SPILL_SLOT_SIZE) != 0) {
+        put_warning ("Can not allocate spill store '%s'", filename);
+        close (fd);
+        return NULL;
+    }
+
+    store = calloc (1, sizeof (SpillStore));
+    if (store == NULL) {
+        put_error (1, "Can not allocate memory for spill store");
+    }
+    store->fd = fd;
+    store->map_size = SPILL_HEADER_SIZE + slot_count * SPILL_SLOT_SIZE;
+    store->map = mmap (NULL, store->map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    if (store->map == MAP_FAILED) {
+        put_warning ("Can not map spill store '%s'", filename);
+        close (fd);
+        free (store);
+        return NULL;
+    }
+    store->header = (SpillHeader *) store->map;
+    g_mutex_init (&store->lock);
+    store->slots = g_hash_table_new (slot_hash, slot_equal);
+
+    if (reuse) {
+        for (i = 0; i < slot_count; ++i) {
+            if (get_slot (store, i)->size > 
+                    SPILL_SLOT_SIZE - sizeof (SpillSlot)) {
+                get_slot (store, i)->gif_id = 0;
+            }
+            if (get_slot (store, i)->gif_id != 0) {
+                g_hash_table_replace (store->slots, get_slot (store, i),
+                        GSIZE_TO_POINTER (i));
+            }
+        }
+    } else {
+        memcpy (store->header->magic, SPILL_MAGIC, 
+                sizeof (store->header->magic));
+        store->header->version = SPILL_VERSION;
+        store->header->slot_size = SPILL_SLOT_SIZE;
+        store->header->slot_count = slot_count;
+        store->header->next = 0;
+    }
+    //Slots may be torn until spill_close
+    store->header->clean = FALSE;
+    msync (store->map, SPILL_HEADER_SIZE, MS_SYNC);
+
+    TRACE_END (stamp, "spill_open");
+    return store;
+}
+
+void
+spill_close (SpillStore *store)
+{
+    if (store == NULL) {
+        return;
+    }
+    //Slots must reach disk before they are declared whole
+    msync (store->map, store->map_size, MS_SYNC);
+    store->header->clean = TRUE;
+    msync (store->map, SPILL_HEADER_SIZE, MS_SYNC);
+
+    munmap (store->map, store->map_size);
+    close (store->fd);
+    g_hash_table_destroy (store->slots);
+    g_mutex_clear (&store->lock);
+    free (store);
+}
+
+gboolean
+spill_put (SpillStore *store, guint64 gif_id, int gif_pos,
+        const GOutputVector *vectors, int count)
+{
+    SpillSlot key = {gif_id, gif_pos, 0}, *slot;
+    gpointer value;
+    size_t size = 0, index;
+    byte *data;
+    int i;
+    TRACE_BEGIN (stamp);
+
+    for (i = 0; i < count; ++i) {
+        size += vectors[i].size;
+    }
+    if (gif_id == 0 || size > SPILL_SLOT_SIZE - sizeof (SpillSlot)) {
+        return FALSE;
+    }
+
+    g_mutex_lock (&store->lock);
+    if (g_hash_table_lookup_extended (store->slots, &key, NULL, &value)) {
+        index = GPOINTER_TO_SIZE (value);
+    } else {
+        index = store->header->next;
+        store->header->next = (index + 1) % store->header->slot_count;
+    }
+    slot = get_slot (store, index);
+    if (slot->gif_id != 0) {
+        g_hash_table_remove (store->slots, slot);
+    }
+
+    slot->gif_id = 0;
+    data = (byte *) (slot + 1);
+    for (i = 0; i < count; ++i) {
+        memcpy (data, vectors[i].buffer, vectors[i].size);
+        data += vectors[i].size;
+    }
+    slot->gif_pos = gif_pos;
+    slot->size = size;
+    slot->gif_id = gif_id;
+    g_hash_table_replace (store->slots, slot, GSIZE_TO_POINTER (index));
+    g_mutex_unlock (&store->lock);
+
+    TRACE_END (stamp, "spill_put");
+    return TRUE;
+}
+
+void *
+spill_get (SpillStore *store, guint64 gif_id, int gif_pos, size_t *size)
+{
+    SpillSlot key = {gif_id, gif_pos, 0}, *slot;
+    gpointer value;
+    void *record = NULL;
+    TRACE_BEGIN (stamp);
+
+    g_mutex_lock (&store->lock);
+    if (gif_id != 0 &&
+            g_hash_table_lookup_extended (store->slots, &key, NULL, &value)) {
+        slot = get_slot (store, GPOINTER_TO_SIZE (value));
+        record = malloc (slot->size);
+        if (record != NULL) {
+            memcpy (record, slot + 1, slot->size);
+            *size = slot->size;
+        }
+    }
+    g_mutex_unlock (&store->lock);
+
+    TRACE_END (stamp, "spill_get");
+    return record;
+}
+
+void
+spill_remove (SpillStore *store, guint64 gif_id, int gif_pos)
+{
+    SpillSlot key = {gif_id, gif_pos, 0}, *slot;
+    gpointer value;
+
+    g_mutex_lock (&store->lock);
+    if (gif_id != 0 &&
+            g_hash_table_lookup_extended (store->slots, &key, NULL, &value)) {
+        slot = get_slot (store, GPOINTER_TO_SIZE (value));
+        g_hash_table_remove (store->slots, slot);
+        slot->gif_id = 0;
+    }
+    g_mutex_unlock (&store->lock);
+}
@@ -0,0 +1,55 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "gifseeker.h"
+
+/**
+ *  Store of records on disk. Used by snapshoot cache as the tier
+ *  below the packed one.
+ *
+ *  Store is a file of fixed size slots mapped into memory. Record is
+ *  identified by gif id and position, it takes one slot and records
+ *  bigger than slot are not stored. Slots are overwritten in ring
+ *  order. spill_get copies record out of the mapping, so revisiting
+ *  costs page-in only, spill_remove frees slot of broken record.
+ *  Disk space of whole store is reserved on open. Store is kept
+ *  between sessions, gif id must change together with the file.
+ *  Store of process, which did not close it, is dropped on open.
+ *  File is locked, so other process gets NULL from spill_open.
+ *  All functions are thread safe.
+ */
+
+typedef struct SpillStore SpillStore;
+
+#define SPILL_SLOT_SIZE (2 << 20)
+
+SpillStore *spill_open (const char *filename, size_t size);
+void spill_close (SpillStore *store);
+
+gboolean spill_put (SpillStore *store, guint64 gif_id, int gif_pos,
+        const GOutputVector *vectors, int count);
+void *spill_get (SpillStore *store, guint64 gif_id, int gif_pos,
+        size_t *size);
+void spill_remove (SpillStore *store, guint64 gif_id, int gif_pos);
+
+#endif /*SPILL_H*/
@@ -0,0 +1,133 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "trace.h"
+#include "gifseeker.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+//Must be power of two
+#define TRACE_BUFFER_SIZE (1 << 16)
+#define TRACE_BUFFER_MASK (TRACE_BUFFER_SIZE - 1)
+
+typedef struct TraceEvent {
+    volatile gint seq;      //Number of slot write + 1, 0 while writing
+    const char *name;
+    gint64 begin, end;
+    int tid;
+} TraceEvent;
+
+static TraceEvent trace_buffer [TRACE_BUFFER_SIZE];
+static volatile gint trace_head = 0;
+static volatile gint trace_last_tid = 0;
+static __thread int trace_tid = 0;
+
+gint64
+trace_now (void)
+{
+    return g_get_monotonic_time ();
+}
+
+gboolean
+trace_enabled (void)
+{
+#ifdef ENABLE_TRACE
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void
+trace_event (const char *name, gint64 begin, gint64 end)
+{
+    TraceEvent *event;
+    gint seq;
+
+    if (trace_tid == 0) {
+        trace_tid = g_atomic_int_add (&trace_last_tid, 1) + 1;
+    }
+    //Reserve slot. Oldest events are overwritten when buffer is full.
+    seq = g_atomic_int_add (&trace_head, 1);
+    event = &trace_buffer[seq & TRACE_BUFFER_MASK];
+
+    g_atomic_int_set (&event->seq, 0);
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    event->tid = trace_tid;
+    g_atomic_int_set (&event->seq, seq + 1);
+}
+
+int
+trace_dump (const char *filename)
+{
+    FILE *file;
+    gint head, first, i;
+    gint64 base = G_MAXINT64;
+    TraceEvent *event;
+    gboolean separator = FALSE;
+    int pid = getpid ();
+
+    if (!trace_enabled ()) {
+        put_warning ("Tracing is not built in. "
+                "Reconfigure with --enable-trace.");
+        return -1;
+    }
+
+    file = fopen (filename, "w");
+    if (file == NULL) {
+        put_warning ("Can not open trace file '%s'", filename);
+        return -1;
+    }
+
+    head = g_atomic_int_get (&trace_head);
+    first = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+
+    for (i = first; i < head; ++i) {
+        event = &trace_buffer[i & TRACE_BUFFER_MASK];
+        if (g_atomic_int_get (&event->seq) == i + 1 && event->begin < base) {
+            base = event->begin;
+        }
+    }
+
+    fprintf (file, "{\"traceEvents\":[\n");
+    for (i = first; i < head; ++i) {
+        event = &trace_buffer[i & TRACE_BUFFER_MASK];
+        //Skip slots, which are being written or were overwritten
+        if (g_atomic_int_get (&event->seq) != i + 1) {
+            continue;
+        }
+        fprintf (file, "%s{\"name\":\"%s\",\"cat\":\"gifseeker\","
+                "\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ","
+                "\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d}",
+                separator ? ",\n" : "",
+                event->name, event->begin - base,
+                event->end - event->begin, pid, event->tid);
+        separator = TRUE;
+    }
+    fprintf (file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fclose (file) != 0) {
+        put_warning ("Can not write trace file '%s'", filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../config.h"
+
+#include <glib.h>
+
+/**
+ *  Trace points. Each phase is wrapped with
+ *
+ *      TRACE_BEGIN (stamp);
+ *      ...
+ *      TRACE_END (stamp, "phase_name");
+ *
+ *  Events go to the lock-free ring buffer and may be saved
+ *  with trace_dump in Chrome trace-event format (chrome://tracing).
+ *  Configure with --enable-trace to build trace points in, otherwise
+ *  macroses expand to nothing.
+ *  Phase name must be a static string.
+ */
+
+#ifdef ENABLE_TRACE
+#define TRACE_BEGIN(stamp) \
+    gint64 stamp = trace_now ()
+#define TRACE_END(stamp, name) \
+    trace_event ((name), (stamp), trace_now ())
+#else
+#define TRACE_BEGIN(stamp)
+#define TRACE_END(stamp, name)
+#endif
+
+gint64 trace_now (void);
+void trace_event (const char *name, gint64 begin, gint64 end);
+gboolean trace_enabled (void);
+int trace_dump (const char *filename);
+
+#endif /*TRACE_H*/
@@ -0,0 +1,276 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "video.h"
+#include "trace.h"
+
+#include <signal.h>
+
+//Faster images are slowed down like browsers do
+#define VIDEO_MIN_DELAY 2
+#define VIDEO_FAST_DELAY 10
+
+typedef struct VideoFrame {
+    byte *data;
+    int repeat;             //Times frame is written, 0 ends the stream
+} VideoFrame;
+
+typedef struct VideoExport {
+    PContext c;
+    VideoFormat format;
+    int fps;
+    int width, height;
+    size_t frame_size;
+    VideoFrame frames[VIDEO_QUEUE_SIZE];
+    GAsyncQueue *free_frames;
+    GAsyncQueue *ready_frames;  //In order of writing
+    guint32 *canvas;        //Image of other size centered on video
+    int gif;                //Gif being composed
+    gint64 time;            //Hundredths of second since start
+    gint64 planned;         //Frames sent to writing
+    volatile gint failed;   //Writing failed, composing must stop
+} VideoExport;
+
+/**
+ *  Puts image of other size into the middle of video canvas.
+ */
+static void
+video_center (VideoExport *video, const unsigned char *pixels,
+        int width, int height, int stride)
+{
+    int x = (video->width - width) / 2, y = (video->height - height) / 2;
+    int dst_x = MAX (x, 0), dst_y = MAX (y, 0);
+    int src_x = MAX (-x, 0), src_y = MAX (-y, 0);
+    int w = MIN (width - src_x, video->width - dst_x);
+    int h = MIN (height - src_y, video->height - dst_y);
+    int i;
+
+    memset (video->canvas, 0, (size_t) video->width * video->height * 4);
+    for (i = 0; i < h; ++i) {
+        memcpy (video->canvas + (size_t) (dst_y + i) * video->width + dst_x,
+                pixels + (size_t) (src_y + i) * stride + src_x * 4, 
+                (size_t) w * 4);
+    }
+}
+
+/**
+ *  Converts BGRX pixels to planar BT.601 YUV 4:4:4.
+ */
+static void
+video_to_yuv (const VideoExport *video, const unsigned char *pixels,
+        int stride, byte *dst)
+{
+    size_t plane = (size_t) video->width * video->height;
+    byte *y_plane = dst, *u_plane = dst + plane, *v_plane = dst + 2 * plane;
+    const guint32 *row;
+    int x, y, r, g, b;
+
+    for (y = 0; y < video->height; ++y) {
+        row = (const guint32 *) (pixels + (size_t) y * stride);
+        for (x = 0; x < video->width; ++x) {
+            r = (row[x] >> 16) & 0xff;
+            g = (row[x] >> 8) & 0xff;
+            b = row[x] & 0xff;
+            *y_plane++ = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            *u_plane++ = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            *v_plane++ = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+}
+
+static gboolean
+on_video_image (int gif_pos, const unsigned char *pixels,
+        int width, int height, int stride, gpointer data)
+{
+    VideoExport *video = (VideoExport *) data;
+    VideoFrame *frame;
+    gint64 target;
+    int delay, y;
+
+    delay = get_gif_image_delay (video->c, video->gif, gif_pos);
+    if (delay < VIDEO_MIN_DELAY) {
+        delay = VIDEO_FAST_DELAY;
+    }
+    //Frame is shown until the time of the next image
+    video->time += delay;
+    target = video->time * video->fps / 100;
+    if (target <= video->planned) {
+        return !g_atomic_int_get (&video->failed);
+    }
+    TRACE_BEGIN (stamp);
+
+    if (width != video->width || height != video->height) {
+        video_center (video, pixels, width, height, stride);
+        pixels = (const unsigned char *) video->canvas;
+        stride = video->width * 4;
+    }
+
+    //Waits, while writer is behind
+    frame = (VideoFrame *) g_async_queue_pop (video->free_frames);
+    if (video->format == VIDEO_Y4M) {
+        video_to_yuv (video, pixels, stride, frame->data);
+    } else {
+        for (y = 0; y < video->height; ++y) {
+            memcpy (frame->data + (size_t) y * video->width * 4,
+                    pixels + (size_t) y * stride, (size_t) video->width * 4);
+        }
+    }
+    frame->repeat = target - video->planned;
+    video->planned = target;
+    g_async_queue_push (video->ready_frames, frame);
+
+    TRACE_END (stamp, "video_image");
+    return !g_atomic_int_get (&video->failed);
+}
+
+static gpointer
+video_compose (gpointer data)
+{
+    VideoExport *video = (VideoExport *) data;
+    VideoFrame *frame;
+    int count = get_gif_count (video->c);
+
+    for (video->gif = 0; video->gif < count && 
+            !g_atomic_int_get (&video->failed); ++video->gif) {
+        if (get_snapshoot_range (video->c, video->gif, 0, G_MAXINT,
+                    GIF_RANGE_COMPOSITE, NULL, 0, on_video_image, video) < 0) {
+            put_warning ("Gif %d can not be decoded, it is skipped",
+                    video->gif);
+        }
+    }
+
+    frame = (VideoFrame *) g_async_queue_pop (video->free_frames);
+    frame->repeat = 0;
+    g_async_queue_push (video->ready_frames, frame);
+    return NULL;
+}
+
+static gboolean
+video_write (VideoExport *video, FILE *file, const VideoFrame *frame)
+{
+    int i;
+    TRACE_BEGIN (stamp);
+
+    for (i = 0; i < frame->repeat; ++i) {
+        if (video->format == VIDEO_Y4M && fputs ("FRAME\n", file) == EOF) {
+            return FALSE;
+        }
+        if (fwrite (frame->data, 1, video->frame_size, file) != 
+                video->frame_size) {
+            return FALSE;
+        }
+    }
+    TRACE_END (stamp, "video_write");
+    return TRUE;
+}
+
+int
+export_video (const PContext c, const char *filename, 
+        VideoFormat format, int fps)
+{
+    VideoExport video;
+    VideoFrame *frame;
+    GThread *thread;
+    FILE *file;
+    int i;
+
+    if (get_gif_count (c) == 0) {
+        put_warning ("There is no gif to export");
+        return -1;
+    }
+    if (fps <= 0) {
+        put_warning ("Wrong frame rate %d", fps);
+        return -1;
+    }
+
+    memset (&video, 0, sizeof (VideoExport));
+    video.c = c;
+    video.format = format;
+    video.fps = fps;
+    get_gif_screen_size (c, 0, &video.width, &video.height);
+    video.frame_size = (size_t) video.width * video.height * 
+            (format == VIDEO_Y4M ? 3 : 4);
+
+    if (strcmp (filename, "-") == 0) {
+        file = stdout;
+    } else {
+        file = fopen (filename, "wb");
+        if (file == NULL) {
+            put_warning ("Can not open file '%s'", filename);
+            return -1;
+        }
+    }
+    //Encoder may quit early, then writing just fails
+    signal (SIGPIPE, SIG_IGN);
+
+    video.free_frames = g_async_queue_new ();
+    video.ready_frames = g_async_queue_new ();
+    for (i = 0; i < VIDEO_QUEUE_SIZE; ++i) {
+        video.frames[i].data = malloc (video.frame_size);
+        if (video.frames[i].data == NULL) {
+            put_error (1, "Can not allocate memory for video frames");
+        }
+        g_async_queue_push (video.free_frames, video.frames + i);
+    }
+    video.canvas = malloc ((size_t) video.width * video.height * 4);
+    if (video.canvas == NULL) {
+        put_error (1, "Can not allocate memory for video frames");
+    }
+
+    if (format == VIDEO_Y4M) {
+        fprintf (file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                video.width, video.height, fps);
+    } else {
+        fprintf (stderr, "Raw video: -f rawvideo -pixel_format bgr0 "
+                "-video_size %dx%d -framerate %d\n", 
+                video.width, video.height, fps);
+    }
+
+    thread = g_thread_new ("video_compose", video_compose, &video);
+    //Frames are returned to composer even after failure to let it stop
+    while ((frame = (VideoFrame *) g_async_queue_pop (
+                    video.ready_frames))->repeat > 0) {
+        if (!g_atomic_int_get (&video.failed) && 
+                !video_write (&video, file, frame)) {
+            put_warning ("Can not write video to '%s'", filename);
+            g_atomic_int_set (&video.failed, TRUE);
+        }
+        g_async_queue_push (video.free_frames, frame);
+    }
+    g_thread_join (thread);
+
+    if (file == stdout) {
+        if (fflush (file) != 0 && !video.failed) {
+            put_warning ("Can not write video to '%s'", filename);
+            video.failed = TRUE;
+        }
+    } else if (fclose (file) != 0 && !video.failed) {
+        put_warning ("Can not write video to '%s'", filename);
+        video.failed = TRUE;
+    }
+
+    for (i = 0; i < VIDEO_QUEUE_SIZE; ++i) {
+        free (video.frames[i].data);
+    }
+    free (video.canvas);
+    g_async_queue_unref (video.free_frames);
+    g_async_queue_unref (video.ready_frames);
+    return video.failed ? -1 : 0;
+}
@@ -0,0 +1,52 @@
+/* Gif Seeker is a simple tool for gif files seeking.
+ * Copyright (C) 2013  Shvedov Yury
+ *
+ * This file is part of Gif Seeker.
+ *
+ * Gif Seeker is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Gif Seeker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Devil.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include "gifseeker.h"
+
+/**
+ *  Raw video stream of all gifs of context for video encoders.
+ *
+ *  Images are composed like animation and written one after another
+ *  at constant frame rate. Image is repeated or dropped to keep its
+ *  delay, delays below 2 hundredths of second are taken as 10 like
+ *  browsers do. Video has size of the first gif, others are centered.
+ *  Images are composed in separate thread, while previous ones are
+ *  written, only VIDEO_QUEUE_SIZE frames are kept in memory.
+ *
+ *  VIDEO_Y4M is YUV4MPEG2 stream with 4:4:4 BT.601 frames.
+ *  VIDEO_RAW is headerless BGRX frames, ffmpeg pixel format bgr0.
+ *  Filename "-" is standard output. Returns 0 on success.
+ */
+
+typedef enum VideoFormat {
+    VIDEO_Y4M,
+    VIDEO_RAW
+} VideoFormat;
+
+#define VIDEO_QUEUE_SIZE 4
+#define VIDEO_DEFAULT_FPS 25
+
+int export_video (const PContext c, const char *filename, 
+        VideoFormat format, int fps);
+
+#endif /*VIDEO_H*/